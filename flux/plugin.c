@@ -18,14 +18,25 @@
  *    "verbose":int,
  *    "smt":int,
  *    "greedy":int,
+ *    "llc":int,
+ *    "cpukinds":int,
+ *    "auto":int,
  *    "gpu_optim":int,
- *    "master":int
+ *    "leader":"[<task>][:core|l3|numa]",
+ *    "master":int,
+ *    "membind":"none|bind|interleave|preferred",
+ *    "reserve":"N[:node|package|numa][:first|last]"
  *  }
  *
  * Examples:
  *   Disable mpibind plugin: '-o mpibind=off'
  *   Enable SMT2 and verbosity: '-o mpibind=smt:2,verbose:1'
  *   Enable debugging messages: '-o verbose'
+ *   Bind memory to the local NUMA domains: '-o mpibind=membind'
+ *   Leave the last core of each package to the OS:
+ *     '-o mpibind=reserve:1:package'
+ *   Give task 0 a NUMA domain of its own: '-o mpibind=leader:numa'
+ *   Choose the best of several candidate mappings: '-o mpibind=auto'
  *
  *  OPERATION
  *
@@ -80,9 +91,19 @@
 struct usr_opts {
   int smt;
   int greedy;
+  int llc;
+  int cpukinds;
+  int auto_map;
   int gpu_optim;
   int verbose;
+  int leader;
+  int leader_domain;
   int master;
+  int membind;
+  int reserve;
+  int reserve_domain;
+  int reserve_end;
+  int nics;
   int omp_proc_bind;
   int omp_places;
   int visible_devices;
@@ -150,7 +171,7 @@ int mpibind_task_init(flux_plugin_t *p, const char *topic,
 		       flux_plugin_arg_t *arg, void *data)
 {
   int nvars, i;
-  char **env_var_values;
+  char *env_var_value;
 
   //mpibind_t *mph = data;
   struct handle_and_opts *hdl = data;
@@ -167,15 +188,18 @@ int mpibind_task_init(flux_plugin_t *p, const char *topic,
 	 (!strcmp(env_var_names[i], "OMP_PROC_BIND") &&
 	  hdl->opts->omp_proc_bind) ||
 	 (strstr(env_var_names[i], "VISIBLE_DEVICES") &&
-	  hdl->opts->visible_devices) )
+	  hdl->opts->visible_devices) ||
+	 ((!strcmp(env_var_names[i], "UCX_NET_DEVICES") ||
+	   !strcmp(env_var_names[i], "FI_CXI_DEVICE_NAME")) &&
+	  hdl->opts->nics) )
       continue;
 
-    env_var_values = mpibind_get_env_var_values(hdl->mph,
-						env_var_names[i]);
-    if (env_var_values[taskid]) {
+    env_var_value = mpibind_get_env_var_ptask(hdl->mph, taskid,
+					      env_var_names[i]);
+    if (env_var_value) {
       shell_debug("task %2d: setting %s=%s\n", taskid,
-		  env_var_names[i], env_var_values[taskid]);
-      plugin_task_setenv(p, env_var_names[i], env_var_values[taskid]);
+		  env_var_names[i], env_var_value);
+      plugin_task_setenv(p, env_var_names[i], env_var_value);
     }
   }
 
@@ -199,6 +223,17 @@ int mpibind_task_init(flux_plugin_t *p, const char *topic,
  *    opt->verbose.
  */
 
+/*
+ * Log the mapping one task at a time
+ * (see mpibind_mapping_write).
+ */
+static
+int log_mapping_line(const char *line, void *arg)
+{
+  shell_log("%s", line);
+  return 0;
+}
+
 /*
  * Handler for task.exec.
  * Applies mpibind mappings for each task.
@@ -229,6 +264,12 @@ int mpibind_task(flux_plugin_t *p, const char *topic,
     shell_die(1, "failed to apply mpibind affinity");
   }
 
+  if (taskid == 0) {
+    char outbuf[LONG_STR_SIZE];
+    mpibind_timers_snprint(outbuf, sizeof(outbuf), mph);
+    shell_debug("task %2d: %s", taskid, outbuf);
+  }
+
   return 0;
 }
 
@@ -238,9 +279,11 @@ int mpibind_task(flux_plugin_t *p, const char *topic,
  */
 static
 bool mpibind_getopt(flux_shell_t *shell,
-		    int *psmt, int *pgreedy, int *pgpu_optim,
-		    int *pverbose, int *pmaster,
-		    int *pomp_proc_bind, int *pomp_places,
+		    int *psmt, int *pgreedy, int *pllc, int *pcpukinds,
+		    int *pauto, int *pgpu_optim, int *pleader, int *pleader_domain,
+		    int *pverbose, int *pmaster, int *pmembind,
+		    int *pnics, int *pomp_proc_bind, int *pomp_places,
+		    int *preserve, int *preserve_domain, int *preserve_end,
 		    int *pvisible_devices)
 {
   int rc;
@@ -248,6 +291,9 @@ bool mpibind_getopt(flux_shell_t *shell,
   char *json_str = NULL;
   json_t *opts = NULL;
   json_error_t err;
+  const char *membind = NULL;
+  const char *reserve = NULL;
+  const char *leader = NULL;
 
   rc = flux_shell_getopt(shell, "mpibind", &json_str);
   if (rc < 0) {
@@ -259,16 +305,32 @@ bool mpibind_getopt(flux_shell_t *shell,
   }
   opts = json_loads(json_str, 0, &err);
 
-  if ( opts )
+  if ( opts ) {
     /* Take parameters from json */
     json_unpack_ex(opts, &err, JSON_DECODE_ANY,
-		   "{s?i s?i s?i s?i s?i}",
+		   "{s?i s?i s?i s?i s?i s?i s?i s?i s?s s?s s?s}",
 		   "smt", psmt,
 		   "greedy", pgreedy,
+		   "llc", pllc,
+		   "cpukinds", pcpukinds,
+		   "auto", pauto,
 		   "gpu_optim", pgpu_optim,
 		   "verbose", pverbose,
-		   "master", pmaster);
-  else
+		   "master", pmaster,
+		   "membind", &membind,
+		   "reserve", &reserve,
+		   "leader", &leader);
+    if ( membind &&
+	 (*pmembind = mpibind_parse_membind(membind)) < 0 )
+      shell_die(1, "invalid membind policy: %s", membind);
+    if ( reserve &&
+	 mpibind_parse_reserved(reserve, preserve, preserve_domain,
+				preserve_end) )
+      shell_die(1, "invalid core reservation: %s", reserve);
+    if ( leader &&
+	 mpibind_parse_leader(leader, pleader, pleader_domain) )
+      shell_die(1, "invalid leader task: %s", leader);
+  } else
     /* Check if options were given to mpibind.
        If no options, proceed with default parameters */
     if ( strcmp(json_str, "1") != 0 ) {
@@ -296,12 +358,22 @@ bool mpibind_getopt(flux_shell_t *shell,
       while (token != NULL) {
 	//shell_debug("token = %s", token);
 	msg = mpibind_parse_option(token,
+				   pauto,
+				   pcpukinds,
 				   &debug,
 				   pgpu_optim,
 				   pgreedy,
+				   pleader,
+				   pleader_domain,
+				   pllc,
 				   pmaster,
+				   pmembind,
+				   pnics,
 				   pomp_places,
 				   pomp_proc_bind,
+				   preserve,
+				   preserve_domain,
+				   preserve_end,
 				   psmt,
 				   &turn_on,
 				   pverbose,
@@ -496,7 +568,8 @@ int mpibind_shell_init(flux_plugin_t *p, const char *s,
   mpibind_t *mph = NULL;
   struct usr_opts *opts = data;
   bool restrict_topo = true;
-  const char *xml;
+  const char *xml, *cache = NULL;
+  double load_usecs;
   flux_shell_t *shell = flux_plugin_get_shell(p);
 
   if ( mpibind_init(&mph) != 0 || mph == NULL ) {
@@ -577,11 +650,19 @@ int mpibind_shell_init(flux_plugin_t *p, const char *s,
         return shell_log_errno("hwloc_topology_set_xml(%s)", xml);
       shell_debug("Loaded topology from %s", xml);
     }
+    /* Discovering the topology dynamically: keep a node-local
+       snapshot of it if MPIBIND_TOPO_CACHE is set */
+    else if ((cache = flux_shell_getenv(shell, "MPIBIND_TOPO_CACHE"))
+	     && cache[0] != '\0')
+      shell_debug("Using topology snapshot %s", cache);
+    else
+      cache = NULL;
   }
 
 #if 1
-  if (mpibind_load_topology(topo) != 0)
+  if (mpibind_load_topology_cached(topo, cache, &load_usecs) != 0)
     return shell_log_errno("mpibind_load_topology");
+  shell_debug("Loaded topology in %.0f us", load_usecs);
 #else
   /* Make sure the OS binding functions are actually called */
   /* Could also use HWLOC_THISSYSTEM=1, but that applies
@@ -620,10 +701,21 @@ int mpibind_shell_init(flux_plugin_t *p, const char *s,
 
   if ( mpibind_set_ntasks(mph, ntasks) != 0 ||
        mpibind_set_topology(mph, topo) != 0 ||
+       mpibind_set_lazy(mph, 1) != 0 ||
        (opts->master <= 0 && mpibind_set_restrict_ids(mph, pus) != 0) ||
        (opts->smt >= 0 && mpibind_set_smt(mph, opts->smt) != 0) ||
        (opts->greedy >= 0 && mpibind_set_greedy(mph, opts->greedy) != 0) ||
-       (opts->gpu_optim >= 0 && mpibind_set_gpu_optim(mph, opts->gpu_optim) != 0) ) {
+       (opts->gpu_optim >= 0 && mpibind_set_gpu_optim(mph, opts->gpu_optim) != 0) ||
+       (opts->membind >= 0 && mpibind_set_membind(mph, opts->membind) != 0) ||
+       (opts->llc >= 0 && mpibind_set_llc(mph, opts->llc) != 0) ||
+       (opts->cpukinds >= 0 &&
+	mpibind_set_cpukinds(mph, opts->cpukinds) != 0) ||
+       (opts->auto_map >= 0 && mpibind_set_auto(mph, opts->auto_map) != 0) ||
+       (opts->leader >= 0 &&
+	mpibind_set_leader(mph, opts->leader, opts->leader_domain) != 0) ||
+       (opts->reserve > 0 &&
+	mpibind_set_reserved(mph, opts->reserve, opts->reserve_domain,
+			     opts->reserve_end) != 0) ) {
     shell_log_errno("Unable to set mpibind parameters");
     return -1;
   }
@@ -637,14 +729,41 @@ int mpibind_shell_init(flux_plugin_t *p, const char *s,
       mpibind_set_nthreads(mph, nthreads);
   }
 
+  /* Reuse mappings computed by previous jobs on this node */
+  str = flux_shell_getenv(shell, "MPIBIND_MAP_CACHE");
+  if (str != NULL && str[0] != '\0') {
+    mpibind_set_map_cache(mph, 1, str);
+    shell_debug("Using mapping cache %s", str);
+  }
+
+  /* Tasks of different sizes: one weight per local task,
+     e.g., 4,1,1,1 */
+  str = flux_shell_getenv(shell, "MPIBIND_TASK_WEIGHTS");
+  if (str != NULL && str[0] != '\0') {
+    int rc = 1, *weights = malloc(ntasks * sizeof(int));
+    if (weights != NULL)
+      rc = mpibind_parse_weights(str, ntasks, weights) ||
+	mpibind_set_weights(mph, ntasks, weights);
+    free(weights);
+    if (rc) {
+      shell_log_error("Invalid MPIBIND_TASK_WEIGHTS %s", str);
+      return -1;
+    }
+    shell_debug("Using task weights %s", str);
+  }
+
   shell_debug("user opts: ntasks=%d nthreads=%d restrict=%s "
-	      "greedy=%d smt=%d gpu_optim=%d verbose=%d master=%d "
-	      "visible_devices=%d omp_proc_bind=%d omp_places=%d "
+	      "greedy=%d llc=%d cpukinds=%d auto=%d smt=%d gpu_optim=%d "
+	      "verbose=%d "
+	      "master=%d membind=%d "
+	      "visible_devices=%d nics=%d omp_proc_bind=%d omp_places=%d "
+	      "reserve=%d leader=%d "
 	      "xml=%s ",
-	      ntasks, nthreads, pus, opts->greedy, opts->smt,
-	      opts->gpu_optim, opts->verbose, opts->master,
-	      opts->visible_devices,
-	      opts->omp_proc_bind, opts->omp_places, xml);
+	      ntasks, nthreads, pus, opts->greedy, opts->llc, opts->cpukinds,
+	      opts->auto_map, opts->smt,
+	      opts->gpu_optim, opts->verbose, opts->master, opts->membind,
+	      opts->visible_devices, opts->nics,
+	      opts->omp_proc_bind, opts->omp_places, opts->reserve, opts->leader, xml);
 
   struct handle_and_opts *hdl = malloc(sizeof(struct handle_and_opts));
   hdl->mph = mph;
@@ -683,8 +802,11 @@ int mpibind_shell_init(flux_plugin_t *p, const char *s,
        since users are used to this enumeration
        (as opposed to mpibind's enumeration) */
     mpibind_set_gpu_ids(mph, MPIBIND_ID_SMI);
-    mpibind_mapping_snprint(outbuf, PRINT_MAP_BUF_SIZE, mph);
-    shell_log("\n%s", outbuf);
+    mpibind_mapping_write(mph, log_mapping_line, NULL);
+
+    /* Catch bad mappings, e.g., on new node types */
+    if (mpibind_metrics_snprint(outbuf, PRINT_MAP_BUF_SIZE, mph) > 0)
+      shell_log("%s", outbuf);
   }
 
   /* Set env variables now for the purposes of task.init */
@@ -693,6 +815,10 @@ int mpibind_shell_init(flux_plugin_t *p, const char *s,
     return -1;
   }
 
+  /* Time spent in each phase, to track launch latency */
+  mpibind_timers_snprint(outbuf, PRINT_MAP_BUF_SIZE, mph);
+  shell_debug("%s", outbuf);
+
   /* Clean up */
   free(pus);
   /* Can't free opts here since it will be used by mpibind_task_init */
@@ -742,6 +868,9 @@ void flux_plugin_init(flux_plugin_t *p)
      When value is -1, use mpibind default value */
   opts->smt = -1;
   opts->greedy = -1;
+  opts->llc = -1;
+  opts->cpukinds = -1;
+  opts->auto_map = -1;
   opts->gpu_optim = -1;
   /* flux plugin parameters */
   opts->verbose = 0;
@@ -755,21 +884,41 @@ void flux_plugin_init(flux_plugin_t *p)
   // if they want mpibind to apply to all of the resources
   // of a node. But, I'm keeping this option just in case.
   opts->master = 0;
+  /* Memory binding is off unless requested */
+  opts->membind = -1;
+  /* No reserved cores unless requested */
+  opts->reserve = 0;
+  opts->reserve_domain = MPIBIND_RESERVE_NODE;
+  opts->reserve_end = 1;
+  /* No leader task unless requested */
+  opts->leader = -1;
+  opts->leader_domain = MPIBIND_LEADER_CORE;
   /* By default mpibind sets the environment variables, i.e.,
      (do not disable setting the variables) */
   opts->omp_proc_bind = 0;
   opts->omp_places = 0;
   opts->visible_devices = 0;
+  opts->nics = 0;
 
   /* Get mpibind user-specified options */
   if ( !mpibind_getopt(shell,
 		       &opts->smt,
 		       &opts->greedy,
+		       &opts->llc,
+		       &opts->cpukinds,
+		       &opts->auto_map,
 		       &opts->gpu_optim,
+		       &opts->leader,
+		       &opts->leader_domain,
 		       &opts->verbose,
 		       &opts->master,
+		       &opts->membind,
+		       &opts->nics,
 		       &opts->omp_proc_bind,
 		       &opts->omp_places,
+		       &opts->reserve,
+		       &opts->reserve_domain,
+		       &opts->reserve_end,
 		       &opts->visible_devices) ) {
     shell_debug("mpibind disabled");
     return;
@@ -53,19 +53,20 @@ def mpibind_get_mapping(verbose=False):
         handle.mpibind()
         #handle.mapping_print()
 
-        # Distribute the mapping
-        nthreads = handle.nthreads
-        cpus = handle.get_cpus_ptask(0)
-        gpus = handle.get_gpus_ptask(0)
-        for i in range(1, node_size):
-            node_comm.send(handle.get_cpus_ptask(i), dest=i)
-            node_comm.send(handle.get_gpus_ptask(i), dest=i)
+        # Distribute the mapping in a single message
+        data = handle.export()
     else:
-        nthreads = None
-        cpus = node_comm.recv(source=0)
-        gpus = node_comm.recv(source=0)
-    
-    nthreads = node_comm.scatter(nthreads, root=0)
+        handle = mpibind.MpibindHandle()
+        data = None
+
+    data = node_comm.bcast(data, root=0)
+    if node_rank != 0:
+        handle.import_mapping(data)
+
+    nthreads = handle.nthreads[node_rank]
+    cpus = handle.get_cpus_ptask(node_rank)
+    gpus = handle.get_gpus_ptask(node_rank)
+    handle.finalize()
 
     if verbose: 
         print('{} task {}/{}: lrank {}/{} nths {} gpus {} cpus {}'\
@@ -45,7 +45,6 @@ SPANK_PLUGIN(mpibind, 2);
 #define PRINT_DEBUG(...) if (opt_debug) fprintf(stderr, __VA_ARGS__)
 
 #define LONG_STR_SIZE 2048
-#define PRINT_MAP_BUF_SIZE (1024*5)
 
 /*
  * S_ALLOC_CORES can be one of:
@@ -70,6 +69,19 @@ static int opt_gpu = -1;
 static int opt_smt = -1;
 /* Enable greedy by default */
 static int opt_greedy = 1;
+static int opt_membind = -1;
+static int opt_llc = -1;
+static int opt_cpukinds = -1;
+static int opt_auto = -1;
+/* Task with a domain of its own (no leader if -1) */
+static int opt_leader = -1;
+static int opt_leader_domain = MPIBIND_LEADER_CORE;
+/* Reserved cores per domain (no reservation if 0) */
+static int opt_reserve = 0;
+static int opt_reserve_domain = MPIBIND_RESERVE_NODE;
+static int opt_reserve_end = 1;
+/* Do not set the NIC env variables if 1 */
+static int opt_nics = 0;
 
 /* mpibind plugin options */
 static int opt_verbose = 0;
@@ -245,11 +257,13 @@ void print_user_options()
   PRINT("Options: enable=%d "
 	  "conf_disabled=%d user_specified=%d excl_only=%d "
 	  "verbose=%d debug=%d "
-	  "gpu=%d smt=%d greedy=%d\n",
+	  "gpu=%d smt=%d greedy=%d membind=%d llc=%d reserve=%d "
+	  "cpukinds=%d leader=%d auto=%d\n",
 	  opt_enable,
 	  opt_conf_disabled, opt_user_specified, opt_exclusive_only,
 	  opt_verbose, opt_debug,
-	  opt_gpu, opt_smt, opt_greedy);
+	  opt_gpu, opt_smt, opt_greedy, opt_membind, opt_llc, opt_reserve,
+	  opt_cpukinds, opt_leader, opt_auto);
 }
 
 /*
@@ -280,12 +294,22 @@ int parse_user_options(int val, const char *arg, int remote)
   while (token != NULL) {
     //fprintf(stderr, "%s\n", token);
     msg = mpibind_parse_option(token,
+			       &opt_auto,
+			       &opt_cpukinds,
 			       &opt_debug,
 			       &opt_gpu,
 			       &opt_greedy,
+			       &opt_leader,
+			       &opt_leader_domain,
+			       &opt_llc,
 			       &master,
+			       &opt_membind,
+			       &opt_nics,
 			       &omp_places,
 			       &omp_proc_bind,
+			       &opt_reserve,
+			       &opt_reserve_domain,
+			       &opt_reserve_end,
 			       &opt_smt,
 			       &opt_user_specified,
 			       &opt_verbose,
@@ -676,6 +700,7 @@ int slurm_spank_user_init(spank_t sp, int ac, char *argv[])
      Some LLNL systems require a topology file to overcome
      Bug TOSS-6198 */
   char xml[512];
+  char *cache = NULL;
   xml[0] = '\0';
   if (spank_getenv(sp, "MPIBIND_TOPOFILE", xml, sizeof(xml))
       == ESPANK_SUCCESS && xml[0] != '\0') {
@@ -694,11 +719,25 @@ int slurm_spank_user_init(spank_t sp, int ac, char *argv[])
     }
   }
 
-  if (mpibind_load_topology(topo) != 0) {
+  /* Otherwise, keep a node-local snapshot of the discovered
+     topology so that subsequent job steps can skip discovery */
+  char cache_file[512];
+  if (xml[0] == '\0' &&
+      spank_getenv(sp, "MPIBIND_TOPO_CACHE", cache_file, sizeof(cache_file))
+      == ESPANK_SUCCESS && cache_file[0] != '\0') {
+    cache = cache_file;
+    if (nodeid == 0)
+      PRINT_DEBUG("mpibind: Using topology snapshot %s\n", cache);
+  }
+
+  double load_usecs;
+  if (mpibind_load_topology_cached(topo, cache, &load_usecs) != 0) {
     opt_enable = 0;
     slurm_error("mpibind: mpibind_load_topology");
     return ESPANK_ERROR;
   }
+  if (nodeid == 0)
+    PRINT_DEBUG("mpibind: Loaded topology in %.0f us\n", load_usecs);
 
   /* Restrict the topology to the cores allocated for the job.
      Note that restricting to current binding does not work
@@ -747,6 +786,15 @@ int slurm_spank_user_init(spank_t sp, int ac, char *argv[])
        (opt_smt > 0 && mpibind_set_smt(mph, opt_smt) != 0) ||
        (opt_greedy >= 0 && mpibind_set_greedy(mph, opt_greedy) != 0) ||
        (opt_gpu >= 0 && mpibind_set_gpu_optim(mph, opt_gpu) != 0) ||
+       (opt_membind >= 0 && mpibind_set_membind(mph, opt_membind) != 0) ||
+       (opt_llc >= 0 && mpibind_set_llc(mph, opt_llc) != 0) ||
+       (opt_cpukinds >= 0 && mpibind_set_cpukinds(mph, opt_cpukinds) != 0) ||
+       (opt_auto >= 0 && mpibind_set_auto(mph, opt_auto) != 0) ||
+       (opt_leader >= 0 &&
+	mpibind_set_leader(mph, opt_leader, opt_leader_domain) != 0) ||
+       (opt_reserve > 0 &&
+	mpibind_set_reserved(mph, opt_reserve, opt_reserve_domain,
+			     opt_reserve_end) != 0) ||
        (restr_type >= 0 && mpibind_set_restrict_type(mph, restr_type) != 0) ||
        (restr_str[0] && mpibind_set_restrict_ids(mph, restr_str) != 0) ) {
     opt_enable = 0;
@@ -756,6 +804,45 @@ int slurm_spank_user_init(spank_t sp, int ac, char *argv[])
 
   mpibind_set_topology(mph, topo);
 
+  /* Each task builds only its own env variables (task_init) */
+  mpibind_set_lazy(mph, 1);
+
+  /* Reuse mappings computed by previous job steps on this node */
+  char map_cache[512];
+  if (spank_getenv(sp, "MPIBIND_MAP_CACHE", map_cache, sizeof(map_cache))
+      == ESPANK_SUCCESS && map_cache[0] != '\0')
+    mpibind_set_map_cache(mph, 1, map_cache);
+
+  /* Tasks of different sizes: one weight per local task,
+     e.g., 4,1,1,1. Room for a 10-digit weight and a comma
+     per task */
+  size_t weights_size = (size_t)ntasks * 11 + 1;
+  char *weights_str = malloc(weights_size);
+  spank_err_t err = ESPANK_ERROR;
+  if (weights_str != NULL)
+    err = spank_getenv(sp, "MPIBIND_TASK_WEIGHTS", weights_str,
+		       weights_size);
+  if (err == ESPANK_NOSPACE) {
+    free(weights_str);
+    opt_enable = 0;
+    slurm_error("mpibind: MPIBIND_TASK_WEIGHTS is too long");
+    return ESPANK_ERROR;
+  }
+  if (err == ESPANK_SUCCESS && weights_str[0] != '\0') {
+    int rc = 1, *weights = malloc(ntasks * sizeof(int));
+    if (weights != NULL)
+      rc = mpibind_parse_weights(weights_str, ntasks, weights) ||
+	mpibind_set_weights(mph, ntasks, weights);
+    free(weights);
+    if (rc) {
+      opt_enable = 0;
+      slurm_error("mpibind: Invalid MPIBIND_TASK_WEIGHTS %s", weights_str);
+      free(weights_str);
+      return ESPANK_ERROR;
+    }
+  }
+  free(weights_str);
+
   PRINT_DEBUG("%s: ntasks=%d nthreads=%d greedy=%d gpu=%d "
 	      "topo=%p exclusive=%d restr_type=%d restr_ids=%s\n",
 	      header,
@@ -784,8 +871,14 @@ int slurm_spank_user_init(spank_t sp, int ac, char *argv[])
     return ESPANK_ERROR;
   }
 
+  /* Time spent in each phase, to track launch latency */
+  if (nodeid == 0 && opt_debug) {
+    char timers[LONG_STR_SIZE];
+    mpibind_timers_snprint(timers, sizeof(timers), mph);
+    PRINT_DEBUG("%s: %s\n", header, timers);
+  }
+
   if (opt_verbose) {
-    char buf[PRINT_MAP_BUF_SIZE];
     int ngpus = mpibind_get_num_gpus(mph);
 
     /* Use VISIBLE_DEVICES IDs to enumerate the GPUs
@@ -793,12 +886,16 @@ int slurm_spank_user_init(spank_t sp, int ac, char *argv[])
        (as opposed to mpibind's enumeration) */
     mpibind_set_gpu_ids(mph, MPIBIND_ID_SMI);
 
-    // This call had an issue with buffer overrun. Now fixed!
-    mpibind_mapping_snprint(buf, PRINT_MAP_BUF_SIZE, mph);
-
+    /* Stream the mapping: No buffer limits the
+       number of tasks printed */
     if (nodeid == 0 || opt_verbose > 1) {
       PRINT("mpibind: %d GPUs on this node\n", ngpus);
-      PRINT("%s", buf);
+      mpibind_mapping_fprint(stderr, mph);
+
+      /* Catch bad mappings, e.g., on new node types */
+      char metrics[LONG_STR_SIZE];
+      if (mpibind_metrics_snprint(metrics, sizeof(metrics), mph) > 0)
+        PRINT("%s\n", metrics);
     }
   }
 #endif
@@ -831,18 +928,30 @@ int slurm_spank_task_init(spank_t sp, int ac, char *argv[])
     return ESPANK_ERROR;
   }
 
+  if (taskid == 0 && opt_debug) {
+    char timers[LONG_STR_SIZE];
+    mpibind_timers_snprint(timers, sizeof(timers), mph);
+    PRINT_DEBUG("%s: %s\n", header, timers);
+  }
+
   /* Export environment variables, e.g., *VISIBLE_DEVICES */
   int nvars, i;
-  char **env_var_values;
+  char *env_var_value;
   char **env_var_names = mpibind_get_env_var_names(mph, &nvars);
 
   for (i=0; i<nvars; i++) {
-    env_var_values = mpibind_get_env_var_values(mph, env_var_names[i]);
-    if (env_var_values[taskid]) {
+    /* The user selects the NICs */
+    if ( opt_nics &&
+	 (!strcmp(env_var_names[i], "UCX_NET_DEVICES") ||
+	  !strcmp(env_var_names[i], "FI_CXI_DEVICE_NAME")) )
+      continue;
+
+    env_var_value = mpibind_get_env_var_ptask(mph, taskid, env_var_names[i]);
+    if (env_var_value) {
       //      fprintf(stderr, "%s: setting %s=%s\n", header,
-      //	      env_var_names[i], env_var_values[taskid]);
+      //	      env_var_names[i], env_var_value);
 
-      if (spank_setenv(sp, env_var_names[i], env_var_values[taskid], 1)
+      if (spank_setenv(sp, env_var_names[i], env_var_value, 1)
 	  != ESPANK_SUCCESS) {
 	slurm_error("mpibind: Failed to set %s in environment\n",
 		    env_var_names[i]);
@@ -0,0 +1,130 @@
+/******************************************************
+ * Edgar A. Leon
+ * Lawrence Livermore National Laboratory
+ ******************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "mpibind-priv.h"
+
+/*
+ * A bump allocator for the outputs of an mpibind handle and
+ * the temporary arrays of the mapping functions, which would
+ * not fit on the stack of large topologies.
+ *
+ * Memory is obtained from the system in chunks and handed out
+ * sequentially. Individual allocations are never released;
+ * instead, all of them are released at once with arena_reset
+ * (keeping the chunks for reuse) or arena_release.
+ */
+
+#define ARENA_CHUNK_SIZE 16384
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+};
+
+/* Chunk data starts after the (aligned) header */
+#define CHUNK_HDR_SIZE \
+  ((sizeof(struct arena_chunk) + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))
+
+void arena_init(struct arena *arena)
+{
+  arena->head = NULL;
+  arena->curr = NULL;
+  arena->nallocs = 0;
+  arena->nchunks = 0;
+  arena->reserved = 0;
+}
+
+/*
+ * Return 'size' bytes of zeroed memory.
+ * Allocations larger than the default chunk size
+ * get a chunk of their own.
+ */
+void* arena_alloc(struct arena *arena, size_t size)
+{
+  struct arena_chunk *chunk, **pp;
+  char *ptr;
+
+  size = (size + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+
+  /* Look for space in the current chunk or the ones
+     after it (available after a reset) */
+  for (chunk=arena->curr; chunk != NULL; chunk=chunk->next)
+    if (chunk->size - chunk->used >= size)
+      break;
+
+  if (chunk == NULL) {
+    chunk = malloc(CHUNK_HDR_SIZE +
+		   ((size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE));
+    if (chunk == NULL)
+      return NULL;
+    chunk->next = NULL;
+    chunk->size = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+    chunk->used = 0;
+
+    /* Append to the list of chunks */
+    for (pp=&arena->head; *pp != NULL; pp=&(*pp)->next)
+      ;
+    *pp = chunk;
+
+    arena->nchunks++;
+    arena->reserved += chunk->size;
+  }
+
+  /* Oversized allocations should not make the
+     current chunk unusable for subsequent ones */
+  if (arena->curr == NULL || size <= ARENA_CHUNK_SIZE)
+    arena->curr = chunk;
+
+  ptr = (char *)chunk + CHUNK_HDR_SIZE + chunk->used;
+  chunk->used += size;
+  arena->nallocs++;
+
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+char* arena_strdup(struct arena *arena, const char *str)
+{
+  size_t len = strlen(str) + 1;
+  char *dup = arena_alloc(arena, len);
+
+  if (dup != NULL)
+    memcpy(dup, str, len);
+
+  return dup;
+}
+
+/*
+ * Invalidate all allocations, but keep the chunks
+ * so that they can be reused.
+ */
+void arena_reset(struct arena *arena)
+{
+  struct arena_chunk *chunk;
+
+  for (chunk=arena->head; chunk != NULL; chunk=chunk->next)
+    chunk->used = 0;
+
+  arena->curr = arena->head;
+  arena->nallocs = 0;
+}
+
+/*
+ * Return all the memory to the system.
+ */
+void arena_release(struct arena *arena)
+{
+  struct arena_chunk *chunk, *next;
+
+  for (chunk=arena->head; chunk != NULL; chunk=next) {
+    next = chunk->next;
+    free(chunk);
+  }
+
+  arena_init(arena);
+}
@@ -0,0 +1,373 @@
+/*
+ * Edgar A. Leon
+ * Lawrence Livermore National Laboratory
+ *
+ * mpibind-bench: Measure the latency of mpibind's phases
+ * on the topologies of real machines (hwloc XML files).
+ * No GPUs or network are needed: Only the XML files.
+ *
+ * Usage: mpibind-bench [options] file.xml ...
+ *   -r <reps>      Repetitions per measurement (default 20)
+ *   -n <list>      Number of tasks, e.g., 1,4,16 (default 1,2,4,8,16,64)
+ *   -t <list>      Number of threads per task (default 0)
+ *   -s <list>      SMT levels (default 0)
+ *   -g <list>      Greedy values (default 1)
+ *   -f <format>    Output format: text, csv, or json (default text)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mpibind.h"
+
+/************************************************
+ * Functions defined in hwloc_utils.c
+ ************************************************/
+int filter_topology(hwloc_topology_t topology);
+
+#define MAX_LIST 32
+#define MAX_SNPRINT_BUF (1<<20)
+
+enum {
+  OUT_TEXT,
+  OUT_CSV,
+  OUT_JSON,
+};
+
+/* Phases measured per grid point */
+enum {
+  PH_CHECK,
+  PH_DEVICES,
+  PH_DISTRIB,
+  PH_ENV_VARS,
+  PH_SNPRINT,
+  NUM_PHASES
+};
+
+static const char *phase_names[] = {
+  "check", "devices", "distrib", "env_vars", "snprint"
+};
+
+struct list {
+  int n;
+  int vals[MAX_LIST];
+};
+
+static int out_format = OUT_TEXT;
+static int nrows = 0;
+
+static
+double now_usecs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static
+int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ * Parse a comma-separated list of integers.
+ * Returns 0 on success.
+ */
+static
+int parse_list(const char *str, struct list *list)
+{
+  char *end;
+
+  list->n = 0;
+  while (*str && list->n < MAX_LIST) {
+    list->vals[list->n++] = strtol(str, &end, 10);
+    if (end == str || (*end != ',' && *end != '\0'))
+      return 1;
+    str = (*end == ',') ? end+1 : end;
+  }
+
+  return (list->n == 0);
+}
+
+/*
+ * Print the statistics of a set of samples: one row per
+ * XML file, grid point, and phase. Grid parameters that
+ * do not apply to a phase are -1.
+ */
+static
+void print_row(const char *xml, int ntasks, int nthreads,
+	       int smt, int greedy, const char *phase,
+	       double *samples, int nsamples,
+	       int nallocs, int nchunks)
+{
+  double min, median, p99;
+
+  qsort(samples, nsamples, sizeof(double), cmp_double);
+  min = samples[0];
+  median = samples[nsamples/2];
+  p99 = samples[(int)(0.99 * (nsamples-1) + 0.5)];
+
+  switch (out_format) {
+  case OUT_CSV:
+    if (nrows == 0)
+      printf("xml,ntasks,nthreads,smt,greedy,phase,"
+	     "min_us,median_us,p99_us,nallocs,nchunks\n");
+    printf("%s,%d,%d,%d,%d,%s,%.2f,%.2f,%.2f,%d,%d\n",
+	   xml, ntasks, nthreads, smt, greedy, phase,
+	   min, median, p99, nallocs, nchunks);
+    break;
+  case OUT_JSON:
+    printf("%s\n  {\"xml\": \"%s\", \"ntasks\": %d, \"nthreads\": %d, "
+	   "\"smt\": %d, \"greedy\": %d, \"phase\": \"%s\", "
+	   "\"min_us\": %.2f, \"median_us\": %.2f, \"p99_us\": %.2f, "
+	   "\"nallocs\": %d, \"nchunks\": %d}",
+	   (nrows == 0) ? "[" : ",",
+	   xml, ntasks, nthreads, smt, greedy, phase,
+	   min, median, p99, nallocs, nchunks);
+    break;
+  default:
+    if (nrows == 0)
+      printf("%-36s %6s %4s %3s %3s %-8s %10s %10s %10s %7s %4s\n",
+	     "xml", "ntasks", "nths", "smt", "gr", "phase",
+	     "min(us)", "median(us)", "p99(us)", "nallocs", "nchk");
+    printf("%-36s %6d %4d %3d %3d %-8s %10.2f %10.2f %10.2f %7d %4d\n",
+	   xml, ntasks, nthreads, smt, greedy, phase,
+	   min, median, p99, nallocs, nchunks);
+  }
+
+  nrows++;
+}
+
+/*
+ * Time filtering and loading an XML topology.
+ * Returns the loaded topology or NULL on failure.
+ */
+static
+hwloc_topology_t bench_load(const char *xml, const char *name, int reps)
+{
+  int r;
+  double t, *filter, *load;
+  hwloc_topology_t topo = NULL;
+
+  /* reps can be large: Keep the samples off the stack */
+  if ((filter = malloc(2 * (size_t)reps * sizeof(double))) == NULL) {
+    fprintf(stderr, "Warn: Failed to allocate %d samples\n", reps);
+    return NULL;
+  }
+  load = filter + reps;
+
+  for (r=0; r<reps; r++) {
+    if (topo != NULL)
+      hwloc_topology_destroy(topo);
+    hwloc_topology_init(&topo);
+    if (hwloc_topology_set_xml(topo, xml) < 0) {
+      fprintf(stderr, "Warn: Failed to read %s\n", xml);
+      hwloc_topology_destroy(topo);
+      free(filter);
+      return NULL;
+    }
+
+    /* Configure the topology like mpibind_load_topology.
+       The mappings are never applied */
+    hwloc_topology_set_flags(topo, HWLOC_TOPOLOGY_FLAG_IS_THISSYSTEM);
+
+    t = now_usecs();
+    filter_topology(topo);
+    filter[r] = now_usecs() - t;
+
+    t = now_usecs();
+    if (hwloc_topology_load(topo) < 0) {
+      fprintf(stderr, "Warn: Failed to load %s\n", xml);
+      hwloc_topology_destroy(topo);
+      free(filter);
+      return NULL;
+    }
+    load[r] = now_usecs() - t;
+  }
+
+  print_row(name, -1, -1, -1, -1, "filter", filter, reps, 0, 0);
+  print_row(name, -1, -1, -1, -1, "load", load, reps, 0, 0);
+  free(filter);
+
+  return topo;
+}
+
+/*
+ * Time a mapping and its outputs. Every repetition uses a new
+ * handle and a copy of the topology, which is what a job
+ * launch does. Returns 0 on success.
+ */
+static
+int bench_mapping(hwloc_topology_t topo, const char *name, int reps,
+		  int ntasks, int nthreads, int smt, int greedy,
+		  char *buf)
+{
+  int r, k, nallocs=0, nchunks=0;
+  size_t nbytes;
+  double t, usecs[MPIBIND_NUM_TIMERS];
+  double *samples[NUM_PHASES];
+  hwloc_topology_t copy;
+  mpibind_t *handle;
+
+  /* One row of samples per phase */
+  if ((samples[0] = malloc(NUM_PHASES * (size_t)reps *
+			   sizeof(double))) == NULL) {
+    fprintf(stderr, "Warn: Failed to allocate %d samples\n", reps);
+    return 1;
+  }
+  for (k=1; k<NUM_PHASES; k++)
+    samples[k] = samples[k-1] + reps;
+
+  for (r=0; r<reps; r++) {
+    hwloc_topology_dup(&copy, topo);
+    mpibind_init(&handle);
+    mpibind_set_topology(handle, copy);
+    mpibind_set_ntasks(handle, ntasks);
+    mpibind_set_nthreads(handle, nthreads);
+    mpibind_set_smt(handle, smt);
+    mpibind_set_greedy(handle, greedy);
+
+    if (mpibind(handle) != 0) {
+      mpibind_finalize(handle);
+      hwloc_topology_destroy(copy);
+      free(samples[0]);
+      return 1;
+    }
+    mpibind_set_env_vars(handle);
+
+    t = now_usecs();
+    mpibind_mapping_snprint(buf, MAX_SNPRINT_BUF, handle);
+    samples[PH_SNPRINT][r] = now_usecs() - t;
+
+    mpibind_get_timers(handle, usecs);
+    samples[PH_CHECK][r] = usecs[MPIBIND_TIMER_LOAD];
+    samples[PH_DEVICES][r] = usecs[MPIBIND_TIMER_DEVICES];
+    samples[PH_DISTRIB][r] = usecs[MPIBIND_TIMER_DISTRIB];
+    samples[PH_ENV_VARS][r] = usecs[MPIBIND_TIMER_ENV_VARS];
+
+    mpibind_get_mem_stats(handle, &nallocs, &nchunks, &nbytes);
+
+    mpibind_finalize(handle);
+    hwloc_topology_destroy(copy);
+  }
+
+  for (k=0; k<NUM_PHASES; k++)
+    print_row(name, ntasks, nthreads, smt, greedy, phase_names[k],
+	      samples[k], reps, nallocs, nchunks);
+  free(samples[0]);
+
+  return 0;
+}
+
+static
+void usage(const char *prog)
+{
+  fprintf(stderr,
+	  "Usage: %s [-r reps] [-n ntasks] [-t nthreads] [-s smt] "
+	  "[-g greedy] [-f text|csv|json] file.xml ...\n"
+	  "Lists are comma separated, e.g., -n 1,4,16\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, a, i, j, k, l, reps = 20;
+  const char *name;
+  char *buf;
+  hwloc_topology_t topo;
+  struct list ntasks = { 6, {1, 2, 4, 8, 16, 64} };
+  struct list nthreads = { 1, {0} };
+  struct list smt = { 1, {0} };
+  struct list greedy = { 1, {1} };
+
+  while ((opt = getopt(argc, argv, "r:n:t:s:g:f:h")) != -1) {
+    switch (opt) {
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 'n':
+      if (parse_list(optarg, &ntasks)) {
+	usage(argv[0]);
+	return 1;
+      }
+      break;
+    case 't':
+      if (parse_list(optarg, &nthreads)) {
+	usage(argv[0]);
+	return 1;
+      }
+      break;
+    case 's':
+      if (parse_list(optarg, &smt)) {
+	usage(argv[0]);
+	return 1;
+      }
+      break;
+    case 'g':
+      if (parse_list(optarg, &greedy)) {
+	usage(argv[0]);
+	return 1;
+      }
+      break;
+    case 'f':
+      if (strcmp(optarg, "csv") == 0)
+	out_format = OUT_CSV;
+      else if (strcmp(optarg, "json") == 0)
+	out_format = OUT_JSON;
+      else if (strcmp(optarg, "text") == 0)
+	out_format = OUT_TEXT;
+      else {
+	usage(argv[0]);
+	return 1;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return (opt != 'h');
+    }
+  }
+
+  if (optind >= argc || reps <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if ((buf = malloc(MAX_SNPRINT_BUF)) == NULL) {
+    fprintf(stderr, "Error: Failed to allocate the output buffer\n");
+    return 1;
+  }
+
+  for (a=optind; a<argc; a++) {
+    /* Report the file name without its directory */
+    name = strrchr(argv[a], '/');
+    name = (name == NULL) ? argv[a] : name+1;
+
+    if ((topo = bench_load(argv[a], name, reps)) == NULL)
+      continue;
+
+    for (i=0; i<ntasks.n; i++)
+      for (j=0; j<nthreads.n; j++)
+	for (k=0; k<smt.n; k++)
+	  for (l=0; l<greedy.n; l++)
+	    if (bench_mapping(topo, name, reps, ntasks.vals[i],
+			      nthreads.vals[j], smt.vals[k],
+			      greedy.vals[l], buf) != 0)
+	      fprintf(stderr, "Warn: %s: mapping failed for ntasks %d "
+		      "nthreads %d smt %d greedy %d\n", name,
+		      ntasks.vals[i], nthreads.vals[j], smt.vals[k],
+		      greedy.vals[l]);
+
+    hwloc_topology_destroy(topo);
+  }
+
+  if (out_format == OUT_JSON)
+    printf("%s\n", (nrows > 0) ? "\n]" : "[]");
+
+  free(buf);
+
+  return 0;
+}
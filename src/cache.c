@@ -0,0 +1,749 @@
+/******************************************************
+ * Edgar A. Leon
+ * Lawrence Livermore National Laboratory
+ ******************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <hwloc.h>
+#include "mpibind-priv.h"
+
+/*
+ * Topology snapshots.
+ *
+ * Discovering the topology of a node (walking sysfs, querying
+ * PCI and GPU libraries) can take hundreds of milliseconds
+ * and is repeated on every job step. A snapshot stores the
+ * filtered topology, after NUMA domains with intersecting CPUs
+ * have been removed, in a node-local file so that later loads
+ * can import it instead of rediscovering the node.
+ *
+ * The file starts with a one-line key followed by the hwloc XML
+ * export (including its terminating null byte):
+ *   mpibind-topo <version> hwloc=<api> boot=<boot-id> filter=<hash>
+ * A snapshot is used only when its key matches the running
+ * system: a new hwloc, a reboot, or a different set of type
+ * filters invalidates it. I/O devices are discovered from the
+ * imported topology, which keeps the OS device attributes
+ * (UUIDs, vendors, etc.) that discover_devices() relies on.
+ */
+
+#define TOPO_CACHE_VERSION 1
+#define BOOT_ID_FILE "/proc/sys/kernel/random/boot_id"
+
+/*
+ * 64-bit FNV-1a hash. Pass the previous hash to
+ * accumulate several buffers, start with FNV_BASIS.
+ */
+#define FNV_BASIS 14695981039346656037ULL
+static
+uint64_t fnv1a(uint64_t hash, const void *buf, size_t size)
+{
+  const unsigned char *ptr = buf;
+  size_t i;
+
+  for (i=0; i<size; i++) {
+    hash ^= ptr[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+/*
+ * Get the boot ID of the running kernel.
+ * Return 0 on success and 1 otherwise.
+ */
+static
+int get_boot_id(char *buf, int size)
+{
+  int len;
+  FILE *fp = fopen(BOOT_ID_FILE, "r");
+
+  if (fp == NULL)
+    return 1;
+
+  if (fgets(buf, size, fp) == NULL) {
+    fclose(fp);
+    return 1;
+  }
+  fclose(fp);
+
+  /* Strip the new line */
+  len = strlen(buf);
+  if (len > 0 && buf[len-1] == '\n')
+    buf[--len] = '\0';
+
+  return (len > 0) ? 0 : 1;
+}
+
+/*
+ * Hash the type filters and flags of a topology that
+ * has been configured but not loaded yet.
+ */
+static
+uint64_t get_filter_hash(hwloc_topology_t topo)
+{
+  int type;
+  unsigned long flags;
+  enum hwloc_type_filter_e filter;
+  uint64_t hash = FNV_BASIS;
+
+  for (type=HWLOC_OBJ_TYPE_MIN; type<HWLOC_OBJ_TYPE_MAX; type++) {
+    if (hwloc_topology_get_type_filter(topo, type, &filter) < 0)
+      filter = -1;
+    hash = fnv1a(hash, &filter, sizeof(filter));
+  }
+
+  flags = hwloc_topology_get_flags(topo);
+  hash = fnv1a(hash, &flags, sizeof(flags));
+
+  return hash;
+}
+
+/*
+ * Write the key of a snapshot, including the new line.
+ * Return the number of characters written or -1 if the key
+ * cannot be generated on this system.
+ */
+static
+int topo_cache_key_snprint(char *buf, size_t size,
+			   hwloc_topology_t topo)
+{
+  char boot_id[SHORT_STR_SIZE*2];
+
+  if (get_boot_id(boot_id, sizeof(boot_id)) != 0)
+    return -1;
+
+  return snprintf(buf, size,
+		  "mpibind-topo %d hwloc=%x boot=%s filter=%016" PRIx64 "\n",
+		  TOPO_CACHE_VERSION, hwloc_get_api_version(),
+		  boot_id, get_filter_hash(topo));
+}
+
+/*
+ * Snapshots live in shared directories: Only use files
+ * owned by this user that others cannot modify.
+ */
+static
+int trusted_file(const struct stat *st)
+{
+  return (S_ISREG(st->st_mode) && st->st_uid == geteuid() &&
+	  (st->st_mode & (S_IWGRP | S_IWOTH)) == 0);
+}
+
+/*
+ * Load a topology from a snapshot.
+ * The topology must have been configured (flags and filters)
+ * but not loaded.
+ *
+ * Return 0 if the topology was loaded from the snapshot,
+ * 1 if there is no valid snapshot (the topology is untouched),
+ * and -1 if the snapshot could not be imported. In the latter
+ * case hwloc has reinitialized the topology and the caller
+ * must configure it again.
+ */
+int topo_cache_load(hwloc_topology_t topo, const char *path)
+{
+  int fd, len, rc = 1;
+  char key[LONG_STR_SIZE];
+  struct stat st;
+  char *map;
+
+  if ((len = topo_cache_key_snprint(key, sizeof(key), topo)) < 0 ||
+      len >= sizeof(key))
+    return 1;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return 1;
+
+  if (fstat(fd, &st) < 0 || !trusted_file(&st) || st.st_size <= len) {
+    close(fd);
+    return 1;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 1;
+
+  /* Stale snapshot: different hwloc, boot, or filters */
+  if (memcmp(map, key, len) != 0)
+    goto out;
+
+  if (hwloc_topology_set_xmlbuffer(topo, map+len, st.st_size-len) < 0)
+    goto out;
+
+  if (hwloc_topology_load(topo) < 0) {
+    PRINT("WARN: Failed to import topology snapshot %s\n", path);
+    unlink(path);
+    rc = -1;
+    goto out;
+  }
+
+#if VERBOSE >= 1
+  PRINT("Loaded topology snapshot %s\n", path);
+#endif
+  rc = 0;
+
+ out:
+  munmap(map, st.st_size);
+  return rc;
+}
+
+/*
+ * Save a loaded topology into a snapshot.
+ * The snapshot is written to a new temporary file with a
+ * unique name first and then renamed, so that concurrent
+ * readers never see a partial file and an existing file or
+ * link with the temporary name is never written.
+ *
+ * Return 0 on success and 1 otherwise.
+ */
+int topo_cache_store(hwloc_topology_t topo, const char *path)
+{
+  int fd, len, buflen, rc = 1;
+  char key[LONG_STR_SIZE];
+  char *tmp, *xml;
+
+  if ((len = topo_cache_key_snprint(key, sizeof(key), topo)) < 0 ||
+      len >= sizeof(key))
+    return 1;
+
+  if (hwloc_topology_export_xmlbuffer(topo, &xml, &buflen, 0) < 0)
+    return 1;
+
+  /* Created with mode 0600 */
+  if ((tmp = malloc(strlen(path) + 8)) == NULL)
+    goto out;
+  sprintf(tmp, "%s.XXXXXX", path);
+  if ((fd = mkstemp(tmp)) < 0)
+    goto out;
+
+  if (write(fd, key, len) != len ||
+      write(fd, xml, buflen) != buflen) {
+    close(fd);
+    unlink(tmp);
+    goto out;
+  }
+  close(fd);
+
+  if (rename(tmp, path) < 0) {
+    unlink(tmp);
+    goto out;
+  }
+
+#if VERBOSE >= 1
+  PRINT("Saved topology snapshot %s\n", path);
+#endif
+  rc = 0;
+
+ out:
+  free(tmp);
+  hwloc_free_xmlbuffer(topo, xml);
+  return rc;
+}
+
+/*
+ * Mapping cache.
+ *
+ * Job steps launched repeatedly on the same node usually ask
+ * for the same mapping. A mapping is identified by a 128-bit
+ * key: two hashes of the (restricted) topology, the I/O devices,
+ * and the input parameters of mpibind. Finished mappings are
+ * kept in process memory and, optionally, in a node-local file
+ * so that other processes can reuse them. Each line of the file
+ * holds one mapping:
+ *   <key> <ntasks> <nthreads>:<cpus>:<gpus> ...
+ * where cpus and gpus are bitmap lists, e.g., 4:0-3,8:1.
+ * The file holds at most MAP_CACHE_FILE_ENTRIES mappings, each
+ * one once; when full, the oldest half is dropped. Writers hold
+ * an exclusive lock on the file and readers a shared one.
+ * Environment variables are derived from the mapping
+ * (mpibind_set_env_vars) and are not stored.
+ */
+
+#define MAP_CACHE_VERSION 6
+#define MAP_CACHE_ENTRIES 64
+#define MAP_CACHE_FILE_ENTRIES 256
+
+/* The second hash of a key uses a different offset basis */
+#define FNV_BASIS2 (FNV_BASIS ^ 0x9e3779b97f4a7c15ULL)
+
+struct map_entry {
+  struct map_key key;
+  int ntasks;
+  int *nthreads;
+  hwloc_bitmap_t *cpus;
+  hwloc_bitmap_t *gpus;
+  struct map_entry *next;
+};
+
+/* Most recently used entries first.
+   Handles of several threads share the cache */
+static pthread_mutex_t map_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct map_entry *map_cache = NULL;
+static int map_cache_size = 0;
+static int map_cache_hits = 0;
+static int map_cache_misses = 0;
+
+static
+void key_update(struct map_key *key, const void *buf, size_t size)
+{
+  key->hash[0] = fnv1a(key->hash[0], buf, size);
+  key->hash[1] = fnv1a(key->hash[1], buf, size);
+}
+
+static
+int key_equal(const struct map_key *a, const struct map_key *b)
+{
+  return (a->hash[0] == b->hash[0] && a->hash[1] == b->hash[1]);
+}
+
+static
+void key_update_bitmap(struct map_key *key, hwloc_const_bitmap_t set)
+{
+  int i, last, weight;
+  unsigned long ul;
+
+  /* Distinguish empty and infinite sets */
+  weight = hwloc_bitmap_weight(set);
+  key_update(key, &weight, sizeof(weight));
+
+  last = hwloc_bitmap_last(set);
+  for (i=0; last>=0 && i<=last/(8*(int)sizeof(unsigned long)); i++) {
+    ul = hwloc_bitmap_to_ith_ulong(set, i);
+    key_update(key, &ul, sizeof(ul));
+  }
+}
+
+/*
+ * The key of a mapping: hashes of the structure of the
+ * topology (type, OS index, and cpuset of every object),
+ * the I/O devices, and the input parameters.
+ */
+struct map_key map_cache_key(hwloc_topology_t topo,
+			     struct device **devs, int ndevs,
+			     int ntasks, int nthreads,
+			     int greedy, int gpu_optim, int smt, int llc,
+			     int cpukinds, int auto_map, const int *weights,
+			     int leader, int leader_domain)
+{
+  int i, depth, topodepth;
+  int params[] = { MAP_CACHE_VERSION, ntasks, nthreads,
+		   greedy, gpu_optim, smt, llc, cpukinds, auto_map,
+		   leader, leader_domain, ndevs };
+  struct map_key key = { { FNV_BASIS, FNV_BASIS2 } };
+  hwloc_obj_t obj;
+
+  key_update(&key, params, sizeof(params));
+  if (weights != NULL)
+    key_update(&key, weights, ntasks * sizeof(int));
+
+  /* Normal objects and NUMA nodes */
+  topodepth = hwloc_topology_get_depth(topo);
+  for (depth=0; depth<=topodepth; depth++) {
+    obj = NULL;
+    while ((obj = hwloc_get_next_obj_by_depth(topo,
+		(depth < topodepth) ? depth : HWLOC_TYPE_DEPTH_NUMANODE,
+		obj)) != NULL) {
+      key_update(&key, &obj->type, sizeof(obj->type));
+      key_update(&key, &obj->os_index, sizeof(obj->os_index));
+      key_update_bitmap(&key, obj->cpuset);
+    }
+  }
+
+  for (i=0; i<ndevs; i++) {
+    /* Bytes past the terminating null are undefined */
+    key_update(&key, devs[i]->name, strlen(devs[i]->name)+1);
+    key_update(&key, devs[i]->pci, strlen(devs[i]->pci)+1);
+    key_update(&key, devs[i]->univ, strlen(devs[i]->univ)+1);
+    key_update(&key, &devs[i]->type, sizeof(devs[i]->type));
+    key_update(&key, &devs[i]->vendor_id, sizeof(devs[i]->vendor_id));
+    key_update(&key, &devs[i]->smi, sizeof(devs[i]->smi));
+    key_update_bitmap(&key, devs[i]->ancestor->cpuset);
+  }
+
+  return key;
+}
+
+static
+void map_entry_free(struct map_entry *entry)
+{
+  int i;
+
+  for (i=0; i<entry->ntasks; i++) {
+    hwloc_bitmap_free(entry->cpus[i]);
+    hwloc_bitmap_free(entry->gpus[i]);
+  }
+  free(entry->cpus);
+  free(entry->gpus);
+  free(entry->nthreads);
+  free(entry);
+}
+
+/*
+ * Return the new entry or NULL if out of memory.
+ */
+static
+struct map_entry* map_entry_alloc(struct map_key key, int ntasks)
+{
+  int i;
+  struct map_entry *entry = calloc(1, sizeof(struct map_entry));
+
+  if (entry == NULL)
+    return NULL;
+
+  entry->key = key;
+  entry->nthreads = calloc(ntasks, sizeof(int));
+  entry->cpus = calloc(ntasks, sizeof(hwloc_bitmap_t));
+  entry->gpus = calloc(ntasks, sizeof(hwloc_bitmap_t));
+  if (entry->nthreads == NULL || entry->cpus == NULL ||
+      entry->gpus == NULL) {
+    map_entry_free(entry);
+    return NULL;
+  }
+
+  /* Bitmaps are freed as they are allocated */
+  for (i=0; i<ntasks; i++) {
+    entry->cpus[i] = hwloc_bitmap_alloc();
+    entry->gpus[i] = hwloc_bitmap_alloc();
+    entry->ntasks = i + 1;
+    if (entry->cpus[i] == NULL || entry->gpus[i] == NULL) {
+      map_entry_free(entry);
+      return NULL;
+    }
+  }
+  entry->next = NULL;
+
+  return entry;
+}
+
+/*
+ * Add an entry to the in-memory cache,
+ * evicting the least recently used entry if full.
+ */
+static
+void map_cache_insert(struct map_entry *entry)
+{
+  struct map_entry **pp;
+
+  entry->next = map_cache;
+  map_cache = entry;
+
+  if (++map_cache_size > MAP_CACHE_ENTRIES) {
+    for (pp=&map_cache; (*pp)->next != NULL; pp=&(*pp)->next)
+      ;
+    map_entry_free(*pp);
+    *pp = NULL;
+    map_cache_size--;
+  }
+}
+
+/*
+ * Print the key and the number of tasks of a mapping,
+ * which identify its line in the cache file.
+ */
+static
+int map_entry_prefix(char *buf, size_t size, struct map_entry *entry)
+{
+  return snprintf(buf, size, "%016" PRIx64 "%016" PRIx64 " %d ",
+		  entry->key.hash[0], entry->key.hash[1], entry->ntasks);
+}
+
+/*
+ * Parse the mappings of one line of the cache file.
+ * Return 0 on success and 1 otherwise.
+ */
+static
+int map_entry_sscanf(struct map_entry *entry, char *line)
+{
+  int i;
+  char *tok, *cpus, *gpus, *save, *end;
+
+  strtok_r(line, " \n", &save);  // key
+  strtok_r(NULL, " \n", &save);  // ntasks
+
+  for (i=0; i<entry->ntasks; i++) {
+    if ((tok = strtok_r(NULL, " \n", &save)) == NULL)
+      return 1;
+
+    entry->nthreads[i] = strtol(tok, &end, 10);
+    if (*end != ':')
+      return 1;
+    cpus = end + 1;
+
+    if ((gpus = strchr(cpus, ':')) == NULL)
+      return 1;
+    *gpus++ = '\0';
+
+    if (*cpus != '\0' &&
+	hwloc_bitmap_list_sscanf(entry->cpus[i], cpus) < 0)
+      return 1;
+    if (*gpus != '\0' &&
+	hwloc_bitmap_list_sscanf(entry->gpus[i], gpus) < 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * A mapping from the cache file must fit the topology:
+ * the CPUs of every task are in the topology and its
+ * GPUs are among the 'ndevs' I/O devices.
+ */
+static
+int map_entry_valid(struct map_entry *entry,
+		    hwloc_topology_t topo, int ndevs)
+{
+  int i;
+  hwloc_const_bitmap_t root = hwloc_get_root_obj(topo)->cpuset;
+
+  for (i=0; i<entry->ntasks; i++)
+    if (entry->nthreads[i] < 0 ||
+	!hwloc_bitmap_isincluded(entry->cpus[i], root) ||
+	hwloc_bitmap_weight(entry->gpus[i]) < 0 ||
+	hwloc_bitmap_last(entry->gpus[i]) >= ndevs)
+      return 0;
+
+  return 1;
+}
+
+/*
+ * Find a mapping of 'topo' in the cache file.
+ * Return the entry or NULL if not found.
+ */
+static
+struct map_entry* map_cache_read(const char *path, struct map_key key,
+				 hwloc_topology_t topo, int ndevs,
+				 int ntasks)
+{
+  int fd, found = 0;
+  char *line = NULL, prefix[2*SHORT_STR_SIZE];
+  size_t cap = 0, len;
+  struct map_entry *entry;
+  struct stat st;
+  FILE *fp;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0 || !trusted_file(&st) ||
+      flock(fd, LOCK_SH) < 0 || (fp = fdopen(fd, "r")) == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  if ((entry = map_entry_alloc(key, ntasks)) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  len = map_entry_prefix(prefix, sizeof(prefix), entry);
+
+  /* Every mapping is written once */
+  while (!found && getline(&line, &cap, fp) > 0)
+    found = (strncmp(line, prefix, len) == 0);
+
+  if (found && (map_entry_sscanf(entry, line) != 0 ||
+		!map_entry_valid(entry, topo, ndevs))) {
+    PRINT("WARN: Ignoring invalid mapping in %s\n", path);
+    found = 0;
+  }
+  if (!found) {
+    map_entry_free(entry);
+    entry = NULL;
+  }
+
+  free(line);
+  fclose(fp);
+
+  return entry;
+}
+
+/*
+ * Add a mapping to the cache file unless another process
+ * already did. When the file is full, drop the oldest half
+ * of its mappings first.
+ * Return 0 on success and 1 otherwise.
+ */
+static
+int map_cache_write(const char *path, struct map_entry *entry)
+{
+  int i, fd, n, nlines, rc = 1;
+  char *line = NULL, *str, *buf = NULL, *keep, *ptr;
+  char prefix[2*SHORT_STR_SIZE];
+  size_t len = 0, plen;
+  ssize_t size;
+  struct stat st;
+  FILE *fp;
+
+  if ((fp = open_memstream(&line, &len)) == NULL)
+    return 1;
+
+  plen = map_entry_prefix(prefix, sizeof(prefix), entry);
+  fputs(prefix, fp);
+  for (i=0; i<entry->ntasks; i++) {
+    fprintf(fp, "%s%d:", (i > 0) ? " " : "", entry->nthreads[i]);
+    hwloc_bitmap_list_asprintf(&str, entry->cpus[i]);
+    fprintf(fp, "%s:", str);
+    free(str);
+    hwloc_bitmap_list_asprintf(&str, entry->gpus[i]);
+    fprintf(fp, "%s", str);
+    free(str);
+  }
+  fprintf(fp, "\n");
+  fclose(fp);
+
+  if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+    goto out;
+  if (flock(fd, LOCK_EX) < 0 ||
+      fstat(fd, &st) < 0 || !trusted_file(&st) ||
+      (buf = malloc(st.st_size + 1)) == NULL ||
+      (size = read(fd, buf, st.st_size)) != st.st_size)
+    goto out;
+  buf[size] = '\0';
+
+  /* Look for this mapping and count the mappings */
+  nlines = 0;
+  for (ptr=buf; *ptr != '\0'; nlines++) {
+    if (strncmp(ptr, line, plen) == 0) {
+      rc = 0;
+      goto out;
+    }
+    if ((ptr = strchr(ptr, '\n')) == NULL)
+      break;
+    ptr++;
+  }
+
+  if (nlines < MAP_CACHE_FILE_ENTRIES) {
+    if (lseek(fd, 0, SEEK_END) >= 0 && write(fd, line, len) == len)
+      rc = 0;
+    goto out;
+  }
+
+  /* Keep the newest half */
+  keep = buf;
+  for (n=0; n<nlines-MAP_CACHE_FILE_ENTRIES/2 && keep != NULL; n++)
+    if ((keep = strchr(keep, '\n')) != NULL)
+      keep++;
+  size = (keep != NULL) ? strlen(keep) : 0;
+
+  if (lseek(fd, 0, SEEK_SET) == 0 &&
+      write(fd, keep, size) == size &&
+      write(fd, line, len) == len &&
+      ftruncate(fd, size + len) == 0)
+    rc = 0;
+
+#if VERBOSE >= 1
+  PRINT("Compacted mapping cache %s\n", path);
+#endif
+
+ out:
+  /* Closing the file releases the lock */
+  if (fd >= 0)
+    close(fd);
+  free(buf);
+  free(line);
+  return rc;
+}
+
+/*
+ * Get a mapping of 'topo' with 'ndevs' I/O devices from the
+ * cache. If the mapping is not in memory and 'path' is not
+ * NULL, look for it in the cache file.
+ * The output arrays have 'ntasks' elements.
+ *
+ * Return 0 on a hit and 1 on a miss.
+ */
+int map_cache_lookup(struct map_key key, hwloc_topology_t topo,
+		     int ndevs, const char *path, int ntasks,
+		     int *nthreads, hwloc_bitmap_t *cpus,
+		     hwloc_bitmap_t *gpus)
+{
+  int i;
+  struct map_entry **pp, *entry = NULL;
+
+  pthread_mutex_lock(&map_cache_lock);
+
+  for (pp=&map_cache; *pp != NULL; pp=&(*pp)->next)
+    if (key_equal(&(*pp)->key, &key) && (*pp)->ntasks == ntasks) {
+      /* Move to the front */
+      entry = *pp;
+      *pp = entry->next;
+      entry->next = map_cache;
+      map_cache = entry;
+      break;
+    }
+
+  if (entry == NULL && path != NULL &&
+      (entry = map_cache_read(path, key, topo, ndevs, ntasks)) != NULL)
+    map_cache_insert(entry);
+
+  if (entry == NULL) {
+    map_cache_misses++;
+    pthread_mutex_unlock(&map_cache_lock);
+    return 1;
+  }
+
+  for (i=0; i<ntasks; i++) {
+    nthreads[i] = entry->nthreads[i];
+    hwloc_bitmap_copy(cpus[i], entry->cpus[i]);
+    hwloc_bitmap_copy(gpus[i], entry->gpus[i]);
+  }
+  map_cache_hits++;
+
+  pthread_mutex_unlock(&map_cache_lock);
+
+#if VERBOSE >= 1
+  PRINT("Mapping cache hit %016" PRIx64 "%016" PRIx64 "\n",
+	key.hash[0], key.hash[1]);
+#endif
+
+  return 0;
+}
+
+/*
+ * Save a mapping in the cache and, if 'path' is not NULL,
+ * in the cache file.
+ * Return 0 on success and 1 otherwise.
+ */
+int map_cache_store(struct map_key key, const char *path, int ntasks,
+		    int *nthreads, hwloc_bitmap_t *cpus,
+		    hwloc_bitmap_t *gpus)
+{
+  int i, rc = 0;
+  struct map_entry *entry = map_entry_alloc(key, ntasks);
+
+  if (entry == NULL)
+    return 1;
+
+  for (i=0; i<ntasks; i++) {
+    entry->nthreads[i] = nthreads[i];
+    hwloc_bitmap_copy(entry->cpus[i], cpus[i]);
+    hwloc_bitmap_copy(entry->gpus[i], gpus[i]);
+  }
+
+  pthread_mutex_lock(&map_cache_lock);
+  map_cache_insert(entry);
+  if (path != NULL)
+    rc = map_cache_write(path, entry);
+  pthread_mutex_unlock(&map_cache_lock);
+
+  return rc;
+}
+
+void map_cache_stats(int *hits, int *misses)
+{
+  pthread_mutex_lock(&map_cache_lock);
+  if (hits != NULL)
+    *hits = map_cache_hits;
+  if (misses != NULL)
+    *misses = map_cache_misses;
+  pthread_mutex_unlock(&map_cache_lock);
+}
@@ -0,0 +1,963 @@
+/******************************************************
+ * Edgar A. Leon
+ * Lawrence Livermore National Laboratory
+ ******************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <hwloc.h>
+#include "mpibind.h"
+#include "mpibind-priv.h"
+
+/*
+ * Export and import of a computed mapping.
+ *
+ * A mapping computed once, e.g., by slurmstepd or the Flux
+ * shell, can be handed to the tasks (through a file, a pipe,
+ * or a message) so that they do not need to load the topology
+ * or recompute the mapping. The export carries the number of
+ * threads, CPUs, GPUs, and NICs of each task, the I/O devices
+ * (so that every MPIBIND_ID_* type of GPU ID is available after
+ * the import), and the environment variables, if set.
+ *
+ * Binary format, version 2. Integers are 32 bits in the byte
+ * order of the writer; strings are a length followed by the
+ * characters (no null byte). CPU, GPU, and NIC sets are lists
+ * of ranges (first and last IDs).
+ *   magic version ntasks ndevs nvars
+ *   ndevs  x { type smi vendor_id name pci univ vendor model }
+ *   ntasks x { nthreads ncpu_ranges ranges... ngpu_ranges ranges...
+ *              nnic_ranges ranges... }
+ *   nvars  x { name ntasks x value }
+ *
+ * JSON format, version 2. CPU, GPU, and NIC sets are hwloc lists:
+ *   {"version": 2, "ntasks": <n>,
+ *    "devices": [{"type": <t>, "smi": <i>, "vendor_id": <i>,
+ *                 "name": <s>, "pci": <s>, "uuid": <s>,
+ *                 "vendor": <s>, "model": <s>}, ...],
+ *    "tasks": [{"nthreads": <n>, "cpus": <s>, "gpus": <s>,
+ *               "nics": <s>}, ...],
+ *    "env": [{"name": <s>, "values": [<s>, ...]}, ...]}
+ */
+
+#define EXPORT_VERSION 2
+#define EXPORT_MAGIC 0x4d50424e  // "MPBN"
+#define MAX_EXPORT_ID (1<<24)
+
+/* The smallest records of the binary format: a device has
+   3 integers and 5 strings, a task 4 integers (no ranges),
+   and each value of a variable is a string */
+#define MIN_DEV_BYTES (8 * sizeof(int32_t))
+#define MIN_TASK_BYTES (4 * sizeof(int32_t))
+#define MIN_STR_BYTES (sizeof(int32_t))
+
+/************************************************
+ * Functions defined in mpibind.c and arena.c
+ ************************************************/
+void release_devices(mpibind_t *hdl);
+void alloc_mapping(mpibind_t *hdl);
+void complete_mapping(mpibind_t *hdl);
+void* arena_alloc(struct arena *arena, size_t size);
+char* arena_strdup(struct arena *arena, const char *str);
+
+/*
+ * A mapping being imported. It is only installed
+ * in the handle once the whole input is valid.
+ */
+struct mapping {
+  int ntasks;
+  int *nthreads;
+  hwloc_bitmap_t *cpus;
+  hwloc_bitmap_t *gpus;
+  hwloc_bitmap_t *nics;
+  int ndevs;
+  struct device **devs;
+  int nvars;
+  char **names;
+  char ***values;
+};
+
+/************************************************
+ * Output buffer
+ ************************************************/
+
+struct wbuf {
+  char *data;
+  size_t len;
+  size_t cap;
+  int err;
+};
+
+static
+void wbuf_put(struct wbuf *w, const void *src, size_t n)
+{
+  char *data;
+
+  if (w->err)
+    return;
+
+  if (w->len + n > w->cap) {
+    w->cap = (w->cap == 0) ? 4096 : w->cap;
+    while (w->len + n > w->cap)
+      w->cap *= 2;
+    if ((data = realloc(w->data, w->cap)) == NULL) {
+      w->err = 1;
+      return;
+    }
+    w->data = data;
+  }
+
+  memcpy(w->data + w->len, src, n);
+  w->len += n;
+}
+
+static
+void wbuf_int(struct wbuf *w, int val)
+{
+  int32_t v = val;
+
+  wbuf_put(w, &v, sizeof(v));
+}
+
+static
+void wbuf_str(struct wbuf *w, const char *str)
+{
+  int len = (str == NULL) ? 0 : strlen(str);
+
+  wbuf_int(w, len);
+  wbuf_put(w, str, len);
+}
+
+static
+void wbuf_printf(struct wbuf *w, const char *fmt, ...)
+{
+  char str[LONG_STR_SIZE];
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(str, sizeof(str), fmt, ap);
+  va_end(ap);
+
+  if (n < 0 || n >= sizeof(str))
+    w->err = 1;
+  else
+    wbuf_put(w, str, n);
+}
+
+/*
+ * A JSON string with the characters that need it escaped
+ */
+static
+void wbuf_json_str(struct wbuf *w, const char *str)
+{
+  wbuf_put(w, "\"", 1);
+  for (; str != NULL && *str; str++) {
+    if (*str == '"' || *str == '\\') {
+      wbuf_put(w, "\\", 1);
+      wbuf_put(w, str, 1);
+    } else if ((unsigned char)*str < 0x20)
+      wbuf_printf(w, "\\u%04x", (unsigned char)*str);
+    else
+      wbuf_put(w, str, 1);
+  }
+  wbuf_put(w, "\"", 1);
+}
+
+/*
+ * The ranges of a set: count followed by first/last pairs
+ */
+static
+void wbuf_ranges(struct wbuf *w, hwloc_const_bitmap_t set)
+{
+  int first, last, n=0;
+
+  for (first=hwloc_bitmap_first(set); first >= 0;
+       first=hwloc_bitmap_next(set, last)) {
+    last = hwloc_bitmap_next_unset(set, first) - 1;
+    n++;
+  }
+  wbuf_int(w, n);
+
+  for (first=hwloc_bitmap_first(set); first >= 0;
+       first=hwloc_bitmap_next(set, last)) {
+    last = hwloc_bitmap_next_unset(set, first) - 1;
+    wbuf_int(w, first);
+    wbuf_int(w, last);
+  }
+}
+
+static
+void wbuf_json_set(struct wbuf *w, hwloc_const_bitmap_t set)
+{
+  char *str;
+
+  if (hwloc_bitmap_list_asprintf(&str, set) < 0) {
+    w->err = 1;
+    return;
+  }
+  wbuf_json_str(w, str);
+  free(str);
+}
+
+static
+void export_binary(mpibind_t *hdl, struct wbuf *w)
+{
+  int i, v;
+  char **values;
+  struct device *dev;
+
+  wbuf_int(w, EXPORT_MAGIC);
+  wbuf_int(w, EXPORT_VERSION);
+  wbuf_int(w, hdl->ntasks);
+  wbuf_int(w, hdl->ndevs);
+  wbuf_int(w, hdl->nvars);
+
+  for (i=0; i<hdl->ndevs; i++) {
+    dev = hdl->devs[i];
+    wbuf_int(w, dev->type);
+    wbuf_int(w, dev->smi);
+    wbuf_int(w, dev->vendor_id);
+    wbuf_str(w, dev->name);
+    wbuf_str(w, dev->pci);
+    wbuf_str(w, dev->univ);
+    wbuf_str(w, dev->vendor);
+    wbuf_str(w, dev->model);
+  }
+
+  for (i=0; i<hdl->ntasks; i++) {
+    wbuf_int(w, hdl->nthreads[i]);
+    wbuf_ranges(w, hdl->cpus[i]);
+    wbuf_ranges(w, hdl->gpus[i]);
+    wbuf_ranges(w, hdl->nics[i]);
+  }
+
+  for (v=0; v<hdl->nvars; v++) {
+    values = mpibind_get_env_var_values(hdl, hdl->env_vars[v].name);
+    wbuf_str(w, hdl->env_vars[v].name);
+    for (i=0; i<hdl->ntasks; i++)
+      wbuf_str(w, values[i]);
+  }
+}
+
+static
+void export_json(mpibind_t *hdl, struct wbuf *w)
+{
+  int i, v;
+  char **values;
+  struct device *dev;
+
+  wbuf_printf(w, "{\"version\": %d, \"ntasks\": %d,\n \"devices\": [",
+	      EXPORT_VERSION, hdl->ntasks);
+  for (i=0; i<hdl->ndevs; i++) {
+    dev = hdl->devs[i];
+    wbuf_printf(w, "%s\n  {\"type\": %d, \"smi\": %d, \"vendor_id\": %d, ",
+		(i == 0) ? "" : ",", dev->type, dev->smi, dev->vendor_id);
+    wbuf_printf(w, "\"name\": ");
+    wbuf_json_str(w, dev->name);
+    wbuf_printf(w, ", \"pci\": ");
+    wbuf_json_str(w, dev->pci);
+    wbuf_printf(w, ", \"uuid\": ");
+    wbuf_json_str(w, dev->univ);
+    wbuf_printf(w, ", \"vendor\": ");
+    wbuf_json_str(w, dev->vendor);
+    wbuf_printf(w, ", \"model\": ");
+    wbuf_json_str(w, dev->model);
+    wbuf_printf(w, "}");
+  }
+
+  wbuf_printf(w, "],\n \"tasks\": [");
+  for (i=0; i<hdl->ntasks; i++) {
+    wbuf_printf(w, "%s\n  {\"nthreads\": %d, \"cpus\": ",
+		(i == 0) ? "" : ",", hdl->nthreads[i]);
+    wbuf_json_set(w, hdl->cpus[i]);
+    wbuf_printf(w, ", \"gpus\": ");
+    wbuf_json_set(w, hdl->gpus[i]);
+    wbuf_printf(w, ", \"nics\": ");
+    wbuf_json_set(w, hdl->nics[i]);
+    wbuf_printf(w, "}");
+  }
+
+  wbuf_printf(w, "],\n \"env\": [");
+  for (v=0; v<hdl->nvars; v++) {
+    wbuf_printf(w, "%s\n  {\"name\": ", (v == 0) ? "" : ",");
+    wbuf_json_str(w, hdl->env_vars[v].name);
+    wbuf_printf(w, ", \"values\": [");
+    values = mpibind_get_env_var_values(hdl, hdl->env_vars[v].name);
+    for (i=0; i<hdl->ntasks; i++) {
+      if (i > 0)
+	wbuf_printf(w, ", ");
+      wbuf_json_str(w, values[i]);
+    }
+    wbuf_printf(w, "]}");
+  }
+  wbuf_printf(w, "]}\n");
+}
+
+/*
+ * Export the mapping of a handle.
+ * The output lives in the handle until the next mapping,
+ * mpibind_reset, or mpibind_finalize.
+ */
+int mpibind_export(mpibind_t *hdl, int format,
+		   const char **buf, size_t *size)
+{
+  struct wbuf w = { NULL, 0, 0, 0 };
+  char *out;
+
+  if (hdl == NULL || hdl->cpus == NULL || buf == NULL || size == NULL ||
+      (format != MPIBIND_FORMAT_BINARY && format != MPIBIND_FORMAT_JSON))
+    return 1;
+
+  if (format == MPIBIND_FORMAT_BINARY)
+    export_binary(hdl, &w);
+  else
+    export_json(hdl, &w);
+
+  if (w.err || (out = arena_alloc(&hdl->arena, w.len + 1)) == NULL) {
+    free(w.data);
+    return 1;
+  }
+
+  /* JSON is a string: Keep the null byte after it */
+  memcpy(out, w.data, w.len);
+  out[w.len] = '\0';
+  free(w.data);
+
+  *buf = out;
+  *size = w.len;
+
+  return 0;
+}
+
+/************************************************
+ * Input buffer
+ ************************************************/
+
+struct rbuf {
+  const char *p;
+  const char *end;
+  int err;
+};
+
+static
+int rbuf_int(struct rbuf *r)
+{
+  int32_t v;
+
+  if (r->err || r->end - r->p < sizeof(v)) {
+    r->err = 1;
+    return 0;
+  }
+  memcpy(&v, r->p, sizeof(v));
+  r->p += sizeof(v);
+
+  return v;
+}
+
+/*
+ * Read a string into 'str' of size 'size'.
+ * Returns a new string instead if 'str' is NULL.
+ */
+static
+char* rbuf_str(struct rbuf *r, char *str, size_t size)
+{
+  int len = rbuf_int(r);
+
+  if (r->err || len < 0 || r->end - r->p < len ||
+      (str != NULL && len >= size)) {
+    r->err = 1;
+    return NULL;
+  }
+
+  if (str == NULL && (str = malloc(len + 1)) == NULL) {
+    r->err = 1;
+    return NULL;
+  }
+  memcpy(str, r->p, len);
+  str[len] = '\0';
+  r->p += len;
+
+  return str;
+}
+
+static
+void rbuf_ranges(struct rbuf *r, hwloc_bitmap_t set)
+{
+  int i, first, last, n = rbuf_int(r);
+
+  if (n < 0 || n > MAX_EXPORT_ID)
+    r->err = 1;
+
+  for (i=0; i<n && !r->err; i++) {
+    first = rbuf_int(r);
+    last = rbuf_int(r);
+    if (first < 0 || last < first || last >= MAX_EXPORT_ID)
+      r->err = 1;
+    else
+      hwloc_bitmap_set_range(set, first, last);
+  }
+}
+
+static
+void free_mapping(struct mapping *m)
+{
+  int i, v;
+
+  for (i=0; i<m->ntasks; i++) {
+    if (m->cpus)
+      hwloc_bitmap_free(m->cpus[i]);
+    if (m->gpus)
+      hwloc_bitmap_free(m->gpus[i]);
+    if (m->nics)
+      hwloc_bitmap_free(m->nics[i]);
+  }
+  free(m->nthreads);
+  free(m->cpus);
+  free(m->gpus);
+  free(m->nics);
+
+  for (i=0; i<m->ndevs; i++)
+    free(m->devs[i]);
+  free(m->devs);
+
+  for (v=0; v<m->nvars; v++) {
+    free(m->names[v]);
+    if (m->values[v] != NULL)
+      for (i=0; i<m->ntasks; i++)
+	free(m->values[v][i]);
+    free(m->values[v]);
+  }
+  free(m->names);
+  free(m->values);
+}
+
+/*
+ * Allocate a mapping for 'ntasks' tasks, 'ndevs' devices,
+ * and 'nvars' environment variables.
+ * Returns 0 on success.
+ */
+static
+int new_mapping(struct mapping *m, int ntasks, int ndevs, int nvars)
+{
+  int i;
+
+  memset(m, 0, sizeof(struct mapping));
+  if (ntasks <= 0 || ntasks > MAX_EXPORT_ID ||
+      ndevs < 0 || ndevs > MAX_EXPORT_ID ||
+      nvars < 0 || nvars > MAX_EXPORT_ID)
+    return 1;
+
+  m->nthreads = calloc(ntasks, sizeof(int));
+  m->cpus = calloc(ntasks, sizeof(hwloc_bitmap_t));
+  m->gpus = calloc(ntasks, sizeof(hwloc_bitmap_t));
+  m->nics = calloc(ntasks, sizeof(hwloc_bitmap_t));
+  m->devs = calloc(ndevs, sizeof(struct device *));
+  m->names = calloc(nvars, sizeof(char *));
+  m->values = calloc(nvars, sizeof(char **));
+  if (!m->nthreads || !m->cpus || !m->gpus || !m->nics ||
+      (ndevs > 0 && !m->devs) ||
+      (nvars > 0 && (!m->names || !m->values)))
+    return 1;
+
+  m->ntasks = ntasks;
+  for (i=0; i<ntasks; i++) {
+    m->cpus[i] = hwloc_bitmap_alloc();
+    m->gpus[i] = hwloc_bitmap_alloc();
+    m->nics[i] = hwloc_bitmap_alloc();
+  }
+
+  m->ndevs = ndevs;
+  for (i=0; i<ndevs; i++)
+    if ((m->devs[i] = calloc(1, sizeof(struct device))) == NULL)
+      return 1;
+
+  m->nvars = nvars;
+  for (i=0; i<nvars; i++)
+    if ((m->values[i] = calloc(ntasks, sizeof(char *))) == NULL)
+      return 1;
+
+  return 0;
+}
+
+/*
+ * Devices are GPUs or NICs
+ */
+static
+int valid_device(struct device *dev)
+{
+  return (dev->type == DEV_GPU || dev->type == DEV_NIC);
+}
+
+static
+int import_binary(struct mapping *m, const char *buf, size_t size)
+{
+  int i, v, ntasks, ndevs, nvars;
+  uint64_t need;
+  struct device *dev;
+  struct rbuf r = { buf, buf + size, 0 };
+
+  if (rbuf_int(&r) != EXPORT_MAGIC || rbuf_int(&r) != EXPORT_VERSION)
+    return 1;
+
+  ntasks = rbuf_int(&r);
+  ndevs = rbuf_int(&r);
+  nvars = rbuf_int(&r);
+  if (r.err || ntasks <= 0 || ntasks > MAX_EXPORT_ID ||
+      ndevs < 0 || ndevs > MAX_EXPORT_ID ||
+      nvars < 0 || nvars > MAX_EXPORT_ID)
+    return 1;
+
+  /* Do not allocate for more records than the input can hold */
+  need = (uint64_t)ndevs * MIN_DEV_BYTES +
+    (uint64_t)ntasks * MIN_TASK_BYTES +
+    (uint64_t)nvars * (ntasks + 1) * MIN_STR_BYTES;
+  if (need > (uint64_t)(r.end - r.p) ||
+      new_mapping(m, ntasks, ndevs, nvars) != 0)
+    return 1;
+
+  for (i=0; i<ndevs; i++) {
+    dev = m->devs[i];
+    dev->type = rbuf_int(&r);
+    dev->smi = rbuf_int(&r);
+    dev->vendor_id = rbuf_int(&r);
+    rbuf_str(&r, dev->name, sizeof(dev->name));
+    rbuf_str(&r, dev->pci, sizeof(dev->pci));
+    rbuf_str(&r, dev->univ, sizeof(dev->univ));
+    rbuf_str(&r, dev->vendor, sizeof(dev->vendor));
+    rbuf_str(&r, dev->model, sizeof(dev->model));
+    if (!r.err && !valid_device(dev))
+      r.err = 1;
+  }
+
+  for (i=0; i<ntasks && !r.err; i++) {
+    m->nthreads[i] = rbuf_int(&r);
+    rbuf_ranges(&r, m->cpus[i]);
+    rbuf_ranges(&r, m->gpus[i]);
+    rbuf_ranges(&r, m->nics[i]);
+  }
+
+  for (v=0; v<nvars && !r.err; v++) {
+    m->names[v] = rbuf_str(&r, NULL, 0);
+    for (i=0; i<ntasks && !r.err; i++)
+      m->values[v][i] = rbuf_str(&r, NULL, 0);
+  }
+
+  return r.err;
+}
+
+/************************************************
+ * A minimal JSON parser for the export format
+ ************************************************/
+
+enum {
+  JSON_NULL,
+  JSON_NUM,
+  JSON_STR,
+  JSON_ARR,
+  JSON_OBJ,
+};
+
+struct json {
+  int type;
+  double num;
+  char *str;
+  int n;                 // Number of elements or members
+  char **keys;           // Member names (objects)
+  struct json *items;    // Elements or member values
+};
+
+static
+void json_free(struct json *j)
+{
+  int i;
+
+  for (i=0; i<j->n; i++) {
+    if (j->keys)
+      free(j->keys[i]);
+    json_free(&j->items[i]);
+  }
+  free(j->keys);
+  free(j->items);
+  free(j->str);
+}
+
+static
+void skip_space(struct rbuf *r)
+{
+  while (r->p < r->end &&
+	 (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r'))
+    r->p++;
+}
+
+static
+char* json_parse_str(struct rbuf *r)
+{
+  struct wbuf w = { NULL, 0, 0, 0 };
+  unsigned code;
+  char ch;
+
+  r->p++;
+  while (r->p < r->end && *r->p != '"') {
+    ch = *r->p++;
+    if (ch == '\\') {
+      if (r->p >= r->end)
+	break;
+      switch (ch = *r->p++) {
+      case 'b': ch = '\b'; break;
+      case 'f': ch = '\f'; break;
+      case 'n': ch = '\n'; break;
+      case 'r': ch = '\r'; break;
+      case 't': ch = '\t'; break;
+      case 'u':
+	/* Only ASCII is expected */
+	if (r->end - r->p < 4 || sscanf(r->p, "%4x", &code) != 1) {
+	  r->err = 1;
+	  break;
+	}
+	ch = (code < 0x80) ? code : '?';
+	r->p += 4;
+	break;
+      }
+    }
+    wbuf_put(&w, &ch, 1);
+  }
+
+  if (r->p >= r->end)
+    r->err = 1;
+  else
+    r->p++;
+
+  wbuf_put(&w, "", 1);
+  if (w.err || r->err) {
+    r->err = 1;
+    free(w.data);
+    return NULL;
+  }
+
+  return w.data;
+}
+
+static
+void json_parse(struct rbuf *r, struct json *j, int depth);
+
+/*
+ * Parse the elements of an array or the members
+ * of an object until the closing character.
+ */
+static
+void json_parse_items(struct rbuf *r, struct json *j, int depth,
+		      int is_obj)
+{
+  struct json *items;
+  char **keys;
+  char close = (is_obj) ? '}' : ']';
+
+  r->p++;
+  skip_space(r);
+  if (r->p < r->end && *r->p == close) {
+    r->p++;
+    return;
+  }
+
+  while (!r->err) {
+    items = realloc(j->items, (j->n+1) * sizeof(struct json));
+    if (items == NULL) {
+      r->err = 1;
+      return;
+    }
+    j->items = items;
+    memset(&j->items[j->n], 0, sizeof(struct json));
+
+    if (is_obj) {
+      keys = realloc(j->keys, (j->n+1) * sizeof(char *));
+      if (keys == NULL) {
+	r->err = 1;
+	return;
+      }
+      j->keys = keys;
+      j->keys[j->n] = NULL;
+
+      skip_space(r);
+      if (r->p >= r->end || *r->p != '"') {
+	r->err = 1;
+	return;
+      }
+      j->keys[j->n] = json_parse_str(r);
+      skip_space(r);
+      if (r->p >= r->end || *r->p != ':') {
+	j->n++;
+	r->err = 1;
+	return;
+      }
+      r->p++;
+    }
+
+    json_parse(r, &j->items[j->n++], depth+1);
+
+    skip_space(r);
+    if (r->p < r->end && *r->p == ',')
+      r->p++;
+    else if (r->p < r->end && *r->p == close) {
+      r->p++;
+      return;
+    } else
+      r->err = 1;
+  }
+}
+
+static
+void json_parse(struct rbuf *r, struct json *j, int depth)
+{
+  char *end;
+
+  skip_space(r);
+  if (r->p >= r->end || depth > 8) {
+    r->err = 1;
+    return;
+  }
+
+  switch (*r->p) {
+  case '"':
+    j->type = JSON_STR;
+    j->str = json_parse_str(r);
+    break;
+  case '[':
+    j->type = JSON_ARR;
+    json_parse_items(r, j, depth, 0);
+    break;
+  case '{':
+    j->type = JSON_OBJ;
+    json_parse_items(r, j, depth, 1);
+    break;
+  case 'n':
+    j->type = JSON_NULL;
+    if (r->end - r->p < 4 || strncmp(r->p, "null", 4) != 0)
+      r->err = 1;
+    r->p += 4;
+    break;
+  default:
+    /* The input is null terminated (see mpibind_import) */
+    j->type = JSON_NUM;
+    j->num = strtod(r->p, &end);
+    if (end == r->p || end > r->end)
+      r->err = 1;
+    r->p = end;
+  }
+}
+
+static
+struct json* json_get(struct json *obj, const char *key, int type)
+{
+  int i;
+
+  if (obj == NULL || obj->type != JSON_OBJ)
+    return NULL;
+
+  for (i=0; i<obj->n; i++)
+    if (obj->keys[i] && strcmp(obj->keys[i], key) == 0)
+      return (obj->items[i].type == type) ? &obj->items[i] : NULL;
+
+  return NULL;
+}
+
+static
+int json_get_int(struct json *obj, const char *key, int *val)
+{
+  struct json *j = json_get(obj, key, JSON_NUM);
+
+  /* Integers only, within the range of an int */
+  if (j == NULL || !(j->num >= INT_MIN && j->num <= INT_MAX) ||
+      j->num != (int)j->num)
+    return 1;
+  *val = j->num;
+
+  return 0;
+}
+
+static
+int json_get_str(struct json *obj, const char *key, char *str, size_t size)
+{
+  struct json *j = json_get(obj, key, JSON_STR);
+
+  if (j == NULL || strlen(j->str) >= size)
+    return 1;
+  strcpy(str, j->str);
+
+  return 0;
+}
+
+static
+int json_get_set(struct json *obj, const char *key, hwloc_bitmap_t set)
+{
+  struct json *j = json_get(obj, key, JSON_STR);
+
+  if (j == NULL || hwloc_bitmap_list_sscanf(set, j->str) < 0 ||
+      hwloc_bitmap_weight(set) < 0 ||
+      hwloc_bitmap_last(set) >= MAX_EXPORT_ID)
+    return 1;
+
+  return 0;
+}
+
+static
+int import_json(struct mapping *m, const char *buf, size_t size)
+{
+  int i, v, version, ntasks, rc=1;
+  struct json root = { 0 }, *devs, *tasks, *env, *item, *values;
+  struct device *dev;
+  struct rbuf r = { buf, buf + size, 0 };
+
+  json_parse(&r, &root, 0);
+  if (r.err ||
+      json_get_int(&root, "version", &version) || version != EXPORT_VERSION ||
+      json_get_int(&root, "ntasks", &ntasks) ||
+      (devs = json_get(&root, "devices", JSON_ARR)) == NULL ||
+      (tasks = json_get(&root, "tasks", JSON_ARR)) == NULL ||
+      (env = json_get(&root, "env", JSON_ARR)) == NULL ||
+      tasks->n != ntasks ||
+      new_mapping(m, ntasks, devs->n, env->n) != 0)
+    goto out;
+
+  for (i=0; i<devs->n; i++) {
+    item = &devs->items[i];
+    dev = m->devs[i];
+    if (json_get_int(item, "type", &dev->type) ||
+	json_get_int(item, "smi", &dev->smi) ||
+	json_get_int(item, "vendor_id", &dev->vendor_id) ||
+	json_get_str(item, "name", dev->name, sizeof(dev->name)) ||
+	json_get_str(item, "pci", dev->pci, sizeof(dev->pci)) ||
+	json_get_str(item, "uuid", dev->univ, sizeof(dev->univ)) ||
+	json_get_str(item, "vendor", dev->vendor, sizeof(dev->vendor)) ||
+	json_get_str(item, "model", dev->model, sizeof(dev->model)) ||
+	!valid_device(dev))
+      goto out;
+  }
+
+  for (i=0; i<ntasks; i++) {
+    item = &tasks->items[i];
+    if (json_get_int(item, "nthreads", &m->nthreads[i]) ||
+	json_get_set(item, "cpus", m->cpus[i]) ||
+	json_get_set(item, "gpus", m->gpus[i]) ||
+	json_get_set(item, "nics", m->nics[i]))
+      goto out;
+  }
+
+  for (v=0; v<env->n; v++) {
+    item = &env->items[v];
+    values = json_get(item, "values", JSON_ARR);
+    if (json_get(item, "name", JSON_STR) == NULL ||
+	values == NULL || values->n != ntasks)
+      goto out;
+    m->names[v] = strdup(json_get(item, "name", JSON_STR)->str);
+    for (i=0; i<ntasks; i++) {
+      if (values->items[i].type != JSON_STR)
+	goto out;
+      m->values[v][i] = strdup(values->items[i].str);
+    }
+  }
+
+  rc = 0;
+
+ out:
+  json_free(&root);
+  return rc;
+}
+
+/*
+ * Replace the mapping of a handle with an imported one.
+ * The I/O devices of the handle are replaced too, so that
+ * the GPU IDs of the mapping remain valid.
+ */
+static
+void install_mapping(mpibind_t *hdl, struct mapping *m)
+{
+  int i, v;
+
+  mpibind_reset(hdl);
+  release_devices(hdl);
+
+  hdl->devs = m->devs;
+  hdl->ndevs = m->ndevs;
+  m->devs = NULL;
+  m->ndevs = 0;
+
+  hdl->ntasks = m->ntasks;
+  alloc_mapping(hdl);
+  for (i=0; i<hdl->ntasks; i++) {
+    hdl->nthreads[i] = m->nthreads[i];
+    hwloc_bitmap_copy(hdl->cpus[i], m->cpus[i]);
+    hwloc_bitmap_copy(hdl->gpus[i], m->gpus[i]);
+    hwloc_bitmap_copy(hdl->nics[i], m->nics[i]);
+  }
+  complete_mapping(hdl);
+
+  if (m->nvars > 0) {
+    hdl->nvars = m->nvars;
+    hdl->env_vars = arena_alloc(&hdl->arena,
+				m->nvars * sizeof(mpibind_env_var));
+    hdl->names = arena_alloc(&hdl->arena, m->nvars * sizeof(char *));
+    for (v=0; v<m->nvars; v++) {
+      hdl->env_vars[v].size = hdl->ntasks;
+      hdl->env_vars[v].key = -1;
+      hdl->env_vars[v].name = arena_strdup(&hdl->arena, m->names[v]);
+      hdl->env_vars[v].values = arena_alloc(&hdl->arena,
+					    hdl->ntasks * sizeof(char *));
+      for (i=0; i<hdl->ntasks; i++)
+	hdl->env_vars[v].values[i] = arena_strdup(&hdl->arena,
+						  m->values[v][i]);
+      hdl->names[v] = hdl->env_vars[v].name;
+    }
+  }
+}
+
+/*
+ * Import a mapping exported by mpibind_export.
+ * Returns 0 on success. On failure, the handle is unchanged.
+ */
+int mpibind_import(mpibind_t *hdl, int format,
+		   const char *buf, size_t size)
+{
+  int i, val, rc;
+  char *str;
+  struct mapping m;
+
+  if (hdl == NULL || buf == NULL ||
+      (format != MPIBIND_FORMAT_BINARY && format != MPIBIND_FORMAT_JSON))
+    return 1;
+
+  memset(&m, 0, sizeof(struct mapping));
+  if (format == MPIBIND_FORMAT_BINARY)
+    rc = import_binary(&m, buf, size);
+  else {
+    /* The number parser needs a terminated string */
+    if ((str = malloc(size + 1)) == NULL)
+      return 1;
+    memcpy(str, buf, size);
+    str[size] = '\0';
+    rc = import_json(&m, str, size);
+    free(str);
+  }
+
+  /* GPUs and NICs must refer to the imported devices */
+  for (i=0; rc == 0 && i<m.ntasks; i++) {
+    hwloc_bitmap_foreach_begin(val, m.gpus[i]) {
+      if (val >= m.ndevs)
+	rc = 1;
+    } hwloc_bitmap_foreach_end();
+    hwloc_bitmap_foreach_begin(val, m.nics[i]) {
+      if (val >= m.ndevs)
+	rc = 1;
+    } hwloc_bitmap_foreach_end();
+  }
+
+  if (rc == 0)
+    install_mapping(hdl, &m);
+
+  free_mapping(&m);
+
+  return rc;
+}
@@ -9,6 +9,14 @@
 #include "mpibind-priv.h"
 #include "hwloc_utils.h"
 
+/************************************************
+ * Functions defined in arena.c
+ ************************************************/
+void arena_init(struct arena *arena);
+void* arena_alloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+void arena_release(struct arena *arena);
+
 /************************************************
  * Functions needed by the mpibind public
  * interface implemenation.
@@ -35,6 +43,107 @@ void distrib(int wks, int doms, int *wk_arr) {
       wk_arr[i] = avg;
 }
 
+/*
+ * Distribute workers over domains in proportion to the
+ * domain weights, e.g., cores over tasks of different sizes.
+ * If there are as many workers as domains, every domain
+ * gets at least one worker. Without weights, this is distrib.
+ * Input:
+ *   wks: number of workers
+ *  doms: number of domains
+ *  weights: array of length doms or NULL
+ *  scratch: memory for temporary arrays
+ * Output: wk_arr of length doms
+ */
+static
+void distrib_weighted(struct arena *scratch, int wks, int doms,
+		      const int *weights, int *wk_arr)
+{
+  int i, j, best, assigned = 0;
+  long long total = 0, *rem;
+
+  if (weights == NULL) {
+    distrib(wks, doms, wk_arr);
+    return;
+  }
+  rem = arena_alloc(scratch, doms * sizeof(long long));
+
+  for (i=0; i<doms; i++)
+    total += weights[i];
+
+  /* Take the floor first, then give the leftover workers
+     to the domains with the highest remainders */
+  for (i=0; i<doms; i++) {
+    wk_arr[i] = (long long)wks * weights[i] / total;
+    rem[i] = (long long)wks * weights[i] % total;
+    assigned += wk_arr[i];
+  }
+  for (; assigned<wks; assigned++) {
+    best = 0;
+    for (i=1; i<doms; i++)
+      if (rem[i] > rem[best])
+	best = i;
+    wk_arr[best]++;
+    rem[best] = -1;
+  }
+
+  /* A light domain may end up with nothing */
+  if (wks >= doms)
+    for (i=0; i<doms; i++)
+      if (wk_arr[i] == 0) {
+	best = 0;
+	for (j=1; j<doms; j++)
+	  if (wk_arr[j] > wk_arr[best])
+	    best = j;
+	wk_arr[best]--;
+	wk_arr[i]++;
+      }
+}
+
+/*
+ * Split consecutive workers into consecutive domains: A worker
+ * goes to the domain that holds the middle of its share of
+ * the total weight, e.g., three tasks with weights 2,1,1 over
+ * two GPUs results in 1,2. A domain may get no workers.
+ * Input:
+ *   wks: number of workers
+ *   weights: array of length wks or NULL (same weight)
+ *   doms: number of domains
+ *   caps: capacity of each domain or NULL (same capacity)
+ * Output: wk_arr of length doms
+ */
+static
+void group_weighted(int wks, const int *weights, int doms,
+		    const int *caps, int *wk_arr)
+{
+  int i, d;
+  double w, mid, wsum = 0, csum = 0, acc = 0, bound;
+
+  for (i=0; i<wks; i++)
+    wsum += (weights) ? weights[i] : 1;
+  for (d=0; d<doms; d++) {
+    csum += (caps) ? caps[d] : 1;
+    wk_arr[d] = 0;
+  }
+  if (csum <= 0) {
+    caps = NULL;
+    csum = doms;
+  }
+
+  d = 0;
+  bound = (caps) ? caps[0] : 1;
+  for (i=0; i<wks; i++) {
+    w = (weights) ? weights[i] : 1;
+    mid = (acc + w/2) / wsum * csum;
+    acc += w;
+    while (d < doms-1 && mid >= bound) {
+      d++;
+      bound += (caps) ? caps[d] : 1;
+    }
+    wk_arr[d]++;
+  }
+}
+
 /*
  * Print an array on one line starting with 'head'
  */
@@ -76,45 +185,26 @@ hwloc_obj_t get_pci_busid(hwloc_obj_t dev, char *busid, int size)
   return obj;
 }
 
-/*
- * Input:
- *   root: A normal object (not numa, io, or misc object).
- * Output:
- *   gpus: The co-processors reachable from the root.
- */
-static
-int get_gpus(hwloc_topology_t topo,
-	     struct device **devs, int ndevs,
-	     hwloc_obj_t root, hwloc_bitmap_t gpus)
-{
-  int i;
-  hwloc_bitmap_zero(gpus);
-
-  for (i=0; i<ndevs; i++)
-    if (devs[i]->type == DEV_GPU &&
-	hwloc_obj_is_in_subtree(topo, devs[i]->ancestor, root))
-      hwloc_bitmap_set(gpus, i);
-
-  return hwloc_bitmap_weight(gpus);
-}
-
 /*
  * Fill buckets with elements
  * Example: Each bucket has a size [0]=3 [1]=3 [2]=2 [3]=2
  * Filled buckets:
  * [0]=2,4,6 [1]=8,10,12 [2]=14,16 [3]=18,20
+ * With weights (one per bucket), the bucket sizes are
+ * proportional to the weights.
  */
 static
-void fill_in_buckets(int *elems, int nelems,
-		     hwloc_bitmap_t *buckets, int nbuckets)
+void fill_in_buckets(struct arena *scratch, int *elems, int nelems,
+		     hwloc_bitmap_t *buckets, int nbuckets,
+		     const int *weights)
 {
   int i, count, bucket_idx, elem_idx;
 
   if (nelems >= nbuckets) {
-    int nelems_per_bucket[nbuckets];
+    int *nelems_per_bucket = arena_alloc(scratch, nbuckets * sizeof(int));
 
     /* Distribute nelems over nbuckets */
-    distrib(nelems, nbuckets, nelems_per_bucket);
+    distrib_weighted(scratch, nelems, nbuckets, weights, nelems_per_bucket);
 
     count = 0;
     bucket_idx = 0;
@@ -126,19 +216,24 @@ void fill_in_buckets(int *elems, int nelems,
       }
     }
   } else {
-    int nbuckets_per_elem[nelems];
+    int *nbuckets_per_elem = arena_alloc(scratch, nelems * sizeof(int));
 
     /* Distribute nbuckets over nelems */
-    distrib(nbuckets, nelems, nbuckets_per_elem);
+    if (weights == NULL)
+      distrib(nbuckets, nelems, nbuckets_per_elem);
+    else
+      group_weighted(nbuckets, weights, nelems, NULL, nbuckets_per_elem);
 
     count = 0;
     elem_idx = 0;
     for (i=0; i<nbuckets; i++) {
-      hwloc_bitmap_set(buckets[i], elems[elem_idx]);
-      if (++count == nbuckets_per_elem[elem_idx]) {
+      /* With weights, an element may have no buckets */
+      while (count == nbuckets_per_elem[elem_idx]) {
 	count = 0;
 	elem_idx++;
       }
+      hwloc_bitmap_set(buckets[i], elems[elem_idx]);
+      count++;
     }
   }
 
@@ -161,19 +256,21 @@ void fill_in_buckets(int *elems, int nelems,
  * Example: elems={2,4,6}, buckets=5.
  * Filled buckets:
  * [0]=2 [1]=2 [2]=4 [3]=4 [4]=6
+ * With weights, see fill_in_buckets.
  */
 static
-void fill_in_buckets_bitmap(hwloc_bitmap_t elems,
-			    hwloc_bitmap_t *buckets, int nbuckets)
+void fill_in_buckets_bitmap(struct arena *scratch, hwloc_bitmap_t elems,
+			    hwloc_bitmap_t *buckets, int nbuckets,
+			    const int *weights)
 {
   int i, count, bucket_idx, elem_idx, curr;
   int nelems = hwloc_bitmap_weight(elems);
 
   if (nelems >= nbuckets) {
-    int nelems_per_bucket[nbuckets];
+    int *nelems_per_bucket = arena_alloc(scratch, nbuckets * sizeof(int));
 
     /* Distribute nelems over nbuckets */
-    distrib(nelems, nbuckets, nelems_per_bucket);
+    distrib_weighted(scratch, nelems, nbuckets, weights, nelems_per_bucket);
 
     count = 0;
     bucket_idx = 0;
@@ -186,21 +283,25 @@ void fill_in_buckets_bitmap(hwloc_bitmap_t elems,
     } hwloc_bitmap_foreach_end();
 
   } else {
-    int nbuckets_per_elem[nelems];
+    int *nbuckets_per_elem = arena_alloc(scratch, nelems * sizeof(int));
 
     /* Distribute nbuckets over nelems */
-    distrib(nbuckets, nelems, nbuckets_per_elem);
+    if (weights == NULL)
+      distrib(nbuckets, nelems, nbuckets_per_elem);
+    else
+      group_weighted(nbuckets, weights, nelems, NULL, nbuckets_per_elem);
 
     count = 0;
     elem_idx = 0;
     curr = hwloc_bitmap_first(elems);
     for (i=0; i<nbuckets; i++) {
-      hwloc_bitmap_set(buckets[i], curr);
-      if (++count == nbuckets_per_elem[elem_idx]) {
+      while (count == nbuckets_per_elem[elem_idx]) {
 	count = 0;
 	elem_idx++;
 	curr = hwloc_bitmap_next(elems, curr);
       }
+      hwloc_bitmap_set(buckets[i], curr);
+      count++;
     }
   }
 
@@ -215,8 +316,37 @@ void fill_in_buckets_bitmap(hwloc_bitmap_t elems,
 }
 
 /*
- * Given a number of objects (nobjs), their cpus (puset), and
- * a number of tasks, distribute the objects among the tasks.
+ * Get the first (at most) 'max' PUs of an object in the order
+ * of their OS indices. Children are sorted by their cpusets,
+ * thus these are the first PUs of the object's cpuset for
+ * a core, and the first PU for any object (used with max=1).
+ * Walking the object rather than its cpuset avoids scanning
+ * a bitmap as long as the topology for every object.
+ * Output: pus.
+ * Returns the number of PUs.
+ */
+static
+int first_pus(hwloc_obj_t obj, int max, int *pus)
+{
+  int n = 0;
+  hwloc_obj_t child;
+
+  if (obj->type == HWLOC_OBJ_PU) {
+    if (max > 0)
+      pus[n++] = obj->os_index;
+    return n;
+  }
+
+  for (child=obj->first_child; child != NULL && n < max;
+       child=child->next_sibling)
+    n += first_pus(child, max-n, pus+n);
+
+  return n;
+}
+
+/*
+ * Given a number of objects (nobjs) and a number of tasks,
+ * distribute the objects among the tasks.
  * Each task is assigned the number of cpus indicated by pus_per_obj.
  *
  * Updated this function to consider the special case when
@@ -232,38 +362,45 @@ void fill_in_buckets_bitmap(hwloc_bitmap_t elems,
  *   task 0 -> 0
  *   task 1 -> 1
  *   task 2 -> 2,3
+ * With weights (one per task), a task gets a number of
+ * objects proportional to its weight.
  */
 static
-void distrib_and_assign_pus(hwloc_bitmap_t *puset, int nobjs,
+void distrib_and_assign_pus(struct arena *scratch,
+			    hwloc_obj_t *objs, int nobjs,
 			    int pus_per_obj,
-			    hwloc_bitmap_t *cpus, int ntasks)
+			    hwloc_bitmap_t *cpus, int ntasks,
+			    const int *weights)
 {
-  int i, j, curr;
-  hwloc_bitmap_t puset_rev[nobjs];
-
-  /* First, create the revised subset of pus for each object
-     based on pus_per_obj */
-  for (j=0; j<nobjs; j++) {
-    puset_rev[j] = hwloc_bitmap_alloc();
-    curr=-1;
-    for (i=0; i<pus_per_obj; i++) {
-	    curr = hwloc_bitmap_next(puset[j], curr);
-	    hwloc_bitmap_set(puset_rev[j], curr);
-    }
-  }
+  int i, j, k, task, *pus, *npus;
+
+  /* E.g., the cores of a CPU kind that is not used */
+  if (nobjs == 0)
+    return;
+
+  /* First, get the revised subset of pus for each object
+     based on pus_per_obj. Cores may have different numbers
+     of PUs, e.g., on hybrid CPUs */
+  pus = arena_alloc(scratch, nobjs * pus_per_obj * sizeof(int));
+  npus = arena_alloc(scratch, nobjs * sizeof(int));
+  for (j=0; j<nobjs; j++)
+    npus[j] = first_pus(objs[j], pus_per_obj, pus + j*pus_per_obj);
 #if VERBOSE >=2
   char str[100];
-  for (i=0; i<nobjs; i++) {
-    hwloc_bitmap_list_snprintf(str, sizeof(str), puset_rev[i]);
-    PRINT("puset_rev[%d]: %s\n", i, str);
+  for (j=0; j<nobjs; j++) {
+    snprintf(str, sizeof(str), "pus[%d]", j);
+    print_array(pus + j*pus_per_obj, npus[j], str);
   }
 #endif
 
   if (nobjs < ntasks) {
     /* Two or more tasks share an object (e.g., core).
        In this case, distribute the object's PUs over the tasks. */
-    int ntasks_per_obj[nobjs];
-    distrib(ntasks, nobjs, ntasks_per_obj);
+    int *ntasks_per_obj = arena_alloc(scratch, nobjs * sizeof(int));
+    if (weights == NULL)
+      distrib(ntasks, nobjs, ntasks_per_obj);
+    else
+      group_weighted(ntasks, weights, nobjs, NULL, ntasks_per_obj);
     // Print
 #if VERBOSE >= 2
     print_array(ntasks_per_obj, nobjs, "ntasks_per_obj");
@@ -272,7 +409,10 @@ void distrib_and_assign_pus(hwloc_bitmap_t *puset, int nobjs,
     // Distribute the pus over tasks
     j = 0;
     for (i=0; i<nobjs; i++) {
-      fill_in_buckets_bitmap(puset_rev[i], cpus+j, ntasks_per_obj[i]);
+      if (ntasks_per_obj[i] == 0)
+	continue;
+      fill_in_buckets(scratch, pus + i*pus_per_obj, npus[i], cpus+j,
+		      ntasks_per_obj[i], (weights) ? weights+j : NULL);
       j += ntasks_per_obj[i];
     }
 #if VERBOSE >= 2
@@ -283,54 +423,92 @@ void distrib_and_assign_pus(hwloc_bitmap_t *puset, int nobjs,
 #endif
   } else {
     // Original distrib_and_assign_pus
-    hwloc_bitmap_t objs = hwloc_bitmap_alloc();
-    hwloc_bitmap_set_range(objs, 0, nobjs-1);
-
-    hwloc_bitmap_t objs_per_task[ntasks];
-    for (i=0; i<ntasks; i++)
-      objs_per_task[i] = hwloc_bitmap_alloc();
-
-    /* Distribute the objects among the tasks */
-    fill_in_buckets_bitmap(objs, objs_per_task, ntasks);
-    hwloc_bitmap_free(objs);
+    /* Distribute the objects among the tasks: Each
+       task gets consecutive objects */
+    int *nobjs_per_task = arena_alloc(scratch, ntasks * sizeof(int));
+    distrib_weighted(scratch, nobjs, ntasks, weights, nobjs_per_task);
 
     /* Assign pus_per_obj pus to each task rather than
        all the pus of each object */
-    int obj, task;
-    for (task=0; task<ntasks; task++) {
-      /* Get the PU set for each object associated with this task */
-      hwloc_bitmap_foreach_begin(obj, objs_per_task[task]) {
-        hwloc_bitmap_or(cpus[task], puset_rev[obj], cpus[task]);
-      } hwloc_bitmap_foreach_end();
-
-      hwloc_bitmap_free(objs_per_task[task]);
-    }
+    for (j=0, task=0; task<ntasks; task++)
+      for (i=0; i<nobjs_per_task[task]; i++, j++)
+	for (k=0; k<npus[j]; k++)
+	  hwloc_bitmap_set(cpus[task], pus[j*pus_per_obj + k]);
+  }
+}
+
+/*
+ * Get the objects at 'depth' in the subtree of 'root' whose
+ * PUs are all in 'set' (NULL for no restriction), in logical
+ * order. This is hwloc_get_next_obj_inside_cpuset_by_depth
+ * without walking the whole level: Calling it for every NUMA
+ * domain would cost the number of NUMA domains times the size
+ * of the topology.
+ * Output: objs (NULL to only count the objects).
+ * Returns the number of objects.
+ */
+static
+int objs_inside_subtree(hwloc_obj_t root, int depth,
+			hwloc_const_bitmap_t set, hwloc_obj_t *objs)
+{
+  int n = 0;
+  hwloc_obj_t child;
+
+  if (set != NULL && !hwloc_bitmap_intersects(root->cpuset, set))
+    return 0;
+
+  if (root->depth == depth) {
+    if (set != NULL && !hwloc_bitmap_isincluded(root->cpuset, set))
+      return 0;
+    if (objs != NULL)
+      objs[0] = root;
+    return 1;
   }
 
-  // Free up resources
-  for (i=0; i<nobjs; i++)
-    hwloc_bitmap_free(puset_rev[i]);
+  for (child=root->first_child; child != NULL; child=child->next_sibling)
+    if (child->depth <= depth)
+      n += objs_inside_subtree(child, depth, set,
+			       (objs) ? objs+n : NULL);
+
+  return n;
 }
 
 /*
- * Get the Hardware SMT level.
+ * Get the Hardware SMT level of the cores under root with
+ * PUs in set (NULL for all of them): The maximum number of
+ * PUs per core. Cores of different kinds may have a different
+ * number of PUs, e.g., P-cores with 2 PUs and E-cores with 1 PU.
  */
-int get_smt_level(hwloc_topology_t topo)
+static
+int get_smt_level_inside(hwloc_topology_t topo, hwloc_obj_t root,
+			 hwloc_const_bitmap_t set)
 {
   /* If there are no Core objects, assume SMT-1 */
-  int level = 1;
-  hwloc_obj_t obj = NULL;
+  int i, n, level = 1;
+  hwloc_obj_t *cores = NULL;
 
-  if ( (obj = hwloc_get_next_obj_by_depth(topo, mpibind_get_core_depth(topo),
-					  obj)) ) {
-    level = (obj->arity == 0) ? 1 : obj->arity;
-    /* Debug */
-    //printf("SMT level: %d (obj->arity: %d)\n", level, obj->arity);
+  n = objs_inside_subtree(root, mpibind_get_core_depth(topo), set, NULL);
+  if (n > 0 && (cores = malloc(n * sizeof(hwloc_obj_t))) == NULL) {
+    fprintf(stderr, "Warn: Couldn't get the cores, assuming SMT-1\n");
+    return level;
   }
+  objs_inside_subtree(root, mpibind_get_core_depth(topo), set, cores);
+  for (i=0; i<n; i++)
+    if ((int)cores[i]->arity > level)
+      level = cores[i]->arity;
+  free(cores);
 
   return level;
 }
 
+/*
+ * Get the Hardware SMT level.
+ */
+int get_smt_level(hwloc_topology_t topo)
+{
+  return get_smt_level_inside(topo, hwloc_get_root_obj(topo), NULL);
+}
+
 /*
  * Input:
  *   root: The root object to start from.
@@ -338,17 +516,25 @@ int get_smt_level(hwloc_topology_t topo)
  *   nthreads: the number of threads per task. If zero,
  *      set the number of threads appropriately.
  *   usr_smt: map the workers to this SMT level.
+ *   allowed: If not NULL, only use the PUs of root in this set,
+ *      e.g., the PUs of a CPU kind.
+ *   weights: If not NULL, the weight of each task. The tasks
+ *      get a share of the cores proportional to their weight.
+ *   scratch: Memory for temporary arrays.
  * Output:
  *   cpus: array of one cpuset per task.
  */
 static
-void cpu_match(hwloc_topology_t topo, hwloc_obj_t root, int ntasks,
-	       int *nthreads_ptr, int usr_smt, hwloc_bitmap_t *cpus)
+void cpu_match(struct arena *scratch,
+	       hwloc_topology_t topo, hwloc_obj_t root, int ntasks,
+	       int *nthreads_ptr, int usr_smt,
+	       hwloc_const_bitmap_t allowed, const int *weights,
+	       hwloc_bitmap_t *cpus)
 {
   int i, nwks, nobjs, hw_smt, it_smt, pus_per_obj;
   int depth, core_depth;
-  hwloc_obj_t obj;
-  hwloc_bitmap_t *cpuset;
+  hwloc_obj_t *objs;
+  hwloc_bitmap_t rset = NULL;
 #if VERBOSE >= 1
   char str[SHORT_STR_SIZE];
 #endif
@@ -356,8 +542,14 @@ void cpu_match(hwloc_topology_t topo, hwloc_obj_t root, int ntasks,
   for (i=0; i<ntasks; i++)
     hwloc_bitmap_zero(cpus[i]);
 
+  /* Without a restriction, every object under root is used */
+  if (allowed != NULL) {
+    rset = hwloc_bitmap_alloc();
+    hwloc_bitmap_and(rset, root->cpuset, allowed);
+  }
+
   /* it_smt holds the intermediate SMT level */
-  hw_smt = get_smt_level(topo);
+  hw_smt = get_smt_level_inside(topo, root, rset);
   it_smt = (usr_smt > 1 && usr_smt < hw_smt) ? usr_smt : 0;
 
 #if VERBOSE >= 4
@@ -370,9 +562,7 @@ void cpu_match(hwloc_topology_t topo, hwloc_obj_t root, int ntasks,
   if (*nthreads_ptr <= 0) {
     depth = (usr_smt < hw_smt) ? core_depth :
       hwloc_topology_get_depth(topo) - 1;
-    nobjs = hwloc_get_nbobjs_inside_cpuset_by_depth(topo,
-						    root->cpuset,
-						    depth);
+    nobjs = objs_inside_subtree(root, depth, rset, NULL);
     if (it_smt)
       nobjs *= it_smt;
 
@@ -396,27 +586,21 @@ void cpu_match(hwloc_topology_t topo, hwloc_obj_t root, int ntasks,
 
   /* Walk the tree to find a matching level */
   for (depth=root->depth; depth<=core_depth; depth++) {
-    nobjs =
-      hwloc_get_nbobjs_inside_cpuset_by_depth(topo,
-					      root->cpuset, depth);
+    nobjs = objs_inside_subtree(root, depth, rset, NULL);
 
     /* Usr smt always matches at the Core level */
     if (usr_smt && depth != core_depth)
       continue;
 
     if (nobjs >= nwks || depth==core_depth) {
-      /* Get the cpu sets of each object in this level */
-      cpuset = calloc(nobjs, sizeof(hwloc_bitmap_t));
-      for (i=0; i<nobjs; i++) {
-	      obj = hwloc_get_obj_inside_cpuset_by_depth(topo, root->cpuset,
-						   depth, i);
-	      cpuset[i] = hwloc_bitmap_dup(obj->cpuset);
+      /* Get the objects in this level */
+      objs = arena_alloc(scratch, nobjs * sizeof(hwloc_obj_t));
+      objs_inside_subtree(root, depth, rset, objs);
 #if VERBOSE >= 1
-	/* Save the object type */
-	      if (i == 0)
-	        hwloc_obj_type_snprintf(str, sizeof(str), obj, 1);
+      /* Save the object type */
+      if (nobjs > 0)
+	      hwloc_obj_type_snprintf(str, sizeof(str), objs[0], 1);
 #endif
-      }
 
       /* Core level or above should have only 1 PU */
       pus_per_obj = 1;
@@ -430,7 +614,8 @@ void cpu_match(hwloc_topology_t topo, hwloc_obj_t root, int ntasks,
 	          break;
 	        }
 
-      distrib_and_assign_pus(cpuset, nobjs, pus_per_obj, cpus, ntasks);
+      distrib_and_assign_pus(scratch, objs, nobjs, pus_per_obj,
+			     cpus, ntasks, weights);
       //distrib_and_assign_pus_v1(cpuset, nobjs, pus_per_obj, cpus, ntasks);
 
       /* Verbose */
@@ -439,38 +624,35 @@ void cpu_match(hwloc_topology_t topo, hwloc_obj_t root, int ntasks,
 	    str, pus_per_obj, depth, nobjs, nobjs*pus_per_obj, nwks);
 #endif
 
-      /* Clean up */
-      for (i=0; i<nobjs; i++)
-	      hwloc_bitmap_free(cpuset[i]);
-      free(cpuset);
-
       break;
     }
   }
+
+  if (rset != NULL)
+    hwloc_bitmap_free(rset);
 }
 
 /*
- * Distribute the GPUs reachable by root over num tasks.
+ * Distribute a set of GPUs over num tasks.
+ * NICs are distributed the same way (see nic_match).
  * Input:
- *   root: An hwloc object to start from.
+ *   gpus: The GPUs reachable from a NUMA domain.
  *   ntasks: The number of tasks.
+ *   weights: The weight of each task or NULL.
+ *   scratch: Memory for temporary arrays.
  * Output:
  *   gpus_pt: Element i of this array is a bitmap of the GPUs
  *            assigned to task i.
  */
 static
-void gpu_match(hwloc_topology_t topo,
-	       struct device **devs, int ndevs,
-               hwloc_obj_t root, int ntasks,
-	       hwloc_bitmap_t *gpus_pt)
+void gpu_match(struct arena *scratch,
+	       hwloc_const_bitmap_t gpus, int ntasks,
+	       const int *weights, hwloc_bitmap_t *gpus_pt)
 {
-  hwloc_bitmap_t gpus;
   int i, devid, num_gpus;
   int *elems;
 
-  /* Get the GPUs of this NUMA */
-  gpus = hwloc_bitmap_alloc();
-  num_gpus = get_gpus(topo, devs, ndevs, root, gpus);
+  num_gpus = hwloc_bitmap_weight(gpus);
 #if VERBOSE >=2
   PRINT("Num GPUs for this NUMA domain: %d\n", num_gpus);
 #endif
@@ -478,18 +660,14 @@ void gpu_match(hwloc_topology_t topo,
   /* Distribute GPUs among tasks */
   if (num_gpus > 0) {
     /* Get the GPUs in elems[] for fill_in_buckets */
-    elems = calloc(num_gpus, sizeof(int));
+    elems = arena_alloc(scratch, num_gpus * sizeof(int));
     i = 0;
     hwloc_bitmap_foreach_begin(devid, gpus) {
       elems[i++] = devid;
     } hwloc_bitmap_foreach_end();
 
-    fill_in_buckets(elems, num_gpus, gpus_pt, ntasks);
-
-    free(elems);
+    fill_in_buckets(scratch, elems, num_gpus, gpus_pt, ntasks, weights);
   }
-
-  hwloc_bitmap_free(gpus);
 }
 
 /*
@@ -519,10 +697,10 @@ int compare_indices_desc(const void *a, const void *b)
  * array of indices.
  */
 static
-void sort_ints_desc(int *arr, int n, int *indices)
+void sort_ints_desc(struct arena *scratch, int *arr, int n, int *indices)
 {
   int i;
-  int* ptrs[n];
+  int **ptrs = arena_alloc(scratch, n * sizeof(int *));
 
   for (i=0; i<n; i++)
     ptrs[i] = arr + i;
@@ -540,10 +718,15 @@ void sort_ints_desc(int *arr, int n, int *indices)
  * to make an appropriate assignment. Before this
  * function I was distributing the tasks evenly among
  * NUMA domains.
+ * With the NUMA distances (dist != NULL), leftover tasks
+ * go to the NUMAs farthest from those that already got
+ * one, e.g., spreading an under-subscribed job over the
+ * packages of a node for more memory bandwidth.
  */
 static
-void num_tasks_per_numa(int ntasks, int nnumas, int *cus_per_numa,
-			int *ntasks_per_numa)
+void num_tasks_per_numa(struct arena *scratch,
+			int ntasks, int nnumas, int *cus_per_numa,
+			hwloc_uint64_t *dist, int *ntasks_per_numa)
 {
   /* Total number of compute units */
   int i, ncus=0;
@@ -555,7 +738,7 @@ void num_tasks_per_numa(int ntasks, int nnumas, int *cus_per_numa,
      Use floor(ntasks * ncus_per_numa / ncus) first,
      then use the remainder to assign leftover tasks
      (since we are taking the floor) */
-  int rem[nnumas];
+  int *rem = arena_alloc(scratch, nnumas * sizeof(int));
   int numerator, assigned=0;
   for (i=0; i<nnumas; i++) {
     numerator = ntasks * cus_per_numa[i];
@@ -567,52 +750,209 @@ void num_tasks_per_numa(int ntasks, int nnumas, int *cus_per_numa,
   /* Use the remainder to assign leftover tasks.
      Use the NUMAs with the highests remainders
      to assign an extra task to those NUMAs */
-  int indices[nnumas];
-  sort_ints_desc(rem, nnumas, indices);
+  if (dist == NULL) {
+    int *indices = arena_alloc(scratch, nnumas * sizeof(int));
+    sort_ints_desc(scratch, rem, nnumas, indices);
+
+    for (i=0; i<ntasks-assigned; i++)
+      ntasks_per_numa[indices[i]] += 1;
+    return;
+  }
 
-  for (i=0; i<ntasks-assigned; i++)
-    ntasks_per_numa[indices[i]] += 1;
+  /* Break ties between equal remainders with the
+     distance to the NUMAs with an extra task */
+  int j, k, best;
+  hwloc_uint64_t *sum = arena_alloc(scratch,
+				    nnumas * sizeof(hwloc_uint64_t));
+
+  for (k=0; k<ntasks-assigned; k++) {
+    best = -1;
+    for (i=0; i<nnumas; i++)
+      if (rem[i] >= 0 &&
+	  (best < 0 || rem[i] > rem[best] ||
+	   (rem[i] == rem[best] && sum[i] > sum[best])))
+	best = i;
+
+    ntasks_per_numa[best] += 1;
+    rem[best] = -1;
+    for (j=0; j<nnumas; j++)
+      sum[j] += dist[j*nnumas + best];
+  }
 }
 
 /*
- * Calculate the number of PUs per NUMA
- * Useful to determine how many tasks per NUMA to assign.
+ * Find the NUMA domains with PUs in 'allowed' (all of
+ * them if 'allowed' is NULL).
+ * Output: usable of length nnumas.
+ * Returns the number of usable NUMA domains.
  */
 static
-void num_pus_per_numa(hwloc_topology_t topo,
-		      int nnumas, int *pus_per_numa)
+int usable_numas(struct topo_index *idx, hwloc_const_bitmap_t allowed,
+		 char *usable)
 {
-  int i = 0;
-  hwloc_obj_t obj = NULL;
-  while ((obj=hwloc_get_next_obj_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE,
-					  obj)) != NULL) {
-    pus_per_numa[i++] = hwloc_bitmap_weight(obj->cpuset);
+  int i, n = 0;
+
+  for (i=0; i<idx->nnumas; i++) {
+    usable[i] = (allowed == NULL) ? 1 :
+      hwloc_bitmap_intersects(idx->numas[i]->cpuset, allowed);
+    n += usable[i];
   }
+
+  return n;
 }
 
 /*
- * Calculate the number of GPUs per NUMA
- * Useful to determine how many tasks per NUMA to assign.
+ * Order the usable NUMA domains so that consecutive groups of
+ * sizes numas_per_task are close to each other: A group
+ * starts with the first NUMA not taken and adds the NUMAs
+ * with the minimum total distance to the group. Without
+ * the NUMA distances, this is the object order.
  */
 static
-void num_gpus_per_numa(hwloc_topology_t topo,
-		       struct device **devs, int ndevs,
-		       int nnumas, int *gpus_per_numa)
+void order_numas(struct topo_index *idx, const char *usable, int ntasks,
+		 int *numas_per_task, int *order)
 {
-  int i, j;
-  for (i=0; i<nnumas; i++)
-    gpus_per_numa[i] = 0;
+  int i, j, k, t, n, best, nnumas = idx->nnumas;
+  char *taken = arena_alloc(&idx->scratch, nnumas);
+  hwloc_uint64_t *sum = arena_alloc(&idx->scratch,
+				    nnumas * sizeof(hwloc_uint64_t));
+
+  for (n=0, i=0; i<nnumas; i++) {
+    if (usable[i])
+      order[n++] = i;
+    taken[i] = !usable[i];
+  }
+  if (idx->numa_dist == NULL)
+    return;
+
+  for (n=0, t=0; t<ntasks; t++) {
+    for (i=0; i<nnumas; i++)
+      sum[i] = 0;
+
+    for (k=0; k<numas_per_task[t]; k++, n++) {
+      best = -1;
+      for (i=0; i<nnumas; i++)
+	if (!taken[i] && (best < 0 || sum[i] < sum[best]))
+	  best = i;
+
+      order[n] = best;
+      taken[best] = 1;
+      for (j=0; j<nnumas; j++)
+	sum[j] += idx->numa_dist[j*nnumas + best];
+    }
+  }
+}
 
-  i = 0;
-  hwloc_obj_t obj = NULL;
-  while ((obj=hwloc_get_next_obj_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE,
-					  obj)) != NULL) {
-    for (j=0; j<ndevs; j++)
-      if (devs[j]->type == DEV_GPU)
-	if (hwloc_bitmap_isset(devs[j]->ancestor->nodeset, obj->os_index))
-	  gpus_per_numa[i] += 1;
-    i++;
+/*
+ * Like cpu_match, but aware of the L3 caches (last-level
+ * caches) under root: A task spans more than one L3 only
+ * when there are fewer tasks than L3s, in which case each
+ * task gets whole L3s. Otherwise, tasks are balanced over the
+ * L3s based on their number of cores. Without two or more
+ * L3s under root, this is cpu_match.
+ * Input:
+ *   scratch, root, ntasks, usr_smt, allowed: As in cpu_match.
+ *   nthreads: The number of threads per task (0 to calculate).
+ * Output:
+ *   nthreads_pt, cpus: The threads and cpuset of each task.
+ */
+static
+void cpu_match_llc(struct arena *scratch,
+		   hwloc_topology_t topo, hwloc_obj_t root, int ntasks,
+		   int nthreads, int usr_smt, hwloc_const_bitmap_t allowed,
+		   int *nthreads_pt, hwloc_bitmap_t *cpus)
+{
+  int i, j, k, l, n, nt, nl3s, l3_depth, core_depth, rem, task_offset;
+  int *ncores, *ntasks_per_l3, *nl3s_per_task, *nthreads_per_l3;
+  hwloc_obj_t *l3s, obj;
+  hwloc_bitmap_t set;
+
+  /* L3s at different depths are not supported */
+  l3_depth = hwloc_get_type_depth(topo, HWLOC_OBJ_L3CACHE);
+  n = (l3_depth >= 0) ? objs_inside_subtree(root, l3_depth, NULL, NULL) : 0;
+  core_depth = mpibind_get_core_depth(topo);
+  l3s = arena_alloc(scratch, n * sizeof(hwloc_obj_t));
+  ncores = arena_alloc(scratch, n * sizeof(int));
+  set = hwloc_bitmap_alloc();
+  if (n > 0)
+    objs_inside_subtree(root, l3_depth, NULL, l3s);
+
+  /* The L3s with allowed cores */
+  for (nl3s=0, l=0; l<n; l++) {
+    obj = l3s[l];
+    if (allowed != NULL)
+      hwloc_bitmap_and(set, obj->cpuset, allowed);
+    l3s[nl3s] = obj;
+    ncores[nl3s] = objs_inside_subtree(obj, core_depth,
+				       (allowed) ? set : NULL, NULL);
+    if (ncores[nl3s] > 0)
+      nl3s++;
   }
+
+  if (nl3s <= 1) {
+    nt = nthreads;
+    cpu_match(scratch, topo, root, ntasks, &nt, usr_smt, allowed, NULL,
+	      cpus);
+    for (i=0; i<ntasks; i++)
+      nthreads_pt[i] = nt;
+    hwloc_bitmap_free(set);
+    return;
+  }
+
+  if (ntasks >= nl3s) {
+    /* Every task within one L3 */
+    ntasks_per_l3 = arena_alloc(scratch, nl3s * sizeof(int));
+    num_tasks_per_numa(scratch, ntasks, nl3s, ncores, NULL, ntasks_per_l3);
+#if VERBOSE >= 1
+    print_array(ntasks_per_l3, nl3s, "ntasks_per_l3");
+#endif
+
+    task_offset = 0;
+    for (l=0; l<nl3s; l++) {
+      if (ntasks_per_l3[l] == 0)
+	continue;
+      nt = nthreads;
+      cpu_match(scratch, topo, l3s[l], ntasks_per_l3[l], &nt, usr_smt,
+		allowed, NULL, cpus+task_offset);
+      for (j=0; j<ntasks_per_l3[l]; j++)
+	nthreads_pt[task_offset+j] = nt;
+      task_offset += ntasks_per_l3[l];
+    }
+  } else {
+    /* Every task gets whole L3s. Given the number of
+       threads, fill up the cores of an L3 before the next */
+    nl3s_per_task = arena_alloc(scratch, ntasks * sizeof(int));
+    nthreads_per_l3 = arena_alloc(scratch, nl3s * sizeof(int));
+    distrib(nl3s, ntasks, nl3s_per_task);
+
+    for (i=0, l=0; i<ntasks; l+=nl3s_per_task[i], i++) {
+      hwloc_bitmap_zero(cpus[i]);
+      nthreads_pt[i] = 0;
+
+      if (nthreads > 0) {
+	rem = nthreads;
+	for (k=0; k<nl3s_per_task[i]; k++) {
+	  nthreads_per_l3[l+k] = (rem < ncores[l+k]) ? rem : ncores[l+k];
+	  rem -= nthreads_per_l3[l+k];
+	}
+	/* More threads than cores */
+	for (k=0; rem > 0; k=(k+1)%nl3s_per_task[i], rem--)
+	  nthreads_per_l3[l+k]++;
+      }
+
+      for (k=0; k<nl3s_per_task[i]; k++) {
+	if (nthreads > 0 && nthreads_per_l3[l+k] == 0)
+	  continue;
+	nt = nthreads_per_l3[l+k];
+	cpu_match(scratch, topo, l3s[l+k], 1, &nt, usr_smt, allowed, NULL,
+		  &set);
+	hwloc_bitmap_or(cpus[i], cpus[i], set);
+	nthreads_pt[i] += nt;
+      }
+    }
+  }
+
+  hwloc_bitmap_free(set);
 }
 
 /*
@@ -622,15 +962,17 @@ void num_gpus_per_numa(hwloc_topology_t topo,
  */
 static
 int distrib_mem_hierarchy(hwloc_topology_t topo,
-			  struct device **devs, int ndevs,
+			  struct topo_index *idx,
 			  int ntasks, int nthreads,
-			  int gpu_optim, int smt,
+			  int gpu_optim, int smt, int llc,
+			  hwloc_const_bitmap_t allowed,
+			  const int *weights,
 			  int *nthreads_pt,
 			  hwloc_bitmap_t *cpus_pt,
 			  hwloc_bitmap_t *gpus_pt)
 {
   int i, j, num_numas, nt, np, task_offset;
-  int *ntasks_per_numa;
+  int *ntasks_per_numa, *cus_allowed = NULL;
   hwloc_obj_t obj;
   hwloc_bitmap_t io_numa_os_ids = NULL;
 
@@ -638,20 +980,48 @@ int distrib_mem_hierarchy(hwloc_topology_t topo,
      Use the number of compute units within each NUMA
      to balance the tasks accordingly */
 #if 1
-  num_numas = hwloc_get_nbobjs_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE);
-  int *cus_per_numa = calloc(num_numas, sizeof(int));
-  ntasks_per_numa = calloc(num_numas, sizeof(int));
-
-  if (gpu_optim)
-    num_gpus_per_numa(topo, devs, ndevs, num_numas, cus_per_numa);
-  else
-    num_pus_per_numa(topo, num_numas, cus_per_numa);
+  num_numas = idx->nnumas;
+  ntasks_per_numa = arena_alloc(&idx->scratch, num_numas * sizeof(int));
+
+  /* The number of PUs and GPUs per NUMA are
+     calculated once per topology */
+  int *cus_per_numa = (gpu_optim) ? idx->numa_ngpus : idx->numa_npus;
+
+  /* Only count the allowed PUs, e.g., of a CPU kind.
+     A NUMA without allowed PUs gets no tasks */
+  if (allowed != NULL) {
+    int ngpus = 0;
+    hwloc_bitmap_t set = hwloc_bitmap_alloc();
+
+    cus_allowed = arena_alloc(&idx->scratch, num_numas * sizeof(int));
+    for (i=0; i<num_numas; i++) {
+      hwloc_bitmap_and(set, idx->numas[i]->cpuset, allowed);
+      cus_allowed[i] = hwloc_bitmap_weight(set);
+      if (cus_allowed[i] > 0)
+	ngpus += idx->numa_ngpus[i];
+    }
+    hwloc_bitmap_free(set);
+
+    /* Use the GPUs unless all of them are in
+       NUMAs without allowed PUs */
+    if (gpu_optim && ngpus > 0)
+      for (i=0; i<num_numas; i++)
+	if (cus_allowed[i] > 0)
+	  cus_allowed[i] = idx->numa_ngpus[i];
+    cus_per_numa = cus_allowed;
+  }
 #if VERBOSE >=1
   print_array(cus_per_numa, num_numas, "ncus_per_numa");
 #endif
 
-  num_tasks_per_numa(ntasks, num_numas, cus_per_numa, ntasks_per_numa);
-  free(cus_per_numa);
+  /* With weights, consecutive tasks fill up the NUMAs
+     based on the weight of each task */
+  if (weights != NULL)
+    group_weighted(ntasks, weights, num_numas, cus_per_numa,
+		   ntasks_per_numa);
+  else
+    num_tasks_per_numa(&idx->scratch, ntasks, num_numas, cus_per_numa,
+		       idx->numa_dist, ntasks_per_numa);
 #else
   /* Previous method was to distribute tasks over NUMAs evenly */
   if (gpu_optim) {
@@ -681,11 +1051,9 @@ int distrib_mem_hierarchy(hwloc_topology_t topo,
 #endif
 
   /* For each NUMA, get the CPUs and GPUs per task */
-  i = 0;
-  obj = NULL;
   task_offset = 0;
-  while ((obj=hwloc_get_next_obj_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE,
-					  obj)) != NULL) {
+  for (i=0; i<num_numas; i++) {
+    obj = idx->numas[i];
 #if 0
     /* Previous method */
     if (gpu_optim)
@@ -695,28 +1063,45 @@ int distrib_mem_hierarchy(hwloc_topology_t topo,
 
     /* Get the cpuset for each task assigned to this NUMA */
     nt = nthreads;
-    np = ntasks_per_numa[i++];
+    np = ntasks_per_numa[i];
 
     /* Some NUMA domains may have 0 tasks if there are more
        NUMAs than tasks */
     if (np == 0)
       continue;
 
-    cpu_match(topo, obj->parent, np, &nt, smt, cpus_pt+task_offset);
-
-    /* The calculated num threads is the same for all tasks in this NUMA,
-       it may be different for other NUMAs */
-    for (j=0; j<np; j++)
-      nthreads_pt[j+task_offset] = nt;
+    if (llc)
+      /* The num threads may be different for each L3 */
+      cpu_match_llc(&idx->scratch, topo, obj->parent, np, nthreads, smt,
+		    allowed, nthreads_pt+task_offset, cpus_pt+task_offset);
+    else if (weights != NULL) {
+      cpu_match(&idx->scratch, topo, obj->parent, np, &nt, smt, allowed,
+		weights+task_offset, cpus_pt+task_offset);
+
+      /* The calculated num threads is one per PU of each task */
+      for (j=0; j<np; j++) {
+	nt = hwloc_bitmap_weight(cpus_pt[j+task_offset]);
+	nthreads_pt[j+task_offset] =
+	  (nthreads > 0) ? nthreads : (nt > 0) ? nt : 1;
+      }
+    } else {
+      cpu_match(&idx->scratch, topo, obj->parent, np, &nt, smt, allowed,
+		NULL, cpus_pt+task_offset);
+
+      /* The calculated num threads is the same for all tasks in this NUMA,
+	 it may be different for other NUMAs */
+      for (j=0; j<np; j++)
+	nthreads_pt[j+task_offset] = nt;
+    }
 
     /* Get the gpuset for each task assigned to this NUMA */
-    gpu_match(topo, devs, ndevs, obj->parent, np, gpus_pt+task_offset);
+    gpu_match(&idx->scratch, idx->parent_gpus[i], np,
+	      (weights) ? weights+task_offset : NULL, gpus_pt+task_offset);
 
     task_offset+=np;
   }
 
   /* Clean up */
-  free(ntasks_per_numa);
   if (gpu_optim)
     hwloc_bitmap_free(io_numa_os_ids);
 
@@ -734,30 +1119,34 @@ int distrib_mem_hierarchy(hwloc_topology_t topo,
  * associated with a single NUMA domain.
  */
 static
-int distrib_greedy(hwloc_topology_t topo,
-                   struct device **devs, int ndevs,
-                   int ntasks, int nthreads, int *nthreads_pt,
+int distrib_greedy(struct topo_index *idx,
+                   int ntasks, int nthreads, hwloc_const_bitmap_t allowed,
+		   const int *weights, int *nthreads_pt,
 		   hwloc_bitmap_t *cpus_pt, hwloc_bitmap_t *gpus_pt)
 {
-  int i, task, num_numas;
-  int *numas_per_task;
+  int i, n, task, num_numas;
+  int *numas_per_task, *order;
+  char *usable = arena_alloc(&idx->scratch, idx->nnumas);
   hwloc_obj_t obj;
-  hwloc_bitmap_t gpus;
 
   for (i=0; i<ntasks; i++) {
     hwloc_bitmap_zero(cpus_pt[i]);
     hwloc_bitmap_zero(gpus_pt[i]);
   }
 
-  num_numas = hwloc_get_nbobjs_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE);
+  num_numas = usable_numas(idx, allowed, usable);
   if (num_numas <= 0) {
     fprintf(stderr, "Error: No viable NUMA domains\n");
     return 1;
   }
 
   /* I know that this case has less tasks than NUMAs */
-  numas_per_task = malloc(ntasks * sizeof(int));
-  distrib(num_numas, ntasks, numas_per_task);
+  numas_per_task = arena_alloc(&idx->scratch, ntasks * sizeof(int));
+  distrib_weighted(&idx->scratch, num_numas, ntasks, weights,
+		   numas_per_task);
+  /* Keep the NUMAs of a task close to each other */
+  order = arena_alloc(&idx->scratch, idx->nnumas * sizeof(int));
+  order_numas(idx, usable, ntasks, numas_per_task, order);
   /* Verbose */
 #if VERBOSE >=1
   print_array(numas_per_task, ntasks, "numas_per_task");
@@ -768,11 +1157,10 @@ int distrib_greedy(hwloc_topology_t topo,
 #endif
 
   i = 0;
-  obj = NULL;
   task = 0;
-  gpus = hwloc_bitmap_alloc();
-  while ((obj=hwloc_get_next_obj_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE,
-					  obj)) != NULL) {
+  for (n=0; n<num_numas; n++) {
+    obj = idx->numas[order[n]];
+
     /* Get the CPUs */
     hwloc_bitmap_or(cpus_pt[task], cpus_pt[task], obj->parent->cpuset);
 
@@ -780,15 +1168,14 @@ int distrib_greedy(hwloc_topology_t topo,
     /* The parent object to a NUMA domain may or may not have
        the GPUs. The GPUs, for example, may be associated with
        an L3 cache, which is one level down from the object that
-       contains the NUMA domain (Group). get_gpus() now looks
-       for the GPUs down the tree from the given root */
-    get_gpus(topo, devs, ndevs, obj->parent, gpus);
-    hwloc_bitmap_or(gpus_pt[task], gpus_pt[task], gpus);
+       contains the NUMA domain (Group). The topology index
+       looks for the GPUs down the tree from the parent */
+    hwloc_bitmap_or(gpus_pt[task], gpus_pt[task], idx->parent_gpus[order[n]]);
 
 #if VERBOSE >= 2
     hwloc_bitmap_list_snprintf(str1, sizeof(str1), obj->parent->cpuset);
-    hwloc_bitmap_list_snprintf(str2, sizeof(str2), gpus);
-    PRINT("task %d numa %d gpus %s cpus %s\n", task, i, str2, str1);
+    hwloc_bitmap_list_snprintf(str2, sizeof(str2), idx->parent_gpus[order[n]]);
+    PRINT("task %d numa %d gpus %s cpus %s\n", task, order[n], str2, str1);
     print_obj(obj->parent, 1);
 #endif
 
@@ -798,13 +1185,12 @@ int distrib_greedy(hwloc_topology_t topo,
     }
   }
 
-  for (i=0; i<ntasks; i++)
+  for (i=0; i<ntasks; i++) {
+    if (allowed != NULL)
+      hwloc_bitmap_and(cpus_pt[i], cpus_pt[i], allowed);
     nthreads_pt[i] =
       (nthreads > 0) ? nthreads : hwloc_bitmap_weight(cpus_pt[i]);
-
-  /* Clean up */
-  hwloc_bitmap_free(gpus);
-  free(numas_per_task);
+  }
 
   return 0;
 }
@@ -866,8 +1252,11 @@ void fill_in_device_info(hwloc_obj_t obj, struct device *dev)
     /* GPUVendor: AMD, NVIDIA
        Get a single word, e.g. 'NVIDIA' out of 'NVIDIA Corporation' */
     char vendor[SHORT_STR_SIZE];
-    sscanf(hwloc_obj_get_info_by_name(obj, "GPUVendor"), "%s", vendor);
-    snprintf(dev->vendor, SHORT_STR_SIZE, "%s", vendor);
+    /* hwloc 1.x topologies do not have GPUVendor */
+    if (hwloc_obj_get_info_by_name(obj, "GPUVendor")) {
+      sscanf(hwloc_obj_get_info_by_name(obj, "GPUVendor"), "%s", vendor);
+      snprintf(dev->vendor, SHORT_STR_SIZE, "%s", vendor);
+    }
     snprintf(dev->model, SHORT_STR_SIZE, "%s",
 	     hwloc_obj_get_info_by_name(obj, "GPUModel"));
     /* UUID: AMDUUID, NVIDIAUUID */
@@ -985,7 +1374,8 @@ int filter_gpu_types(hwloc_topology_t topo)
 
 /*
  * Input: An hwloc topology.
- * Output: An array of devices.
+ * Output: An array of devices (pdevs), which grows with the
+ * number of devices, and its size (the return value).
  *
  * For every unique I/O device, add an entry to the
  * output array with the device's IDs:
@@ -1027,10 +1417,10 @@ int filter_gpu_types(hwloc_topology_t topo)
  * bxi0   Network     ___             ___            BXI       BXIUUID (hwloc 3)
  * hsi0   Network     ___             ___            Slingshot Address
  */
-int discover_devices(hwloc_topology_t topo,
-		     struct device **devs, int size)
+int discover_devices(hwloc_topology_t topo, struct device ***pdevs)
 {
-  int index=0;
+  int index=0, size=0;
+  struct device **devs=NULL, **tmp;
   char busid[PCI_BUSID_LEN];
   hwloc_obj_osdev_type_t type;
   hwloc_obj_t pci_obj, obj=NULL;
@@ -1067,12 +1457,19 @@ int discover_devices(hwloc_topology_t topo,
 	continue;
 
       if (index >= size) {
-	fprintf(stderr, "Warn: I/O device array maxed out\n");
-	return index;
+	size = (size > 0) ? 2*size : 16;
+	if ((tmp = realloc(devs, size * sizeof(struct device *))) == NULL) {
+	  fprintf(stderr, "Warn: Couldn't grow the I/O device array\n");
+	  break;
+	}
+	devs = tmp;
       }
 
       /* Allocate and initialize the new device */
-      devs[index] = malloc(sizeof(struct device));
+      if ((devs[index] = malloc(sizeof(struct device))) == NULL) {
+	fprintf(stderr, "Warn: Couldn't allocate an I/O device\n");
+	break;
+      }
       devs[index]->univ[0] = '\0';
       devs[index]->vendor[0] = '\0';
       devs[index]->model[0] = '\0';
@@ -1102,6 +1499,7 @@ int discover_devices(hwloc_topology_t topo,
     }
   }
 
+  *pdevs = devs;
   return index;
 }
 
@@ -1143,20 +1541,115 @@ char* get_gpu_vendor(struct device **devs, int ndevs)
   return vendor;
 }
 
+int get_num_nics(struct device **devs, int ndevs)
+{
+  int i, count=0;
+
+  for (i=0; i<ndevs; i++)
+    if (devs[i]->type == DEV_NIC)
+      count++;
+
+  return count;
+}
+
 /*
- * The main mapping function.
+ * Assign NICs to tasks given their CPUs. A task can use the
+ * NICs local to its NUMA domains. The tasks that see the same
+ * local NICs share them like tasks of a NUMA domain share
+ * GPUs (gpu_match). Tasks on NUMA domains without local NICs
+ * use the NICs of the node.
+ * Input:
+ *   idx: The lookup tables of the topology.
+ *   devs, ndevs: The I/O devices.
+ *   ntasks, cpus_pt: The CPUs of each task.
+ * Output:
+ *   nics_pt: Element i is a bitmap of the NICs of task i.
  */
-int mpibind_distrib(hwloc_topology_t topo,
-		    struct device **devs, int ndevs,
-		    int ntasks, int nthreads,
-		    int greedy, int gpu_optim, int smt,
-		    int *nthreads_pt,
-		    hwloc_bitmap_t *cpus_pt,
-		    hwloc_bitmap_t *gpus_pt)
+void nic_match(struct topo_index *idx, struct device **devs, int ndevs,
+	       int ntasks, hwloc_bitmap_t *cpus_pt, hwloc_bitmap_t *nics_pt)
+{
+  int i, j, n, pu, numa, last;
+  hwloc_bitmap_t all, *local, *group;
+  char *done;
+
+  /* Tasks get no NICs if out of memory */
+  for (i=0; i<ntasks; i++)
+    hwloc_bitmap_zero(nics_pt[i]);
+  if (get_num_nics(devs, ndevs) == 0)
+    return;
+
+  all = hwloc_bitmap_alloc();
+  local = calloc(ntasks, sizeof(hwloc_bitmap_t));
+  group = malloc(ntasks * sizeof(hwloc_bitmap_t));
+  done = calloc(ntasks, sizeof(char));
+  if (all == NULL || local == NULL || group == NULL || done == NULL)
+    goto out;
+  for (i=0; i<ndevs; i++)
+    if (devs[i]->type == DEV_NIC)
+      hwloc_bitmap_set(all, i);
+
+  /* The NICs local to each task */
+  for (i=0; i<ntasks; i++) {
+    if ((local[i] = hwloc_bitmap_alloc()) == NULL)
+      goto out;
+    last = -1;
+    hwloc_bitmap_foreach_begin(pu, cpus_pt[i]) {
+      if (pu < idx->npus && (numa = idx->pu_numa[pu]) >= 0 && numa != last) {
+	hwloc_bitmap_or(local[i], local[i], idx->numa_nics[numa]);
+	last = numa;
+      }
+    } hwloc_bitmap_foreach_end();
+    if (hwloc_bitmap_iszero(local[i]))
+      hwloc_bitmap_copy(local[i], all);
+  }
+
+  /* Distribute the NICs of each group of tasks */
+  for (i=0; i<ntasks; i++) {
+    if (done[i])
+      continue;
+    n = 0;
+    for (j=i; j<ntasks; j++)
+      if (!done[j] && hwloc_bitmap_isequal(local[j], local[i])) {
+	group[n++] = nics_pt[j];
+	done[j] = 1;
+      }
+    gpu_match(&idx->scratch, local[i], n, NULL, group);
+  }
+
+#if VERBOSE >= 2
+  char str[LONG_STR_SIZE];
+  for (i=0; i<ntasks; i++) {
+    hwloc_bitmap_list_snprintf(str, sizeof(str), nics_pt[i]);
+    PRINT("task %d nics %s\n", i, str);
+  }
+#endif
+
+ out:
+  for (i=0; local != NULL && i<ntasks; i++)
+    hwloc_bitmap_free(local[i]);
+  free(local);
+  free(group);
+  free(done);
+  hwloc_bitmap_free(all);
+}
+
+/*
+ * Map the tasks to the PUs in 'allowed' (all if NULL).
+ */
+static
+int distrib_tasks(hwloc_topology_t topo,
+		  struct topo_index *idx,
+		  int ntasks, int nthreads,
+		  int greedy, int gpu_optim, int smt, int llc,
+		  hwloc_const_bitmap_t allowed, const int *weights,
+		  int *nthreads_pt,
+		  hwloc_bitmap_t *cpus_pt,
+		  hwloc_bitmap_t *gpus_pt)
 {
   int rc, num_numas;
+  char *usable = arena_alloc(&idx->scratch, idx->nnumas);
 
-  num_numas = hwloc_get_nbobjs_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE);
+  num_numas = usable_numas(idx, allowed, usable);
   //printf("num_numas=%d\n", num_numas);
 
 #if 0
@@ -1168,17 +1661,233 @@ int mpibind_distrib(hwloc_topology_t topo,
 #endif
 
   if (greedy && ntasks < num_numas)
-    rc = distrib_greedy(topo, devs, ndevs,
-			ntasks, nthreads,
+    rc = distrib_greedy(idx, ntasks, nthreads, allowed, weights,
 			nthreads_pt, cpus_pt, gpus_pt);
   else
-    rc = distrib_mem_hierarchy(topo, devs, ndevs,
-			       ntasks, nthreads, gpu_optim, smt,
-			       nthreads_pt, cpus_pt, gpus_pt);
+    rc = distrib_mem_hierarchy(topo, idx,
+			       ntasks, nthreads, gpu_optim, smt, llc, allowed,
+			       weights, nthreads_pt, cpus_pt, gpus_pt);
+
+  return rc;
+}
+
+/*
+ * Give the leader task a core, an L3 cache, or a NUMA domain
+ * of its own (domain is MPIBIND_LEADER_*) close to a NIC,
+ * and map the other tasks to the rest of the node.
+ * The leader gets the GPUs of its domain only if the domain
+ * is a NUMA domain.
+ */
+static
+int distrib_leader(hwloc_topology_t topo,
+		   struct topo_index *idx,
+		   int ntasks, int nthreads,
+		   int greedy, int gpu_optim, int smt, int llc,
+		   hwloc_const_bitmap_t allowed, const int *weights,
+		   int leader, int domain,
+		   int *nthreads_pt,
+		   hwloc_bitmap_t *cpus_pt,
+		   hwloc_bitmap_t *gpus_pt)
+{
+  int i, j, n, nt, rc, *rest_nthreads, *rest_weights = NULL;
+  char *usable = arena_alloc(&idx->scratch, idx->nnumas);
+  hwloc_obj_t obj = NULL, l3;
+  hwloc_bitmap_t rest, *rest_cpus, *rest_gpus;
+
+  /* The first NUMA domain with a NIC or else the first one */
+  if (usable_numas(idx, allowed, usable) == 0) {
+    fprintf(stderr, "Error: No viable NUMA domains\n");
+    return 1;
+  }
+  for (n=0; n<idx->nnumas; n++)
+    if (usable[n] && !hwloc_bitmap_iszero(idx->numa_nics[n]))
+      break;
+  if (n == idx->nnumas)
+    for (n=0; !usable[n]; n++)
+      ;
+
+  /* Its first core */
+  while ((obj = hwloc_get_next_obj_inside_cpuset_by_depth(topo,
+			idx->numas[n]->cpuset,
+			mpibind_get_core_depth(topo), obj)) != NULL)
+    if (allowed == NULL || hwloc_bitmap_intersects(obj->cpuset, allowed))
+      break;
+  if (obj == NULL) {
+    fprintf(stderr, "Error: No cores for the leader task\n");
+    return 1;
+  }
+
+  if (domain == MPIBIND_LEADER_NUMA)
+    obj = idx->numas[n]->parent;
+  else if (domain == MPIBIND_LEADER_L3 &&
+	   (l3 = hwloc_get_ancestor_obj_by_type(topo, HWLOC_OBJ_L3CACHE,
+						obj)) != NULL)
+    obj = l3;
+
+  nt = nthreads;
+  cpu_match(&idx->scratch, topo, obj, 1, &nt, smt, allowed, NULL,
+	    &cpus_pt[leader]);
+  nthreads_pt[leader] = nt;
+  hwloc_bitmap_zero(gpus_pt[leader]);
+  if (domain == MPIBIND_LEADER_NUMA)
+    hwloc_bitmap_copy(gpus_pt[leader], idx->parent_gpus[n]);
+
+  /* The other tasks do not use the domain of the leader */
+  rest = hwloc_bitmap_dup((allowed) ? allowed :
+			  hwloc_get_root_obj(topo)->cpuset);
+  hwloc_bitmap_andnot(rest, rest, obj->cpuset);
+  if (hwloc_bitmap_iszero(rest)) {
+    fprintf(stderr, "Error: No resources left after the leader task\n");
+    hwloc_bitmap_free(rest);
+    return 1;
+  }
+
+  rest_nthreads = arena_alloc(&idx->scratch, (ntasks-1) * sizeof(int));
+  rest_cpus = arena_alloc(&idx->scratch,
+			  (ntasks-1) * sizeof(hwloc_bitmap_t));
+  rest_gpus = arena_alloc(&idx->scratch,
+			  (ntasks-1) * sizeof(hwloc_bitmap_t));
+  if (weights != NULL)
+    rest_weights = arena_alloc(&idx->scratch, (ntasks-1) * sizeof(int));
+  for (i=0, j=0; i<ntasks; i++)
+    if (i != leader) {
+      rest_cpus[j] = cpus_pt[i];
+      rest_gpus[j] = gpus_pt[i];
+      if (weights != NULL)
+	rest_weights[j] = weights[i];
+      j++;
+    }
+
+  rc = distrib_tasks(topo, idx, ntasks-1, nthreads, greedy, gpu_optim,
+		     smt, llc, rest, rest_weights,
+		     rest_nthreads, rest_cpus, rest_gpus);
+
+  for (i=0, j=0; i<ntasks; i++)
+    if (i != leader)
+      nthreads_pt[i] = rest_nthreads[j++];
+
+  hwloc_bitmap_free(rest);
 
   return rc;
 }
 
+/*
+ * The main mapping function.
+ * Temporary arrays come from the scratch arena of the
+ * topology index, which is reset on every call.
+ */
+int mpibind_distrib(hwloc_topology_t topo,
+		    struct topo_index *idx,
+		    int ntasks, int nthreads,
+		    int greedy, int gpu_optim, int smt, int llc,
+		    int cpukinds, const int *weights,
+		    int leader, int leader_domain,
+		    int *nthreads_pt,
+		    hwloc_bitmap_t *cpus_pt,
+		    hwloc_bitmap_t *gpus_pt)
+{
+  /* Tasks use the most efficient kind of cores only */
+  hwloc_const_bitmap_t allowed = (cpukinds) ? idx->kind_cpus : NULL;
+
+  arena_reset(&idx->scratch);
+
+  if (leader >= 0 && leader < ntasks && ntasks > 1)
+    return distrib_leader(topo, idx, ntasks, nthreads, greedy, gpu_optim,
+			  smt, llc, allowed, weights, leader, leader_domain,
+			  nthreads_pt, cpus_pt, gpus_pt);
+
+  return distrib_tasks(topo, idx, ntasks, nthreads, greedy, gpu_optim,
+		       smt, llc, allowed, weights,
+		       nthreads_pt, cpus_pt, gpus_pt);
+}
+
+/*
+ * Place the threads of a task on the task's PUs: Threads
+ * go to different cores first and then to the hardware
+ * threads (SMT) of each core, as cpu_match does for tasks.
+ * With fewer threads than cores, each thread gets whole cores.
+ * Input:
+ *   topo, idx: The topology and its lookup tables (optional).
+ *   cpus: The PUs of the task.
+ *   nthreads: The number of threads of the task.
+ * Output:
+ *   threads: Element i is the PU set of thread i.
+ */
+void thread_match(hwloc_topology_t topo, struct topo_index *idx,
+		  hwloc_const_bitmap_t cpus, int nthreads,
+		  hwloc_bitmap_t *threads)
+{
+  int i, j, k, c, ncores, depth;
+  hwloc_obj_t obj = NULL;
+  hwloc_bitmap_t *cores, set;
+  struct arena scratch;
+
+  for (i=0; i<nthreads; i++)
+    hwloc_bitmap_zero(threads[i]);
+  if (nthreads <= 0 || hwloc_bitmap_iszero(cpus))
+    return;
+
+  arena_init(&scratch);
+
+  /* The PUs of the task in each of its cores, in core order.
+     Without core information, each PU is a core */
+  ncores = 0;
+  cores = arena_alloc(&scratch,
+		      hwloc_bitmap_weight(cpus) * sizeof(hwloc_bitmap_t));
+  set = hwloc_bitmap_alloc();
+  if (idx != NULL) {
+    for (c=0; c<idx->ncores; c++) {
+      hwloc_bitmap_and(set, idx->core_pus[c], cpus);
+      if (!hwloc_bitmap_iszero(set))
+	cores[ncores++] = hwloc_bitmap_dup(set);
+    }
+  } else if (topo != NULL) {
+    /* There is no index for imported mappings */
+    depth = mpibind_get_core_depth(topo);
+    while ((obj = hwloc_get_next_obj_by_depth(topo, depth, obj))) {
+      hwloc_bitmap_and(set, obj->cpuset, cpus);
+      if (!hwloc_bitmap_iszero(set))
+	cores[ncores++] = hwloc_bitmap_dup(set);
+    }
+  }
+  if (ncores == 0)
+    hwloc_bitmap_foreach_begin(i, cpus) {
+      cores[ncores] = hwloc_bitmap_alloc();
+      hwloc_bitmap_only(cores[ncores++], i);
+    } hwloc_bitmap_foreach_end();
+  hwloc_bitmap_free(set);
+
+  if (nthreads <= ncores) {
+    /* Each thread gets one or more cores */
+    int *ncores_per_thread = arena_alloc(&scratch, nthreads * sizeof(int));
+    distrib(ncores, nthreads, ncores_per_thread);
+    for (i=0, j=0; i<nthreads; i++)
+      for (k=0; k<ncores_per_thread[i]; k++)
+	hwloc_bitmap_or(threads[i], threads[i], cores[j++]);
+  } else {
+    /* Threads share cores: Spread them over each core's PUs */
+    int *nthreads_per_core = arena_alloc(&scratch, ncores * sizeof(int));
+    distrib(nthreads, ncores, nthreads_per_core);
+    for (c=0, j=0; c<ncores; c++) {
+      fill_in_buckets_bitmap(&scratch, cores[c], threads+j,
+			     nthreads_per_core[c], NULL);
+      j += nthreads_per_core[c];
+    }
+  }
+
+#if VERBOSE >= 2
+  char str[LONG_STR_SIZE];
+  for (i=0; i<nthreads; i++) {
+    hwloc_bitmap_list_snprintf(str, sizeof(str), threads[i]);
+    PRINT("thread[%d]: %s\n", i, str);
+  }
+#endif
+
+  for (c=0; c<ncores; c++)
+    hwloc_bitmap_free(cores[c]);
+  arena_release(&scratch);
+}
+
 /*
  * Get a string associated with the specified
  * ID type for a given device.
@@ -1202,47 +1911,277 @@ int device_key_snprint(char *buf, size_t size,
 
 /*
  * Given a PU id, provide the PU set of the core
- * that contains that PU.
+ * that contains that PU. Without an index (imported
+ * mappings), look the core up in the topology.
+ * Returns NULL if the core is not known.
+ */
+hwloc_const_bitmap_t get_core_cpuset(hwloc_topology_t topo,
+				     struct topo_index *idx, int pu)
+{
+  hwloc_obj_t obj;
+
+  if (pu < 0)
+    return NULL;
+
+  if (idx != NULL) {
+    if (pu >= idx->npus || idx->pu_core[pu] < 0)
+      return NULL;
+    return idx->core_pus[idx->pu_core[pu]];
+  }
+
+  if (topo == NULL ||
+      (obj = hwloc_get_pu_obj_by_os_index(topo, pu)) == NULL)
+    return NULL;
+  obj = hwloc_get_ancestor_obj_by_depth(topo,
+					mpibind_get_core_depth(topo), obj);
+
+  return (obj != NULL) ? obj->cpuset : NULL;
+}
+
+/*
+ * Get the cores reserved for the OS and system daemons:
+ * 'ncores' of each domain (MPIBIND_RESERVE_*), the last or
+ * the first ones depending on 'from_end'.
+ * Return 0 on success, 1 if a domain would have no cores left.
  */
-const hwloc_bitmap_t get_core_cpuset(hwloc_topology_t topo, int pu)
+int reserve_cores(hwloc_topology_t topo, int ncores, int domain,
+		  int from_end, hwloc_bitmap_t reserved)
 {
-  int i, core_depth, ncores;
-  hwloc_obj_t core;
+  int i, j, ndoms, ndcores, core_depth;
+  hwloc_obj_t dom, core;
+  hwloc_obj_type_t type;
+
+  hwloc_bitmap_zero(reserved);
+  if (ncores <= 0)
+    return 0;
+
+  type = (domain == MPIBIND_RESERVE_PACKAGE) ? HWLOC_OBJ_PACKAGE :
+    (domain == MPIBIND_RESERVE_NUMA) ? HWLOC_OBJ_NUMANODE :
+    HWLOC_OBJ_MACHINE;
+  /* A flattened topology may not have packages */
+  ndoms = hwloc_get_nbobjs_by_type(topo, type);
+  if (ndoms <= 0) {
+    type = HWLOC_OBJ_MACHINE;
+    ndoms = 1;
+  }
 
   core_depth = mpibind_get_core_depth(topo);
-  ncores = hwloc_get_nbobjs_by_depth(topo, core_depth);
+  for (i=0; i<ndoms; i++) {
+    dom = hwloc_get_obj_by_type(topo, type, i);
+    ndcores = hwloc_get_nbobjs_inside_cpuset_by_depth(topo, dom->cpuset,
+						      core_depth);
+    if (ndcores <= ncores) {
+      fprintf(stderr, "Error: Cannot reserve %d of %d cores of %s %d\n",
+	      ncores, ndcores, hwloc_obj_type_string(type), i);
+      return 1;
+    }
 
-  for (i=0; i<ncores; i++) {
-    core = hwloc_get_obj_by_depth(topo, core_depth, i);
-    if ( hwloc_bitmap_isset(core->cpuset, pu) )
-      return core->cpuset;
+    for (j=0; j<ncores; j++) {
+      core = hwloc_get_obj_inside_cpuset_by_depth(topo, dom->cpuset,
+						  core_depth,
+						  (from_end) ? ndcores-1-j : j);
+      hwloc_bitmap_or(reserved, reserved, core->cpuset);
+    }
   }
 
-  return NULL;
+  return 0;
 }
 
 /*
- * Input:
- *   buf: A set of lines. The last line was partially written.
- *   size: The number of chars in the buffer
- *
- * Either
- *   Remove the partial line or
- *   Overwrite it with [...] if there's space
+ * Get the latency matrix of the NUMA domains, e.g., the
+ * ACPI SLIT, in the order of numas. Returns NULL if the
+ * topology has no latencies for all of these domains.
  */
-void terminate_str(char *buf, int size)
+static
+hwloc_uint64_t* numa_distances(hwloc_topology_t topo,
+			       hwloc_obj_t *numas, int nnumas)
 {
-  /* Look for the beginning of the last line */
-  int ch = '\n';
-  char *ptr = strrchr(buf, ch) + 1;
-  int nchars = buf+size - ptr;
-#if DEBUG >=1
-  fprintf(OUT_STREAM, "terminate_str: nchars=%d last='%s'\n", nchars, ptr);
-#endif
-  if (nchars > 6)
-    snprintf(ptr, nchars, "[...]\n");
-  else
-    ptr[0] = '\0';
+  int i, j, from, to;
+  unsigned nr = 1;
+  struct hwloc_distances_s *dist;
+  hwloc_uint64_t *values = NULL;
+
+  if (nnumas < 2 ||
+      hwloc_distances_get_by_type(topo, HWLOC_OBJ_NUMANODE, &nr, &dist,
+				  HWLOC_DISTANCES_KIND_MEANS_LATENCY, 0) < 0 ||
+      nr == 0)
+    return NULL;
+
+  values = malloc(nnumas * nnumas * sizeof(hwloc_uint64_t));
+  for (i=0; i<nnumas && values; i++) {
+    from = hwloc_distances_obj_index(dist, numas[i]);
+    for (j=0; j<nnumas; j++) {
+      to = hwloc_distances_obj_index(dist, numas[j]);
+      if (from < 0 || to < 0) {
+	free(values);
+	values = NULL;
+	break;
+      }
+      values[i*nnumas + j] = dist->values[from*dist->nbobjs + to];
+    }
+  }
+
+  hwloc_distances_release(topo, dist);
+
+  return values;
+}
+
+/*
+ * Get the PUs of the most efficient (powerful) kind of cores
+ * of a hybrid CPU, e.g., P-cores. Returns NULL if there is a
+ * single kind or the kinds cannot be ranked.
+ */
+static
+hwloc_bitmap_t best_cpukind(hwloc_topology_t topo)
+{
+  int i, nr, eff, best = -1, best_eff = -1;
+  hwloc_bitmap_t set;
+
+  nr = hwloc_cpukinds_get_nr(topo, 0);
+  if (nr < 2)
+    return NULL;
+
+  set = hwloc_bitmap_alloc();
+  for (i=0; i<nr; i++)
+    if (hwloc_cpukinds_get_info(topo, i, set, &eff, NULL, NULL, 0) == 0 &&
+	eff > best_eff) {
+      best = i;
+      best_eff = eff;
+    }
+
+  if (best < 0) {
+    hwloc_bitmap_free(set);
+    return NULL;
+  }
+
+  hwloc_cpukinds_get_info(topo, best, set, NULL, NULL, NULL, 0);
+  hwloc_bitmap_and(set, set, hwloc_get_root_obj(topo)->cpuset);
+
+  return set;
+}
+
+/*
+ * Build the lookup tables of a loaded topology.
+ * The I/O devices must have been discovered already.
+ * The index is valid as long as the topology is not
+ * modified, e.g., restricted.
+ */
+struct topo_index* topo_index_build(hwloc_topology_t topo,
+				    struct device **devs, int ndevs)
+{
+  int i, j, pu, core_depth;
+  hwloc_obj_t obj;
+  struct topo_index *idx = calloc(1, sizeof(struct topo_index));
+
+  arena_init(&idx->scratch);
+
+  /* PU arrays are indexed by OS index */
+  idx->npus = hwloc_bitmap_last(hwloc_get_root_obj(topo)->cpuset) + 1;
+  if (idx->npus < 0)
+    idx->npus = 0;
+  idx->pu_core = malloc(idx->npus * sizeof(int));
+  idx->pu_numa = malloc(idx->npus * sizeof(int));
+  for (i=0; i<idx->npus; i++)
+    idx->pu_core[i] = idx->pu_numa[i] = -1;
+
+  core_depth = mpibind_get_core_depth(topo);
+  idx->ncores = hwloc_get_nbobjs_by_depth(topo, core_depth);
+  idx->core_pus = calloc(idx->ncores, sizeof(hwloc_const_bitmap_t));
+  for (i=0; i<idx->ncores; i++) {
+    obj = hwloc_get_obj_by_depth(topo, core_depth, i);
+    idx->core_pus[i] = obj->cpuset;
+  }
+  /* Walk the PUs rather than the cpuset of every core,
+     which costs as many words as the node has PUs */
+  obj = NULL;
+  while ((obj = hwloc_get_next_obj_by_type(topo, HWLOC_OBJ_PU,
+					   obj)) != NULL) {
+    hwloc_obj_t core = hwloc_get_ancestor_obj_by_depth(topo,
+						       core_depth, obj);
+    pu = obj->os_index;
+    if (core != NULL && pu < idx->npus)
+      idx->pu_core[pu] = core->logical_index;
+  }
+
+  idx->nnumas = hwloc_get_nbobjs_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE);
+  idx->numas = calloc(idx->nnumas, sizeof(hwloc_obj_t));
+  idx->numa_npus = calloc(idx->nnumas, sizeof(int));
+  idx->numa_ngpus = calloc(idx->nnumas, sizeof(int));
+  idx->numa_gpus = calloc(idx->nnumas, sizeof(hwloc_bitmap_t));
+  idx->numa_nics = calloc(idx->nnumas, sizeof(hwloc_bitmap_t));
+  idx->parent_gpus = calloc(idx->nnumas, sizeof(hwloc_bitmap_t));
+  for (i=0; i<idx->nnumas; i++) {
+    obj = hwloc_get_obj_by_depth(topo, HWLOC_TYPE_DEPTH_NUMANODE, i);
+    idx->numas[i] = obj;
+    idx->numa_gpus[i] = hwloc_bitmap_alloc();
+    idx->numa_nics[i] = hwloc_bitmap_alloc();
+    idx->parent_gpus[i] = hwloc_bitmap_alloc();
+
+    /* If NUMA domains share PUs, keep the first one */
+    hwloc_bitmap_foreach_begin(pu, obj->cpuset) {
+      if (pu < idx->npus && idx->pu_numa[pu] < 0)
+	idx->pu_numa[pu] = i;
+    } hwloc_bitmap_foreach_end();
+
+    /* A device is local to the NUMA domains of its ancestor.
+       GPUs are assigned from the parent of a NUMA domain, which
+       may hold GPUs associated with an object below it */
+    for (j=0; j<ndevs; j++) {
+      if (hwloc_bitmap_isset(devs[j]->ancestor->nodeset, obj->os_index)) {
+	if (devs[j]->type == DEV_GPU)
+	  hwloc_bitmap_set(idx->numa_gpus[i], j);
+	else if (devs[j]->type == DEV_NIC)
+	  hwloc_bitmap_set(idx->numa_nics[i], j);
+      }
+      if (devs[j]->type == DEV_GPU &&
+	  hwloc_obj_is_in_subtree(topo, devs[j]->ancestor, obj->parent))
+	hwloc_bitmap_set(idx->parent_gpus[i], j);
+    }
+
+    /* Weights used to distribute tasks over NUMA domains */
+    idx->numa_npus[i] = hwloc_bitmap_weight(obj->cpuset);
+    idx->numa_ngpus[i] = hwloc_bitmap_weight(idx->numa_gpus[i]);
+  }
+
+  idx->numa_dist = numa_distances(topo, idx->numas, idx->nnumas);
+
+  /* Hybrid CPUs: The most efficient kind and the others */
+  idx->kind_cpus = best_cpukind(topo);
+  if (idx->kind_cpus != NULL) {
+    idx->helper_cpus = hwloc_bitmap_alloc();
+    hwloc_bitmap_andnot(idx->helper_cpus, hwloc_get_root_obj(topo)->cpuset,
+			idx->kind_cpus);
+  }
+
+  return idx;
+}
+
+void topo_index_free(struct topo_index *idx)
+{
+  int i;
+
+  if (idx == NULL)
+    return;
+
+  for (i=0; i<idx->nnumas; i++) {
+    hwloc_bitmap_free(idx->numa_gpus[i]);
+    hwloc_bitmap_free(idx->numa_nics[i]);
+    hwloc_bitmap_free(idx->parent_gpus[i]);
+  }
+  free(idx->numa_gpus);
+  free(idx->numa_nics);
+  free(idx->parent_gpus);
+  free(idx->numa_dist);
+  hwloc_bitmap_free(idx->kind_cpus);
+  hwloc_bitmap_free(idx->helper_cpus);
+  free(idx->numas);
+  free(idx->numa_npus);
+  free(idx->numa_ngpus);
+  free(idx->core_pus);
+  free(idx->pu_numa);
+  free(idx->pu_core);
+  arena_release(&idx->scratch);
+  free(idx);
 }
 
 /*
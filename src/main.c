@@ -2,6 +2,8 @@
  * Edgar A. Leon
  * Lawrence Livermore National Laboratory
  */
+#include <string.h>
+#include <time.h>
 #include "mpibind.h"
 
 /*
@@ -75,16 +77,99 @@ void howto_env_vars(mpibind_t *handle)
 #endif
 }
 
+/*
+ * Show where each thread of a task should run, e.g.,
+ * to pin pthreads without OpenMP places.
+ */
+void howto_threads(mpibind_t *handle, int taskid)
+{
+  int i, j, nthreads, *ncpus;
+  int **cpus = mpibind_get_threads_ptask(handle, taskid,
+					 &nthreads, &ncpus);
+
+  if (cpus == NULL)
+    return;
+
+  printf("Threads of task %d:\n", taskid);
+  for (i=0; i<nthreads; i++) {
+    printf("\t[%d]: ", i);
+    for (j=0; j<ncpus[i]; j++)
+      printf( (j == ncpus[i]-1) ? "%d\n" : "%d,", cpus[i][j]);
+  }
+}
+
+/*
+ * Compute the mappings for 1 to ncores tasks and
+ * every SMT level of the node in a single call.
+ */
+int howto_sweep(mpibind_t *handle)
+{
+  int i, p, t, ncores, hw_smt;
+  int smt[16];
+  double usecs;
+  struct timespec start, end;
+  hwloc_topology_t topo;
+  mpibind_sweep_t *sw;
+
+  hwloc_topology_init(&topo);
+  mpibind_load_topology(topo);
+  mpibind_set_topology(handle, topo);
+
+  ncores = hwloc_get_nbobjs_by_depth(topo,
+				     mpibind_get_core_depth(topo));
+  hw_smt = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_PU) / ncores;
+  if (hw_smt >= sizeof(smt)/sizeof(int))
+    hw_smt = sizeof(smt)/sizeof(int) - 1;
+  /* SMT 0 lets mpibind choose */
+  for (i=0; i<=hw_smt; i++)
+    smt[i] = i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  sw = mpibind_sweep(handle, 1, ncores, smt, hw_smt+1);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (sw == NULL)
+    return 1;
+
+  for (p=0; p<sw->npoints; p++) {
+    printf("ntasks %d smt %d:", sw->ntasks[p], sw->smt[p]);
+    if (sw->rc[p] != 0) {
+      printf(" failed\n");
+      continue;
+    }
+    for (t=sw->offset[p]; t<sw->offset[p]+sw->ntasks[p]; t++)
+      printf(" %d/%d/%d", sw->nthreads[t],
+	     sw->cpu_start[t+1] - sw->cpu_start[t],
+	     sw->gpu_start[t+1] - sw->gpu_start[t]);
+    printf("\n");
+  }
+
+  usecs = (end.tv_sec - start.tv_sec) * 1e6 +
+    (end.tv_nsec - start.tv_nsec) / 1e3;
+  printf("Swept %d mappings (%zu tasks) in %.1f us\n",
+	 sw->npoints, sw->ntotal, usecs);
+
+  mpibind_sweep_free(sw);
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
+  mpibind_t *handle;
+  mpibind_init(&handle);
+
+  /* Sweep mode: all the task counts at once.
+     Output per task: nthreads/ncpus/ngpus */
+  if (argc > 1 && strcmp(argv[1], "sweep") == 0)
+    return howto_sweep(handle);
+
   /* Optional program input: number of tasks */
   int ntasks = 5;
   if (argc > 1)
     ntasks = atoi(argv[1]);
 
-  mpibind_t *handle;
-  mpibind_init(&handle);
-
   /* User input */
   mpibind_set_ntasks(handle, ntasks);
   //mpibind_set_nthreads(handle, 3);
@@ -154,6 +239,11 @@ int main(int argc, char *argv[])
   mpibind_set_gpu_ids(handle, MPIBIND_ID_SMI);
   mpibind_mapping_print(handle);
 
+  /* Quality of the mapping */
+  char metrics[512];
+  if (mpibind_metrics_snprint(metrics, sizeof(metrics), handle) > 0)
+    printf("%s\n", metrics);
+
   /* Test popping CPUs/cores */
   //mpibind_pop_cpus_ptask(handle, 2, 4);
   //mpibind_pop_cores_ptask(handle, 1, 3);
@@ -168,6 +258,9 @@ int main(int argc, char *argv[])
   /* Example using affinity environment variables */
   howto_env_vars(handle);
 
+  /* Example placing the threads of a task */
+  howto_threads(handle, 0);
+
   /* Clean up */
   mpibind_finalize(handle);
 
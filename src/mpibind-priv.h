@@ -6,14 +6,15 @@
 #define MPIBIND_PRIV_H_INCLUDED
 
 #include <hwloc.h>
+#include <time.h>
+#include <pthread.h>
+#include "mpibind.h"
 
 #define SHORT_STR_SIZE 32
 #define LONG_STR_SIZE 1024
 
 #define PCI_BUSID_LEN 16
 #define UUID_LEN 64
-#define MAX_IO_DEVICES 128
-#define MAX_CPUS_PER_TASK 1024
 
 #define VERBOSE 0
 #define DEBUG 0
@@ -33,23 +34,49 @@ const char usage_str[] = "\n"
   "Usage: mpibind=[args]\n"
   "\n"
   "where args is a comma separated list of one or more of the following:\n"
+  "  auto[:0|1]        Choose the best of several candidate mappings(1)\n"
+  "  cpukinds[:0|1]    Map tasks to the most efficient cores only(1)\n"
   "  gpu[:0|1]         Enable(1)/disable(0) GPU-optimized mappings\n"
   "  greedy[:0|1]      Allow(1)/disallow(0) multiple NUMAs per task\n"
   "  h[elp]            Display this message\n"
+  "  leader[:<task>][:core|l3|numa]\n"
+  "                    Give task (default 0) its own core (default),\n"
+  "                    L3 cache, or NUMA domain close to a NIC\n"
+  "  llc[:0|1]         Keep(1) each task within an L3 cache if possible\n"
+  "  membind[:<pol>]   Bind memory to the tasks' NUMA domains, where\n"
+  "                    pol is bind (default), interleave, or preferred\n"
+  "  nics              Do not set UCX_NET_DEVICES/FI_CXI_DEVICE_NAME\n"
   "  off               Disable mpibind\n"
   "  on                Enable mpibind\n"
   "  omp_places        Do not set OMP_PLACES\n"
   "  omp_proc_bind     Do not set OMP_PROC_BIND\n"
+  "  reserve:<n>[:<dom>][:first|last]\n"
+  "                    Reserve n cores per dom for the OS, where dom is\n"
+  "                    node (default), package, or numa\n"
   "  smt:<k>           Allow using k hardware threads per core\n"
   "  v[erbose]         Print affinty for each task\n"
   "  visdevs           Do not set VISIBLE_DEVICES\n"
   "\n";
 
+/*
+ * Monotonic clock, in nanoseconds, for the phase timers.
+ * Cheap enough (vDSO) to leave on at all times.
+ */
+static inline
+uint64_t timer_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 /*
  * An environment variable with one value per task
  */
 typedef struct {
   int size;
+  int key;              // Index in the list of mpibind variables
   char *name;
   char **values;
 } mpibind_env_var;
@@ -81,6 +108,54 @@ struct device {
   char model[SHORT_STR_SIZE];  // Model of GPU/COPROC devices
 };
 
+/*
+ * Memory for the outputs of a handle and the temporary
+ * arrays of the mapping functions (see arena.c)
+ */
+struct arena {
+  struct arena_chunk *head;     // Chunks in allocation order
+  struct arena_chunk *curr;     // Chunk to allocate from
+  int nallocs;                  // Number of allocations served
+  int nchunks;                  // Number of chunks (system allocations)
+  size_t reserved;              // Bytes obtained from the system
+};
+
+/*
+ * Lookup tables of a loaded (and restricted) topology.
+ * Built once per handle so that the mapping functions do not
+ * walk the topology tree repeatedly.
+ * PUs are identified by their OS index, cores and NUMA domains
+ * by their logical index, and I/O devices by their mpibind ID.
+ */
+struct topo_index {
+  int npus;                       // Size of PU arrays (max PU + 1)
+  int ncores;                     // Number of cores
+  int nnumas;                     // Number of NUMA domains
+  int *pu_core;                   // PU -> core (-1 if none)
+  int *pu_numa;                   // PU -> NUMA domain (-1 if none)
+  hwloc_const_bitmap_t *core_pus; // Core -> PUs
+  hwloc_obj_t *numas;             // NUMA domain -> object
+  int *numa_npus;                 // NUMA domain -> number of PUs
+  int *numa_ngpus;                // NUMA domain -> number of local GPUs
+  hwloc_bitmap_t *numa_gpus;      // NUMA domain -> local GPUs
+  hwloc_bitmap_t *numa_nics;      // NUMA domain -> local NICs
+  hwloc_bitmap_t *parent_gpus;    // NUMA domain -> GPUs under its parent
+  hwloc_uint64_t *numa_dist;      // NUMA x NUMA -> latency (NULL if none)
+  hwloc_bitmap_t kind_cpus;       // PUs of the most efficient CPU kind
+                                  // (NULL if not a hybrid CPU)
+  hwloc_bitmap_t helper_cpus;     // PUs of the other CPU kinds
+  struct arena scratch;           // Temporary arrays of a mapping
+                                  // (reset by mpibind_distrib)
+};
+
+/*
+ * The key of a cached mapping (see cache.c): two 64-bit
+ * hashes of the topology, the devices, and the inputs.
+ */
+struct map_key {
+  uint64_t hash[2];
+};
+
 /*
  * The mpibind handle
  */
@@ -91,8 +166,24 @@ struct mpibind_t {
   int greedy;
   int gpu_optim;
   int smt;
+  int llc;
+  int cpukinds;
+  int auto_map;
+  int nweights;
+  int *weights;
+  int leader;
+  int leader_domain;
+  int nprev;
+  hwloc_bitmap_t *prev_cpus;
+  hwloc_bitmap_t *prev_gpus;
   char *restr_set;
   int restr_type;
+  int map_cache;
+  const char *map_cache_file;
+  int membind;
+  int resv_ncores;
+  int resv_domain;
+  int resv_end;
 
   /* Input/Output parameters */
   hwloc_topology_t topo;
@@ -101,8 +192,12 @@ struct mpibind_t {
   int *nthreads;
   hwloc_bitmap_t *cpus;
   hwloc_bitmap_t *gpus;
+  hwloc_bitmap_t *mems;
+  hwloc_bitmap_t *nics;
   char ***gpus_usr;
+  char ***nics_usr;
   int **cpus_usr;
+  int *moved;
 
   /* Environment variables */
   int nvars;
@@ -112,6 +207,39 @@ struct mpibind_t {
   /* IDs of I/O devices */
   int ndevs;
   struct device **devs;
+
+  /* Lookup tables of the topology */
+  struct topo_index *index;
+
+  /* Storage for output parameters and environment variables */
+  struct arena arena;
+
+  /* Kept across mappings: The bitmaps of cpus, gpus, mems, and nics,
+     and the restriction and reservation applied to the topology */
+  int nbitmaps;
+  hwloc_bitmap_t *bitmaps;
+  char *restr_applied;
+  int restr_applied_type;
+  int resv_applied;
+  int resv_applied_domain;
+  int resv_applied_end;
+
+  /* Lazy mode: The GPU IDs and the env variables of a task
+     are built on first access (per-task flags), under 'lock'.
+     A NULL flags array means every task is built */
+  int lazy;
+  int gpu_id_type;
+  char *gpus_done;
+  char *env_done;
+  pthread_mutex_t lock;
+
+  /* The PUs of each thread of a task, built on first
+     access (see mpibind_get_threads_ptask) */
+  int ***thread_cpus;
+  int **thread_ncpus;
+
+  /* Nanoseconds spent in each phase (MPIBIND_TIMER_*) */
+  uint64_t timers[MPIBIND_NUM_TIMERS];
 };
 
 #endif // MPIBIND_PRIV_H_INCLUDED
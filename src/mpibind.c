@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <limits.h>
 #include "mpibind.h"
 #include "mpibind-priv.h"
 #include "hwloc_utils.h"
@@ -33,27 +34,416 @@
  * or hwloc_utils.c
  ************************************************/
 int get_smt_level(hwloc_topology_t topo);
-int discover_devices(hwloc_topology_t topo,
-      struct device **devs, int size);
+int discover_devices(hwloc_topology_t topo, struct device ***pdevs);
 int get_num_gpus(struct device **devs, int ndevs);
+int get_num_nics(struct device **devs, int ndevs);
 int mpibind_distrib(hwloc_topology_t topo,
-      struct device **devs, int ndevs,
+      struct topo_index *idx,
 		  int ntasks, int nthreads,
-		  int greedy, int gpu_optim, int smt,
+		  int greedy, int gpu_optim, int smt, int llc,
+		  int cpukinds, const int *weights,
+		  int leader, int leader_domain,
 		  int *nthreads_pt,
 		  hwloc_bitmap_t *cpus_pt,
 		  hwloc_bitmap_t *gpus_pt);
+void thread_match(hwloc_topology_t topo, struct topo_index *idx,
+      hwloc_const_bitmap_t cpus, int nthreads,
+      hwloc_bitmap_t *threads);
+void nic_match(struct topo_index *idx, struct device **devs, int ndevs,
+      int ntasks, hwloc_bitmap_t *cpus_pt, hwloc_bitmap_t *nics_pt);
 int device_key_snprint(char *buf, size_t size,
       struct device *dev, int id_type);
 int get_gpu_vendor_id(struct device **devs, int ndevs);
 char* get_gpu_vendor(struct device **devs, int ndevs);
-const hwloc_bitmap_t get_core_cpuset(hwloc_topology_t topo, int pu);
-void terminate_str(char *buf, int size);
+hwloc_const_bitmap_t get_core_cpuset(hwloc_topology_t topo,
+      struct topo_index *idx, int pu);
+struct topo_index* topo_index_build(hwloc_topology_t topo,
+      struct device **devs, int ndevs);
+void topo_index_free(struct topo_index *idx);
+int reserve_cores(hwloc_topology_t topo, int ncores, int domain,
+		  int from_end, hwloc_bitmap_t reserved);
 int filter_topology(hwloc_topology_t topology);
 int numas_have_intersecting_cpus(hwloc_topology_t topo);
 int restrict_numas_with_intersecting_cpus(hwloc_topology_t topo);
 int check_topology(hwloc_topology_t topo);
 
+/************************************************
+ * Functions defined in arena.c
+ ************************************************/
+void arena_init(struct arena *arena);
+void* arena_alloc(struct arena *arena, size_t size);
+char* arena_strdup(struct arena *arena, const char *str);
+void arena_reset(struct arena *arena);
+void arena_release(struct arena *arena);
+
+/************************************************
+ * Functions defined in cache.c
+ ************************************************/
+int topo_cache_load(hwloc_topology_t topo, const char *path);
+int topo_cache_store(hwloc_topology_t topo, const char *path);
+struct map_key map_cache_key(hwloc_topology_t topo,
+      struct device **devs, int ndevs,
+      int ntasks, int nthreads,
+      int greedy, int gpu_optim, int smt, int llc, int cpukinds,
+      int auto_map, const int *weights, int leader, int leader_domain);
+int map_cache_lookup(struct map_key key, hwloc_topology_t topo, int ndevs,
+      const char *path, int ntasks,
+      int *nthreads, hwloc_bitmap_t *cpus, hwloc_bitmap_t *gpus);
+int map_cache_store(struct map_key key, const char *path, int ntasks,
+      int *nthreads, hwloc_bitmap_t *cpus, hwloc_bitmap_t *gpus);
+void map_cache_stats(int *hits, int *misses);
+
+/*
+ * Release the I/O devices and the topology index
+ * of a handle. They are rebuilt by the next mapping.
+ */
+void release_devices(mpibind_t *hdl)
+{
+  int i;
+
+  for (i=0; i<hdl->ndevs; i++)
+    free(hdl->devs[i]);
+  free(hdl->devs);
+  topo_index_free(hdl->index);
+
+  hdl->ndevs = 0;
+  hdl->devs = NULL;
+  hdl->index = NULL;
+}
+
+/*
+ * Environment variables set by mpibind_set_env_vars.
+ * hdl->env_vars[v].key is an index in this list.
+ */
+static const char *env_var_names[] = {
+  "OMP_NUM_THREADS",
+  "OMP_PLACES",
+  "OMP_PROC_BIND",
+  "VISIBLE_DEVICES",
+  "UCX_NET_DEVICES",
+  "FI_CXI_DEVICE_NAME"
+};
+#define NUM_ENV_VARS (sizeof(env_var_names) / sizeof(const char *))
+
+/*
+ * The env variable that selects a NIC for the communication
+ * libraries: Slingshot NICs (hsiN interfaces, cxiN devices)
+ * through libfabric's CXI provider and InfiniBand/RoCE NICs
+ * through UCX. BXI NICs do not have a common selector.
+ */
+static
+const char* nic_env_var(struct device *dev)
+{
+  if (strncmp(dev->name, "hsi", 3) == 0 ||
+      strncmp(dev->name, "cxi", 3) == 0)
+    return "FI_CXI_DEVICE_NAME";
+  if (strncmp(dev->name, "bxi", 3) == 0)
+    return NULL;
+
+  return "UCX_NET_DEVICES";
+}
+
+/*
+ * The NIC variables are only set on nodes with
+ * NICs of their kind.
+ */
+static
+int env_var_used(mpibind_t *hdl, const char *var)
+{
+  int i;
+  const char *nic_var;
+
+  if (strcmp(var, "UCX_NET_DEVICES") != 0 &&
+      strcmp(var, "FI_CXI_DEVICE_NAME") != 0)
+    return 1;
+
+  for (i=0; i<hdl->ndevs; i++)
+    if (hdl->devs[i]->type == DEV_NIC &&
+	(nic_var = nic_env_var(hdl->devs[i])) != NULL &&
+	strcmp(nic_var, var) == 0)
+      return 1;
+
+  return 0;
+}
+
+/*
+ * Build the GPU IDs of a task (hdl->gpus_usr)
+ * with the current type of IDs.
+ */
+static
+void gpu_ids_task(mpibind_t *hdl, int taskid)
+{
+  int val, j=0, len;
+
+  if (hdl->gpus_usr[taskid] == NULL)
+    hdl->gpus_usr[taskid] =
+      arena_alloc(&hdl->arena,
+		  hwloc_bitmap_weight(hdl->gpus[taskid]) * sizeof(char *));
+
+  /* The IDs are sized for the given type. The IDs of
+     a previous type stay in the arena until finalize */
+  hwloc_bitmap_foreach_begin(val, hdl->gpus[taskid]) {
+    len = device_key_snprint(NULL, 0, hdl->devs[val],
+			     hdl->gpu_id_type) + 1;
+    hdl->gpus_usr[taskid][j] = arena_alloc(&hdl->arena, len);
+    device_key_snprint(hdl->gpus_usr[taskid][j], len, hdl->devs[val],
+		       hdl->gpu_id_type);
+#if VERBOSE >= 2
+    PRINT("Task[%d] GPU[%d]: %s\n", taskid, j, hdl->gpus_usr[taskid][j]);
+#endif
+    j++;
+  } hwloc_bitmap_foreach_end();
+}
+
+/*
+ * Build the values of the env variables of a task.
+ */
+static
+void env_vars_task(mpibind_t *hdl, int taskid)
+{
+  int v, nc, val, end, size;
+  char *str;
+  const char *var;
+  struct device *nic;
+
+  /* The device lists grow with the number of devices: A device
+     takes at most its name, a prefix or suffix, and a comma */
+  size = LONG_STR_SIZE + (SHORT_STR_SIZE + 8) *
+    (hwloc_bitmap_weight(hdl->gpus[taskid]) +
+     hwloc_bitmap_weight(hdl->nics[taskid]));
+  if ((str = malloc(size)) == NULL)
+    return;
+
+  for (v=0; v<hdl->nvars; v++) {
+    var = env_var_names[hdl->env_vars[v].key];
+    str[0] = '\0';
+
+    if ( strncmp(var, "OMP_NUM_THREADS", 8) == 0 )
+      snprintf(str, size, "%d", hdl->nthreads[taskid]);
+
+    else if ( strncmp(var, "OMP_PLACES", 8) == 0 ) {
+      /*
+       * Simplifying the value of this variable from
+       * a list of PUs to 'threads'.
+       *
+       * mpibind binds each process to a set of PUs already
+       * so it might be redundant to apply the thread
+       * binding to the same list of PUs as the process
+       * binding.
+       * While setting this env variable to a explicit
+       * list of places should not hurt, it can be problematic
+       * for some OpenMP compilers that interpret the list
+       * of places as relative IDs: An ID of 4 does not mean
+       * hardware thread 4, instead it means the forth place.
+       * This may result in errors when passing large IDs
+       * like 60 (hardware thread 60) since there may not be a
+       * 60th place within this process.
+       */
+#if 0
+      nc = 0;
+      hwloc_bitmap_foreach_begin(val, hdl->cpus[taskid]) {
+	nc += snprintf(str+nc,
+		       (size-nc < 0) ? 0 : size-nc,
+		       "{%d},", val);
+      } hwloc_bitmap_foreach_end();
+#else
+      snprintf(str, size, "threads");
+#endif
+    }
+
+    else if ( strncmp(var, "OMP_PROC", 8) == 0 )
+      snprintf(str, size, "spread");
+
+    else if ( strncmp(var, "VISIBLE_DEVICES", 8) == 0 ) {
+      nc = 0;
+      /* Use the GPU's visible devices ID (visdevs),
+	 not the mpibind ID (val).
+	 Todo: When AMD supports UUIDs, use UUIDs instead */
+      hwloc_bitmap_foreach_begin(val, hdl->gpus[taskid]) {
+	nc += snprintf(str+nc, size-nc, "%d,",
+		       hdl->devs[val]->smi);
+      } hwloc_bitmap_foreach_end();
+    }
+
+    else if ( strncmp(var, "UCX_NET_DEVICES", 8) == 0 ||
+	      strncmp(var, "FI_CXI_DEVICE_NAME", 8) == 0 ) {
+      nc = 0;
+      hwloc_bitmap_foreach_begin(val, hdl->nics[taskid]) {
+	nic = hdl->devs[val];
+	if (nic_env_var(nic) == NULL || strcmp(nic_env_var(nic), var) != 0)
+	  continue;
+	/* UCX takes a device and a port; use the first port.
+	   CXI devices are numbered like their hsi interfaces */
+	if (var[0] == 'U')
+	  nc += snprintf(str+nc, size-nc, "%s:1,", nic->name);
+	else
+	  nc += snprintf(str+nc, size-nc, "cxi%s,", nic->name+3);
+      } hwloc_bitmap_foreach_end();
+    }
+
+    /* Strip the last comma */
+    end = strlen(str) - 1;
+    if (end >= 0 && str[end] == ',')
+      str[end] = '\0';
+
+    /* Keep only the characters used */
+    hdl->env_vars[v].values[taskid] = arena_strdup(&hdl->arena, str);
+  }
+
+  free(str);
+}
+
+/*
+ * Use GPU IDs of the given type (see mpibind_set_gpu_ids).
+ * The caller holds the lock of the handle.
+ */
+static
+void set_gpu_ids(mpibind_t *hdl, int id_type)
+{
+  int i;
+  char ***ids;
+
+  hdl->gpu_id_type = id_type;
+
+  /* In lazy mode, IDs are built on first access (IDs of a
+     previous type too). Mark them before publishing the
+     storage of the IDs below */
+  if (hdl->lazy) {
+    hdl->gpus_done = arena_alloc(&hdl->arena, hdl->ntasks);
+    memset(hdl->gpus_done, 0, hdl->ntasks);
+  } else
+    hdl->gpus_done = NULL;
+
+  /* If space has not been allocated, allocate space
+     to store GPU mapping. Each task's IDs are allocated
+     once, when first built */
+  if (hdl->gpus_usr == NULL) {
+    ids = arena_alloc(&hdl->arena, hdl->ntasks * sizeof(char **));
+    for (i=0; i<hdl->ntasks; i++)
+      ids[i] = NULL;
+    hdl->gpus_usr = ids;
+  }
+
+  if (!hdl->lazy)
+    for (i=0; i<hdl->ntasks; i++)
+      gpu_ids_task(hdl, i);
+}
+
+/*
+ * In lazy mode, build the GPU IDs and the env variables
+ * of a task if they have not been built yet.
+ * Tasks may call this function concurrently.
+ */
+static
+void complete_task(mpibind_t *hdl, int taskid)
+{
+  uint64_t start;
+
+  /* Only lazy handles build outputs on access. The flag is
+     set before the mapping, unlike the pointers below */
+  if (!hdl->lazy)
+    return;
+
+  pthread_mutex_lock(&hdl->lock);
+
+  if (hdl->gpus_done && hdl->gpus_usr && !hdl->gpus_done[taskid]) {
+    gpu_ids_task(hdl, taskid);
+    hdl->gpus_done[taskid] = 1;
+  }
+
+  if (hdl->env_done && !hdl->env_done[taskid]) {
+    start = timer_now();
+    env_vars_task(hdl, taskid);
+    hdl->env_done[taskid] = 1;
+    hdl->timers[MPIBIND_TIMER_ENV_VARS] += timer_now() - start;
+  }
+
+  pthread_mutex_unlock(&hdl->lock);
+}
+
+/*
+ * Place the threads of a task (see thread_match) and keep
+ * the PUs of each thread. Tasks may call this function
+ * concurrently. Returns 0 on success and 1 if out of memory.
+ */
+static
+int place_threads(mpibind_t *hdl, int taskid)
+{
+  int i, j, val, nths, rc = 1;
+  int *ncpus, **cpus;
+  hwloc_bitmap_t *threads;
+
+  pthread_mutex_lock(&hdl->lock);
+
+  if (hdl->thread_cpus == NULL) {
+    hdl->thread_cpus = arena_alloc(&hdl->arena,
+				   hdl->ntasks * sizeof(int **));
+    hdl->thread_ncpus = arena_alloc(&hdl->arena,
+				    hdl->ntasks * sizeof(int *));
+    if (hdl->thread_cpus == NULL || hdl->thread_ncpus == NULL) {
+      hdl->thread_cpus = NULL;
+      goto out;
+    }
+    for (i=0; i<hdl->ntasks; i++) {
+      hdl->thread_cpus[i] = NULL;
+      hdl->thread_ncpus[i] = NULL;
+    }
+  }
+
+  if (hdl->thread_cpus[taskid] == NULL) {
+    nths = hdl->nthreads[taskid];
+    if ((threads = calloc(nths, sizeof(hwloc_bitmap_t))) == NULL)
+      goto out;
+    for (i=0; i<nths; i++)
+      if ((threads[i] = hwloc_bitmap_alloc()) == NULL)
+	goto free_threads;
+
+    thread_match(hdl->topo, hdl->index, hdl->cpus[taskid], nths, threads);
+
+    ncpus = arena_alloc(&hdl->arena, nths * sizeof(int));
+    cpus = arena_alloc(&hdl->arena, nths * sizeof(int *));
+    if (ncpus == NULL || cpus == NULL)
+      goto free_threads;
+    for (i=0; i<nths; i++) {
+      ncpus[i] = hwloc_bitmap_weight(threads[i]);
+      cpus[i] = arena_alloc(&hdl->arena, ncpus[i] * sizeof(int));
+      if (cpus[i] == NULL)
+	goto free_threads;
+      j = 0;
+      hwloc_bitmap_foreach_begin(val, threads[i]) {
+	cpus[i][j++] = val;
+      } hwloc_bitmap_foreach_end();
+    }
+    hdl->thread_ncpus[taskid] = ncpus;
+    hdl->thread_cpus[taskid] = cpus;
+
+  free_threads:
+    for (i=0; i<nths; i++)
+      hwloc_bitmap_free(threads[i]);
+    free(threads);
+  }
+  rc = (hdl->thread_cpus[taskid] == NULL);
+
+ out:
+  pthread_mutex_unlock(&hdl->lock);
+  return rc;
+}
+
+/*
+ * Build the outputs of every task not built yet.
+ */
+static
+void complete_tasks(mpibind_t *hdl)
+{
+  int i;
+
+  if (!hdl->lazy)
+    return;
+
+  for (i=0; i<hdl->ntasks; i++)
+    complete_task(hdl, i);
+}
+
 /*********************************************
  * Public interface of mpibind.
  *********************************************/
@@ -78,9 +468,25 @@ int mpibind_init(mpibind_t **handle)
   hdl->greedy = 1;
   hdl->gpu_optim = 1;
   hdl->smt = 0;
+  hdl->llc = 0;
+  hdl->cpukinds = 0;
+  hdl->auto_map = 0;
+  hdl->nweights = 0;
+  hdl->weights = NULL;
+  hdl->leader = -1;
+  hdl->leader_domain = MPIBIND_LEADER_CORE;
+  hdl->nprev = 0;
+  hdl->prev_cpus = NULL;
+  hdl->prev_gpus = NULL;
   hdl->restr_set = NULL;
   hdl->restr_type = MPIBIND_RESTRICT_CPU;
   hdl->topo = NULL;
+  hdl->map_cache = 0;
+  hdl->map_cache_file = NULL;
+  hdl->membind = MPIBIND_MEMBIND_NONE;
+  hdl->resv_ncores = 0;
+  hdl->resv_domain = MPIBIND_RESERVE_NODE;
+  hdl->resv_end = 1;
 
   hdl->nvars = 0;
   hdl->names = NULL;
@@ -88,13 +494,35 @@ int mpibind_init(mpibind_t **handle)
 
   hdl->ndevs = 0;
   hdl->devs = NULL;
+  hdl->index = NULL;
 
   /* Initialize output parameters */
   hdl->nthreads = NULL;
   hdl->cpus = NULL;
   hdl->gpus = NULL;
+  hdl->mems = NULL;
+  hdl->nics = NULL;
   hdl->gpus_usr = NULL;
   hdl->cpus_usr = NULL;
+  hdl->nics_usr = NULL;
+  hdl->moved = NULL;
+  arena_init(&hdl->arena);
+
+  hdl->nbitmaps = 0;
+  hdl->bitmaps = NULL;
+  hdl->restr_applied = NULL;
+  hdl->restr_applied_type = -1;
+  hdl->resv_applied = 0;
+
+  hdl->lazy = 0;
+  hdl->gpu_id_type = MPIBIND_ID_SMI;
+  hdl->gpus_done = NULL;
+  hdl->env_done = NULL;
+  pthread_mutex_init(&hdl->lock, NULL);
+  hdl->thread_cpus = NULL;
+  hdl->thread_ncpus = NULL;
+
+  memset(hdl->timers, 0, sizeof(hdl->timers));
 
   *handle = hdl;
 
@@ -107,58 +535,27 @@ int mpibind_init(mpibind_t **handle)
  */
 int mpibind_finalize(mpibind_t *hdl)
 {
-  int i, j, v;
+  int i;
 
   if (hdl == NULL)
     return 1;
 
-  /* Release user-specified GPU ID type */
-  if (hdl->gpus_usr != NULL) {
-    for (i=0; i<hdl->ntasks; i++) {
-      for (j=0; j<hwloc_bitmap_weight(hdl->gpus[i]); j++)
-        free(hdl->gpus_usr[i][j]);
-      free(hdl->gpus_usr[i]);
-    }
-    free(hdl->gpus_usr);
-  }
-
-  /* Release CPU arrays */
-  if (hdl->cpus_usr != NULL) {
-    for (i=0; i<hdl->ntasks; i++) {
-      free(hdl->cpus_usr[i]);
-    }
-    free(hdl->cpus_usr);
-  }
-
-  /* Release mapping space */
-  for (i=0; i<hdl->ntasks; i++) {
-    hwloc_bitmap_free(hdl->cpus[i]);
-    hwloc_bitmap_free(hdl->gpus[i]);
-  }
-  free(hdl->cpus);
-  free(hdl->gpus);
-  free(hdl->nthreads);
+  /* Release mapping space. The arrays themselves
+     live in the arena */
+  for (i=0; i<hdl->nbitmaps; i++)
+    hwloc_bitmap_free(hdl->bitmaps[i]);
+  free(hdl->bitmaps);
 
   /* Release I/O devices structure */
-  for (i=0; i<hdl->ndevs; i++)
-    free(hdl->devs[i]);
-  free(hdl->devs);
+  release_devices(hdl);
+  free(hdl->restr_applied);
+  free(hdl->weights);
+  mpibind_set_previous(hdl, 0, NULL, NULL);
+  pthread_mutex_destroy(&hdl->lock);
 
-  /* Release env variables space */
-  for (v=0; v<hdl->nvars; v++) {
-#if VERBOSE >= 3
-    PRINT("Releasing %s\n", hdl->env_vars[v].name);
-#endif
-    free(hdl->names[v]);
-    free(hdl->env_vars[v].name);
-    for (i=0; i<hdl->env_vars[v].size; i++)
-      free(hdl->env_vars[v].values[i]);
-    free(hdl->env_vars[v].values);
-  }
-  if (hdl->names != NULL)
-    free(hdl->names);
-  if (hdl->env_vars != NULL)
-    free(hdl->env_vars);
+  /* Release the outputs: CPU and GPU arrays,
+     and env variables space */
+  arena_release(&hdl->arena);
 
   /* Release the main structure */
   free(hdl);
@@ -249,6 +646,188 @@ int mpibind_set_smt(mpibind_t *handle,
   return 0;
 }
 
+/*
+ * Valid values are 0 and 1. Default is 0.
+ * If 1, tasks stay within an L3 cache when possible
+ * (see cpu_match_llc).
+ */
+int mpibind_set_llc(mpibind_t *handle, int llc)
+{
+  if (handle == NULL || llc < 0 || llc > 1)
+    return 1;
+
+  handle->llc = llc;
+
+  return 0;
+}
+
+/*
+ * Valid values are 0 and 1. Default is 0.
+ * If 1, tasks use the most efficient kind of
+ * cores of a hybrid CPU only.
+ */
+int mpibind_set_cpukinds(mpibind_t *handle, int cpukinds)
+{
+  if (handle == NULL || cpukinds < 0 || cpukinds > 1)
+    return 1;
+
+  handle->cpukinds = cpukinds;
+
+  return 0;
+}
+
+/*
+ * Valid values are 0 and 1. Default is 0.
+ * If 1, choose the best of several candidate mappings
+ * according to a cost model (see distrib_auto).
+ */
+int mpibind_set_auto(mpibind_t *handle, int enable)
+{
+  if (handle == NULL || enable < 0 || enable > 1)
+    return 1;
+
+  handle->auto_map = enable;
+
+  return 0;
+}
+
+/*
+ * The weight of each task, e.g., its number of threads.
+ * Tasks get cores and GPUs in proportion to their weight.
+ * The weights are copied. NULL or nweights=0 removes them.
+ */
+int mpibind_set_weights(mpibind_t *handle, int nweights,
+			const int *weights)
+{
+  int i, *copy = NULL;
+
+  if (handle == NULL || nweights < 0 ||
+      (nweights > 0 && weights == NULL))
+    return 1;
+
+  for (i=0; i<nweights; i++)
+    if (weights[i] <= 0)
+      return 1;
+
+  if (nweights > 0) {
+    if ((copy = malloc(nweights * sizeof(int))) == NULL)
+      return 1;
+    memcpy(copy, weights, nweights * sizeof(int));
+  }
+
+  free(handle->weights);
+  handle->weights = copy;
+  handle->nweights = nweights;
+
+  return 0;
+}
+
+/*
+ * Give task 'task' a domain of its own (MPIBIND_LEADER_*).
+ * A task of -1 disables the leader.
+ */
+int mpibind_set_leader(mpibind_t *handle, int task, int domain)
+{
+  if (handle == NULL || task < -1 ||
+      domain < MPIBIND_LEADER_CORE || domain > MPIBIND_LEADER_NUMA)
+    return 1;
+
+  handle->leader = task;
+  handle->leader_domain = domain;
+
+  return 0;
+}
+
+/*
+ * The mapping of 'ntasks' tasks before the job grew or
+ * shrank. The sets are copied, so they can be the outputs
+ * of the last mapping of this handle. Without 'gpus',
+ * only the CPUs are compared.
+ */
+int mpibind_set_previous(mpibind_t *handle, int ntasks,
+			 hwloc_bitmap_t *cpus, hwloc_bitmap_t *gpus)
+{
+  int i;
+
+  if (handle == NULL || ntasks < 0 || (ntasks > 0 && cpus == NULL))
+    return 1;
+
+  for (i=0; i<handle->nprev; i++) {
+    hwloc_bitmap_free(handle->prev_cpus[i]);
+    if (handle->prev_gpus != NULL)
+      hwloc_bitmap_free(handle->prev_gpus[i]);
+  }
+  free(handle->prev_cpus);
+  free(handle->prev_gpus);
+  handle->prev_cpus = handle->prev_gpus = NULL;
+  handle->nprev = 0;
+
+  if (ntasks == 0)
+    return 0;
+
+  /* On failure, there is no previous mapping */
+  handle->prev_cpus = calloc(ntasks, sizeof(hwloc_bitmap_t));
+  if (gpus != NULL)
+    handle->prev_gpus = calloc(ntasks, sizeof(hwloc_bitmap_t));
+  if (handle->prev_cpus == NULL ||
+      (gpus != NULL && handle->prev_gpus == NULL)) {
+    free(handle->prev_cpus);
+    free(handle->prev_gpus);
+    handle->prev_cpus = handle->prev_gpus = NULL;
+    return 1;
+  }
+  for (i=0; i<ntasks; i++) {
+    handle->prev_cpus[i] = hwloc_bitmap_dup(cpus[i]);
+    if (gpus != NULL)
+      handle->prev_gpus[i] = hwloc_bitmap_dup(gpus[i]);
+    handle->nprev = i + 1;
+    if (handle->prev_cpus[i] == NULL ||
+	(gpus != NULL && handle->prev_gpus[i] == NULL)) {
+      mpibind_set_previous(handle, 0, NULL, NULL);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Memory policy applied by mpibind_apply,
+ * e.g., MPIBIND_MEMBIND_BIND.
+ */
+int mpibind_set_membind(mpibind_t *handle, int policy)
+{
+  if (handle == NULL ||
+      (policy != MPIBIND_MEMBIND_NONE &&
+       policy != MPIBIND_MEMBIND_BIND &&
+       policy != MPIBIND_MEMBIND_INTERLEAVE &&
+       policy != MPIBIND_MEMBIND_PREFERRED))
+    return 1;
+
+  handle->membind = policy;
+
+  return 0;
+}
+
+/*
+ * Reserve 'ncores' cores of each domain for the OS,
+ * the last ones if 'from_end' is 1 or the first ones.
+ */
+int mpibind_set_reserved(mpibind_t *handle, int ncores,
+			 int domain, int from_end)
+{
+  if (handle == NULL || ncores < 0 ||
+      domain < MPIBIND_RESERVE_NODE || domain > MPIBIND_RESERVE_NUMA ||
+      from_end < 0 || from_end > 1)
+    return 1;
+
+  handle->resv_ncores = ncores;
+  handle->resv_domain = domain;
+  handle->resv_end = from_end;
+
+  return 0;
+}
+
 /*
  * Restrict the hardware topology to resources
  * associated with the specified hardware ids of type 'restr_type'.
@@ -293,11 +872,52 @@ int mpibind_set_topology(mpibind_t *handle,
   if (handle == NULL)
     return 1;
 
+  /* Devices discovered on a previous topology are stale */
+  if (topo != handle->topo) {
+    release_devices(handle);
+    free(handle->restr_applied);
+    handle->restr_applied = NULL;
+    handle->restr_applied_type = -1;
+    handle->resv_applied = 0;
+  }
+
   handle->topo = topo;
 
   return 0;
 }
 
+/*
+ * Reuse mappings computed earlier by this process and,
+ * if 'cache_file' is not NULL, by other processes on
+ * this node. Valid values of 'enable' are 0 and 1.
+ */
+int mpibind_set_map_cache(mpibind_t *handle,
+			  int enable, const char *cache_file)
+{
+  if (handle == NULL || enable < 0 || enable > 1)
+    return 1;
+
+  handle->map_cache = enable;
+  handle->map_cache_file = cache_file;
+
+  return 0;
+}
+
+/*
+ * Build the GPU IDs and the env variables of a task
+ * when they are first retrieved rather than for all
+ * the tasks at once. Valid values are 0 and 1.
+ */
+int mpibind_set_lazy(mpibind_t *handle, int lazy)
+{
+  if (handle == NULL || lazy < 0 || lazy > 1)
+    return 1;
+
+  handle->lazy = lazy;
+
+  return 0;
+}
+
 /*
  * Array with 'ntasks' elements. Each entry correspond
  * to the number of threads to use for the process/task
@@ -323,6 +943,29 @@ hwloc_bitmap_t* mpibind_get_cpus(mpibind_t *handle)
   return handle->cpus;
 }
 
+/*
+ * Array with 'ntasks' elements. The NUMA domains
+ * (nodeset) local to the CPUs of a given process/task.
+ */
+hwloc_bitmap_t* mpibind_get_mems(mpibind_t *handle)
+{
+  if (handle == NULL)
+    return NULL;
+
+  return handle->mems;
+}
+
+/*
+ * The PUs of the CPU kinds not used by tasks.
+ */
+hwloc_const_bitmap_t mpibind_get_helper_cpus(mpibind_t *handle)
+{
+  if (handle == NULL || !handle->cpukinds || handle->index == NULL)
+    return NULL;
+
+  return handle->index->helper_cpus;
+}
+
 /*
  * Array with 'ntasks' elements. The GPUs to use for a
  * given process/task.
@@ -378,23 +1021,56 @@ hwloc_bitmap_t* mpibind_get_gpus(mpibind_t *handle)
 char ** mpibind_get_gpus_ptask(mpibind_t *handle, int taskid,
                                int *ngpus)
 {
-  if (handle == NULL || taskid >= handle->ntasks || taskid < 0)
+  if (handle == NULL || handle->gpus == NULL ||
+      taskid >= handle->ntasks || taskid < 0)
     return NULL;
 
+  /* User hasn't called mpibind_set_gpu_ids(): Use the
+     default ID type. Tasks may get here concurrently */
+  pthread_mutex_lock(&handle->lock);
   if (handle->gpus_usr == NULL)
-    /* User hasn't called mpibind_set_gpu_ids().
-       Call this function with the default ID type */
-    mpibind_set_gpu_ids(handle, MPIBIND_ID_SMI);
+    set_gpu_ids(handle, MPIBIND_ID_SMI);
+  pthread_mutex_unlock(&handle->lock);
+  complete_task(handle, taskid);
 
   *ngpus = hwloc_bitmap_weight(handle->gpus[taskid]);
 
   return handle->gpus_usr[taskid];
 }
 
-int* mpibind_get_cpus_ptask(mpibind_t *handle, int taskid,
-			    int *ncpus)
-{
-  if (handle == NULL || taskid >= handle->ntasks || taskid < 0)
+/*
+ * Array with 'ntasks' elements. The NICs to use for a
+ * given process/task (mpibind IDs, see mpibind_get_gpus).
+ */
+hwloc_bitmap_t* mpibind_get_nics(mpibind_t *handle)
+{
+  if (handle == NULL)
+    return NULL;
+
+  return handle->nics;
+}
+
+/*
+ * Get an array of strings with the names of the
+ * NICs of the specified task, e.g., mlx5_0.
+ */
+char** mpibind_get_nics_ptask(mpibind_t *handle, int taskid,
+			      int *nnics)
+{
+  if (handle == NULL || handle->nics_usr == NULL ||
+      taskid >= handle->ntasks || taskid < 0)
+    return NULL;
+
+  *nnics = hwloc_bitmap_weight(handle->nics[taskid]);
+
+  return handle->nics_usr[taskid];
+}
+
+int* mpibind_get_cpus_ptask(mpibind_t *handle, int taskid,
+			    int *ncpus)
+{
+  if (handle == NULL || handle->cpus == NULL ||
+      taskid >= handle->ntasks || taskid < 0)
     return NULL;
 
   *ncpus = hwloc_bitmap_weight(handle->cpus[taskid]);
@@ -402,6 +1078,48 @@ int* mpibind_get_cpus_ptask(mpibind_t *handle, int taskid,
   return handle->cpus_usr[taskid];
 }
 
+/*
+ * The PUs of each thread of a given task: Threads are
+ * placed on different cores first and then on the hardware
+ * threads of each core. The number of threads is set in
+ * 'nthreads' and the number of PUs of each thread in 'ncpus'.
+ */
+int** mpibind_get_threads_ptask(mpibind_t *handle, int taskid,
+				int *nthreads, int **ncpus)
+{
+  if (handle == NULL || handle->cpus == NULL ||
+      taskid >= handle->ntasks || taskid < 0)
+    return NULL;
+
+  if (place_threads(handle, taskid) != 0)
+    return NULL;
+
+  *nthreads = handle->nthreads[taskid];
+  if (ncpus != NULL)
+    *ncpus = handle->thread_ncpus[taskid];
+
+  return handle->thread_cpus[taskid];
+}
+
+/*
+ * The PUs of a given thread of a given task
+ * (see mpibind_get_threads_ptask).
+ */
+int* mpibind_get_thread_cpus(mpibind_t *handle, int taskid,
+			     int threadid, int *ncpus)
+{
+  int nths, *counts;
+  int **threads = mpibind_get_threads_ptask(handle, taskid,
+					    &nths, &counts);
+
+  if (threads == NULL || threadid < 0 || threadid >= nths)
+    return NULL;
+
+  *ncpus = counts[threadid];
+
+  return threads[threadid];
+}
+
 /*
  * Get the number of GPUs in the system/allocation.
  */
@@ -413,6 +1131,17 @@ int mpibind_get_num_gpus(mpibind_t *handle)
   return get_num_gpus(handle->devs, handle->ndevs);
 }
 
+/*
+ * Get the number of NICs in the system/allocation.
+ */
+int mpibind_get_num_nics(mpibind_t *handle)
+{
+  if (handle == NULL)
+    return -1;
+
+  return get_num_nics(handle->devs, handle->ndevs);
+}
+
 /*
  * Get the hwloc loaded topology used by mpibind so that
  * callers can continue to use it even after mpibind has
@@ -476,6 +1205,113 @@ int mpibind_get_smt(mpibind_t *handle)
   return handle->smt;
 }
 
+/*
+ * Get the L3-aware setting associated with an
+ * mpibind handle.
+ */
+int mpibind_get_llc(mpibind_t *handle)
+{
+  if (handle == NULL)
+    return -1;
+
+  return handle->llc;
+}
+
+/*
+ * Get the CPU kinds setting associated with an
+ * mpibind handle.
+ */
+int mpibind_get_cpukinds(mpibind_t *handle)
+{
+  if (handle == NULL)
+    return -1;
+
+  return handle->cpukinds;
+}
+
+/*
+ * Get the auto mode setting associated with an
+ * mpibind handle.
+ */
+int mpibind_get_auto(mpibind_t *handle)
+{
+  if (handle == NULL)
+    return -1;
+
+  return handle->auto_map;
+}
+
+/*
+ * Get the task weights associated with an
+ * mpibind handle, NULL if there are none.
+ */
+const int* mpibind_get_weights(mpibind_t *handle, int *nweights)
+{
+  if (handle == NULL)
+    return NULL;
+
+  if (nweights != NULL)
+    *nweights = handle->nweights;
+
+  return handle->weights;
+}
+
+/*
+ * Get whether each task of the last mapping moved with
+ * respect to the previous mapping.
+ */
+int* mpibind_get_moved(mpibind_t *handle)
+{
+  if (handle == NULL)
+    return NULL;
+
+  return handle->moved;
+}
+
+/*
+ * Get the leader task and its domain associated with an
+ * mpibind handle.
+ */
+int mpibind_get_leader(mpibind_t *handle, int *domain)
+{
+  if (handle == NULL)
+    return -1;
+
+  if (domain != NULL)
+    *domain = handle->leader_domain;
+
+  return handle->leader;
+}
+
+/*
+ * Get the memory policy associated with an
+ * mpibind handle.
+ */
+int mpibind_get_membind(mpibind_t *handle)
+{
+  if (handle == NULL)
+    return -1;
+
+  return handle->membind;
+}
+
+/*
+ * Get the reserved cores per domain associated with an
+ * mpibind handle.
+ */
+int mpibind_get_reserved(mpibind_t *handle, int *domain, int *from_end)
+{
+  if (handle == NULL)
+    return -1;
+
+  if (domain != NULL)
+    *domain = handle->resv_domain;
+  if (from_end != NULL)
+    *from_end = handle->resv_end;
+
+  return handle->resv_ncores;
+}
+
 /*
  * Get the restrict id set associated with an
  * mpibind handle.
@@ -501,13 +1337,11 @@ int mpibind_get_restrict_type(mpibind_t *handle)
 }
 
 /*
- * Wrap hwloc_topology_load with extra filters
- * to make sure the topology meets the criteria
- * for mpibind's correct operation.
- *
- * Return 0 on success and 1 otherwise
+ * Set the topology flags and filters required by mpibind.
+ * Call before hwloc_topology_load.
  */
-int mpibind_load_topology(hwloc_topology_t topo)
+static
+void configure_topology(hwloc_topology_t topo)
 {
   /* Make sure OS functions are actually called
      when binding workers. Could also use HWLOC_THISSYSTEM=1,
@@ -518,6 +1352,49 @@ int mpibind_load_topology(hwloc_topology_t topo)
   /* Make sure OS and PCI devices are not filtered out */
   if (filter_topology(topo) < 0)
     PRINT("WARN: Failed to incorporate key topology components\n");
+}
+
+/*
+ * Wrap hwloc_topology_load with extra filters
+ * to make sure the topology meets the criteria
+ * for mpibind's correct operation.
+ *
+ * Return 0 on success and 1 otherwise
+ */
+int mpibind_load_topology(hwloc_topology_t topo)
+{
+  return mpibind_load_topology_cached(topo, NULL, NULL);
+}
+
+/*
+ * Same as mpibind_load_topology, but use a node-local
+ * snapshot of the resulting topology when possible.
+ * If 'cache_file' holds a snapshot that matches this hwloc
+ * version, kernel boot, and set of filters, the topology is
+ * imported from it. Otherwise, the topology is discovered
+ * and saved into 'cache_file' for subsequent calls.
+ * If 'usecs' is not NULL, it gets the load time in microseconds.
+ *
+ * Return 0 on success and 1 otherwise
+ */
+int mpibind_load_topology_cached(hwloc_topology_t topo,
+				 const char *cache_file, double *usecs)
+{
+  int rc;
+  uint64_t start = timer_now();
+
+  configure_topology(topo);
+
+  if (cache_file != NULL) {
+    if ((rc = topo_cache_load(topo, cache_file)) == 0) {
+      if (usecs != NULL)
+	*usecs = (timer_now() - start) / 1e3;
+      return 0;
+    }
+    else if (rc < 0)
+      /* hwloc reinitialized the topology */
+      configure_topology(topo);
+  }
 
   if (hwloc_topology_load(topo) < 0) {
     PRINT("ERR: hwloc_topology_load failed\n");
@@ -532,37 +1409,28 @@ int mpibind_load_topology(hwloc_topology_t topo)
   if ( numas_have_intersecting_cpus(topo) )
     restrict_numas_with_intersecting_cpus(topo);
 
+  /* Failing to save the snapshot is not an error */
+  if (cache_file != NULL && topo_cache_store(topo, cache_file) != 0)
+    PRINT("WARN: Failed to save topology snapshot %s\n", cache_file);
+
+  if (usecs != NULL)
+    *usecs = (timer_now() - start) / 1e3;
+
   return 0;
 }
 
 /*
- * Process the input and call the main mapping function.
- * Input:
- *   ntasks: number of tasks.
- *   nthreads: (optional) number of threads per task.
- *             Default value should be 0, in which case
- *             mpibind calculates the nthreads per task.
- *   greedy: (optional) Use the whole node when using a single task.
- *           Default value should be 1, in which case
- *           1-task jobs span the whole node.
- *   gpu_optim: (optional) optimize placement based on GPUs.
- *              If 0, optimize based on memory and CPUs.
- *              Default value should be 1 if allocation has GPUs
- *              and 0 otherwise.
- *   smt: (optional) map app workers to the specified SMT level.
- *        Default value should be 0, in which case the matching
- *        level is Core, or SMT-k if enough threads are given.
- *        If smt>0 workers are always mapped to the specified SMT
- *        level regardless of the given number of threads.
- * Output:
- *   nthreads, cpus, gpus.
+ * Get the topology of a handle ready for mapping: load it if
+ * the caller did not provide one, restrict it, and discover
+ * its I/O devices. The work is done once per topology.
  * Returns 0 on success.
  */
-int mpibind(mpibind_t *hdl)
+static
+int prepare_topology(mpibind_t *hdl)
 {
-  int i, j, val, gpu_optim, rc=0;
   unsigned version, major;
   unsigned long flags;
+  uint64_t start;
   hwloc_bitmap_t set;
 
   /* hwloc API version 2 required */
@@ -575,33 +1443,38 @@ int mpibind(mpibind_t *hdl)
     return 1;
   }
 
-  /* Input parameters check */
-  if (hdl->ntasks <= 0 || hdl->in_nthreads < 0) {
-    fprintf(stderr, "Error: ntasks %d or nthreads %d out of range\n",
-	    hdl->ntasks, hdl->in_nthreads);
-    return 1;
-  }
-
+  start = timer_now();
   if (hdl->topo == NULL) {
     hwloc_topology_init(&hdl->topo);
     mpibind_load_topology(hdl->topo);
-  } else
+  } else if (hdl->index == NULL)
     /* Caller provides the hwloc topology */
     check_topology(hdl->topo);
+  hdl->timers[MPIBIND_TIMER_LOAD] += timer_now() - start;
 
 #if VERBOSE >= 1
   print_topo_brief(hdl->topo);
   print_topo_io(hdl->topo);
 #endif
 
-  if (hdl->smt < 0 || hdl->smt > get_smt_level(hdl->topo)) {
-    fprintf(stderr, "Error: SMT parameter %d out of range\n",
-	    hdl->smt);
+  /* A topology cannot be unrestricted: Mappings with a
+     different restriction need a new topology */
+  if (hdl->restr_applied != NULL &&
+      (hdl->restr_set == NULL ||
+       strcmp(hdl->restr_set, hdl->restr_applied) != 0 ||
+       hdl->restr_type != hdl->restr_applied_type)) {
+    fprintf(stderr, "Error: Topology already restricted to %s\n",
+	    hdl->restr_applied);
     return 1;
   }
 
   /* User asked to restrict the topology */
-  if (hdl->restr_set) {
+  if (hdl->restr_set && hdl->restr_applied == NULL) {
+    /* Devices of the unrestricted topology are stale */
+    release_devices(hdl);
+    hdl->restr_applied = strdup(hdl->restr_set);
+    hdl->restr_applied_type = hdl->restr_type;
+
     flags = 0;
     set = hwloc_bitmap_alloc();
     hwloc_bitmap_list_sscanf(set, hdl->restr_set);
@@ -612,48 +1485,787 @@ int mpibind(mpibind_t *hdl)
       flags = HWLOC_RESTRICT_FLAG_BYNODESET |
 	HWLOC_RESTRICT_FLAG_REMOVE_MEMLESS;
 
+    start = timer_now();
     if ( hwloc_topology_restrict(hdl->topo, set, flags) )
       PRINT("Warn: Failed to restrict topology to %s\n", hdl->restr_set);
+    hdl->timers[MPIBIND_TIMER_RESTRICT] += timer_now() - start;
 
 #if VERBOSE >= 1
     PRINT("Restricted topology to %s with flags %lu\n",
 	  hdl->restr_set, flags);
 #endif
 
-    hwloc_bitmap_free(set);
+    hwloc_bitmap_free(set);
+  }
+
+  /* Same for the reserved cores */
+  if (hdl->resv_applied > 0 &&
+      (hdl->resv_ncores != hdl->resv_applied ||
+       hdl->resv_domain != hdl->resv_applied_domain ||
+       hdl->resv_end != hdl->resv_applied_end)) {
+    fprintf(stderr, "Error: Topology already has %d reserved cores "
+	    "per domain\n", hdl->resv_applied);
+    return 1;
+  }
+
+  /* User asked to reserve cores */
+  if (hdl->resv_ncores > 0 && hdl->resv_applied == 0) {
+    set = hwloc_bitmap_alloc();
+    if (reserve_cores(hdl->topo, hdl->resv_ncores, hdl->resv_domain,
+		      hdl->resv_end, set) != 0) {
+      hwloc_bitmap_free(set);
+      return 1;
+    }
+    /* Devices of the topology without reservation are stale */
+    release_devices(hdl);
+    hdl->resv_applied = hdl->resv_ncores;
+    hdl->resv_applied_domain = hdl->resv_domain;
+    hdl->resv_applied_end = hdl->resv_end;
+
+    start = timer_now();
+    hwloc_bitmap_andnot(set, hwloc_get_root_obj(hdl->topo)->cpuset, set);
+    if ( hwloc_topology_restrict(hdl->topo, set,
+				 HWLOC_RESTRICT_FLAG_REMOVE_CPULESS) )
+      PRINT("Warn: Failed to reserve %d cores per domain\n",
+	    hdl->resv_ncores);
+    hdl->timers[MPIBIND_TIMER_RESTRICT] += timer_now() - start;
+
+#if VERBOSE >= 1
+    char str[LONG_STR_SIZE];
+    hwloc_bitmap_list_snprintf(str, sizeof(str), set);
+    PRINT("Restricted topology to non-reserved PUs %s\n", str);
+#endif
+
+    hwloc_bitmap_free(set);
+  }
+
+  /* Discover I/O devices once per topology.
+     Devices of an imported mapping are replaced */
+  if (hdl->index == NULL) {
+    start = timer_now();
+    release_devices(hdl);
+    hdl->ndevs = discover_devices(hdl->topo, &hdl->devs);
+
+    /* Lookup tables used by the mapping functions */
+    hdl->index = topo_index_build(hdl->topo, hdl->devs, hdl->ndevs);
+    hdl->timers[MPIBIND_TIMER_DEVICES] += timer_now() - start;
+  }
+
+#if VERBOSE >=1
+  int i;
+  PRINT("Effective I/O devices: %d\n", hdl->ndevs);
+  for (i=0; i<hdl->ndevs; i++)
+    PRINT("[%d]: busid=%s smi=%d name=%s\n"
+	  "\tvendor=%s model=%s\n"
+	  "\tuuid=%s\n"
+	  "\tvendorid=0x%x ancestor=0x%" PRIu64 "\n",
+	  i, hdl->devs[i]->pci, hdl->devs[i]->smi, hdl->devs[i]->name,
+	  hdl->devs[i]->vendor, hdl->devs[i]->model,
+	  hdl->devs[i]->univ, hdl->devs[i]->vendor_id,
+	  hdl->devs[i]->ancestor->gp_index);
+#endif
+
+  return 0;
+}
+
+/*
+ * Release the mapping of a handle so that the handle can
+ * compute another mapping. Input parameters, the topology,
+ * and the discovered I/O devices are kept.
+ * mpibind() calls this function implicitly.
+ */
+int mpibind_reset(mpibind_t *hdl)
+{
+  if (hdl == NULL)
+    return 1;
+
+  hdl->nthreads = NULL;
+  hdl->cpus = NULL;
+  hdl->gpus = NULL;
+  hdl->mems = NULL;
+  hdl->nics = NULL;
+  hdl->cpus_usr = NULL;
+  hdl->gpus_usr = NULL;
+  hdl->nics_usr = NULL;
+  hdl->moved = NULL;
+
+  hdl->nvars = 0;
+  hdl->names = NULL;
+  hdl->env_vars = NULL;
+
+  hdl->gpus_done = NULL;
+  hdl->env_done = NULL;
+  hdl->thread_cpus = NULL;
+  hdl->thread_ncpus = NULL;
+
+  /* Keep the memory for the next mapping */
+  arena_reset(&hdl->arena);
+
+  return 0;
+}
+
+/*
+ * Allocate the outputs of a mapping of hdl->ntasks tasks
+ * with empty CPU, GPU, memory, and NIC sets. The bitmaps
+ * are kept across mappings.
+ */
+void alloc_mapping(mpibind_t *hdl)
+{
+  int i;
+
+  if (4*hdl->ntasks > hdl->nbitmaps) {
+    hdl->bitmaps = realloc(hdl->bitmaps,
+			   4*hdl->ntasks * sizeof(hwloc_bitmap_t));
+    for (i=hdl->nbitmaps; i<4*hdl->ntasks; i++)
+      hdl->bitmaps[i] = hwloc_bitmap_alloc();
+    hdl->nbitmaps = 4*hdl->ntasks;
+  }
+
+  hdl->nthreads = arena_alloc(&hdl->arena, hdl->ntasks * sizeof(int));
+  hdl->cpus = arena_alloc(&hdl->arena, hdl->ntasks * sizeof(hwloc_bitmap_t));
+  hdl->gpus = arena_alloc(&hdl->arena, hdl->ntasks * sizeof(hwloc_bitmap_t));
+  hdl->mems = arena_alloc(&hdl->arena, hdl->ntasks * sizeof(hwloc_bitmap_t));
+  hdl->nics = arena_alloc(&hdl->arena, hdl->ntasks * sizeof(hwloc_bitmap_t));
+  for (i=0; i<hdl->ntasks; i++) {
+    hdl->cpus[i] = hdl->bitmaps[4*i];
+    hdl->gpus[i] = hdl->bitmaps[4*i+1];
+    hdl->mems[i] = hdl->bitmaps[4*i+2];
+    hdl->nics[i] = hdl->bitmaps[4*i+3];
+    hwloc_bitmap_zero(hdl->cpus[i]);
+    hwloc_bitmap_zero(hdl->gpus[i]);
+    hwloc_bitmap_zero(hdl->mems[i]);
+    hwloc_bitmap_zero(hdl->nics[i]);
+  }
+}
+
+/*
+ * Populate the outputs derived from the CPU sets:
+ * hdl->cpus_usr, using a single block sized to the
+ * assigned CPUs, hdl->mems, from the topology
+ * index or, if there is none (imports), the topology,
+ * and hdl->nics (kept as is for imports) with their
+ * names in hdl->nics_usr.
+ */
+void complete_mapping(mpibind_t *hdl)
+{
+  int i, j, val, numa;
+  int *ptr;
+  char **names;
+  struct topo_index *idx = hdl->index;
+
+  for (i=0, j=0; i<hdl->ntasks; i++)
+    j += hwloc_bitmap_weight(hdl->cpus[i]);
+  hdl->cpus_usr = arena_alloc(&hdl->arena, hdl->ntasks * sizeof(int *));
+  ptr = arena_alloc(&hdl->arena, j * sizeof(int));
+  /* One pass over each cpuset: Walking a bitmap costs
+     as many words as the node has PUs */
+  for (i=0; i<hdl->ntasks; i++) {
+    hdl->cpus_usr[i] = ptr;
+    j = 0;
+    hwloc_bitmap_foreach_begin(val, hdl->cpus[i]) {
+      hdl->cpus_usr[i][j++] = val;
+      if (idx != NULL && val < idx->npus &&
+	  (numa = idx->pu_numa[val]) >= 0)
+	hwloc_bitmap_set(hdl->mems[i], idx->numas[numa]->os_index);
+    } hwloc_bitmap_foreach_end();
+    ptr += j;
+
+    if (idx == NULL && hdl->topo != NULL)
+      hwloc_cpuset_to_nodeset(hdl->topo, hdl->cpus[i], hdl->mems[i]);
+  }
+
+  if (idx != NULL)
+    nic_match(idx, hdl->devs, hdl->ndevs, hdl->ntasks,
+	      hdl->cpus, hdl->nics);
+
+  /* The names live in the devices, which are kept
+     until the next mapping */
+  for (i=0, j=0; i<hdl->ntasks; i++)
+    j += hwloc_bitmap_weight(hdl->nics[i]);
+  hdl->nics_usr = arena_alloc(&hdl->arena, hdl->ntasks * sizeof(char **));
+  names = arena_alloc(&hdl->arena, j * sizeof(char *));
+  for (i=0; i<hdl->ntasks; i++) {
+    hdl->nics_usr[i] = names;
+    hwloc_bitmap_foreach_begin(val, hdl->nics[i]) {
+      *names++ = hdl->devs[val]->name;
+    } hwloc_bitmap_foreach_end();
+  }
+}
+
+/*
+ * The number of objects of a given type whose
+ * CPUs intersect a set of CPUs.
+ */
+static
+int count_intersecting_objs(hwloc_topology_t topo, hwloc_obj_type_t type,
+			    hwloc_const_bitmap_t cpus)
+{
+  int n = 0;
+  hwloc_obj_t obj = NULL;
+
+  while ((obj = hwloc_get_next_obj_by_type(topo, type, obj)) != NULL)
+    if (hwloc_bitmap_intersects(obj->cpuset, cpus))
+      n++;
+
+  return n;
+}
+
+/*
+ * The fraction of the CPUs of a task that share an object
+ * of a given type (NUMA domain or L3 cache) with any of
+ * the task's GPUs. 'near' is scratch space.
+ */
+static
+double gpu_affinity(hwloc_topology_t topo, hwloc_obj_type_t type,
+		    struct device **devs, hwloc_const_bitmap_t cpus,
+		    hwloc_const_bitmap_t gpus, hwloc_bitmap_t near)
+{
+  int id;
+  hwloc_obj_t obj = NULL;
+
+  hwloc_bitmap_zero(near);
+  while ((obj = hwloc_get_next_obj_by_type(topo, type, obj)) != NULL) {
+    hwloc_bitmap_foreach_begin(id, gpus) {
+      if (devs[id]->ancestor != NULL &&
+	  hwloc_bitmap_intersects(obj->cpuset, devs[id]->ancestor->cpuset)) {
+	hwloc_bitmap_or(near, near, obj->cpuset);
+	break;
+      }
+    } hwloc_bitmap_foreach_end();
+  }
+
+  hwloc_bitmap_and(near, near, cpus);
+  return (double) hwloc_bitmap_weight(near) / hwloc_bitmap_weight(cpus);
+}
+
+/*
+ * The core of every PU of a topology without an index
+ * (see topo_index_build), indexed by the PU's OS index.
+ * Returns NULL on failure.
+ */
+static
+int* pu_core_map(hwloc_topology_t topo, int *npus)
+{
+  int core_depth, *pu_core;
+  hwloc_obj_t obj = NULL, core;
+
+  *npus = hwloc_bitmap_last(hwloc_get_root_obj(topo)->cpuset) + 1;
+  if (*npus < 0)
+    *npus = 0;
+  if ((pu_core = malloc((*npus + 1) * sizeof(int))) == NULL)
+    return NULL;
+  memset(pu_core, -1, (*npus + 1) * sizeof(int));
+
+  core_depth = mpibind_get_core_depth(topo);
+  while ((obj = hwloc_get_next_obj_by_type(topo, HWLOC_OBJ_PU,
+					   obj)) != NULL) {
+    core = hwloc_get_ancestor_obj_by_depth(topo, core_depth, obj);
+    if (core != NULL && obj->os_index < *npus)
+      pu_core[obj->os_index] = core->logical_index;
+  }
+
+  return pu_core;
+}
+
+/*
+ * Measure the quality of a mapping of 'ntasks' tasks given
+ * by their CPUs and GPUs (see mpibind_metrics_t). 'idx' is
+ * the index of the topology, or NULL if it was not built.
+ */
+static
+int mapping_metrics(hwloc_topology_t topo, struct topo_index *idx,
+		    struct device **devs, int ntasks, const int *weights,
+		    hwloc_bitmap_t *cpus, hwloc_bitmap_t *gpus,
+		    mpibind_metrics_t *m)
+{
+  int k, t, pu, ncores, npus_max, ngtasks=0, nl3tasks=0;
+  int npus, ngpus, w;
+  int *pu_core, *core_ntasks, *core_last;
+  double load, pu_max=0, pu_sum=0, gpu_max=0, gpu_sum=0;
+  double numa_sum=0, l3_sum=0;
+  hwloc_bitmap_t near;
+
+  if (idx != NULL) {
+    pu_core = idx->pu_core;
+    npus_max = idx->npus;
+  } else if ((pu_core = pu_core_map(topo, &npus_max)) == NULL)
+    return 1;
+  ncores = hwloc_get_nbobjs_by_depth(topo, mpibind_get_core_depth(topo));
+  if ((core_ntasks = calloc(2 * ncores + 1, sizeof(int))) == NULL) {
+    if (idx == NULL)
+      free(pu_core);
+    return 1;
+  }
+  core_last = core_ntasks + ncores;
+  near = hwloc_bitmap_alloc();
+
+  memset(m, 0, sizeof(mpibind_metrics_t));
+  m->ntasks = ntasks;
+  m->min_pus = m->min_gpus = INT_MAX;
+
+  for (t=0; t<ntasks; t++) {
+    npus = hwloc_bitmap_weight(cpus[t]);
+    ngpus = hwloc_bitmap_weight(gpus[t]);
+    w = (weights != NULL) ? weights[t] : 1;
+
+    /* Load balance */
+    if (npus < m->min_pus)
+      m->min_pus = npus;
+    if (npus > m->max_pus)
+      m->max_pus = npus;
+    if (ngpus < m->min_gpus)
+      m->min_gpus = ngpus;
+    if (ngpus > m->max_gpus)
+      m->max_gpus = ngpus;
+    load = (double) npus / w;
+    pu_sum += load;
+    if (load > pu_max)
+      pu_max = load;
+    load = (double) ngpus / w;
+    gpu_sum += load;
+    if (load > gpu_max)
+      gpu_max = load;
+
+    if (npus <= 0)
+      continue;
+
+    /* Locality of CPUs and GPUs */
+    if (ngpus > 0) {
+      numa_sum += gpu_affinity(topo, HWLOC_OBJ_NUMANODE, devs,
+			       cpus[t], gpus[t], near);
+      ngtasks++;
+      if (hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_L3CACHE) > 0) {
+	l3_sum += gpu_affinity(topo, HWLOC_OBJ_L3CACHE, devs,
+			       cpus[t], gpus[t], near);
+	nl3tasks++;
+      }
+    }
+
+    /* Boundaries */
+    if (count_intersecting_objs(topo, HWLOC_OBJ_NUMANODE, cpus[t]) > 1)
+      m->cross_numa++;
+    if (count_intersecting_objs(topo, HWLOC_OBJ_PACKAGE, cpus[t]) > 1)
+      m->cross_package++;
+    if (count_intersecting_objs(topo, HWLOC_OBJ_L3CACHE, cpus[t]) > 1)
+      m->cross_l3++;
+  }
+
+  if (ntasks > 0) {
+    m->pu_imbalance = (pu_sum > 0) ? pu_max * ntasks / pu_sum - 1 : 0;
+    m->gpu_imbalance = (gpu_sum > 0) ? gpu_max * ntasks / gpu_sum - 1 : 0;
+  } else
+    m->min_pus = m->min_gpus = 0;
+  m->gpu_numa_affinity = (ngtasks > 0) ? numa_sum / ngtasks : -1;
+  m->gpu_l3_affinity = (nl3tasks > 0) ? l3_sum / nl3tasks : -1;
+
+  /* SMT siblings assigned to different tasks: count the
+     tasks of every core with one pass over the PUs of each
+     task rather than testing every core against every task */
+  for (k=0; k<ncores; k++)
+    core_last[k] = -1;
+  for (t=0; t<ntasks; t++) {
+    hwloc_bitmap_foreach_begin(pu, cpus[t]) {
+      if (pu >= npus_max)
+	break;
+      if ((k = pu_core[pu]) >= 0 && core_last[k] != t) {
+	core_last[k] = t;
+	core_ntasks[k]++;
+      }
+    } hwloc_bitmap_foreach_end();
+  }
+  for (k=0; k<ncores; k++)
+    if (core_ntasks[k] > 1)
+      m->shared_cores++;
+  for (t=0; t<ntasks; t++) {
+    hwloc_bitmap_foreach_begin(pu, cpus[t]) {
+      if (pu >= npus_max)
+	break;
+      if ((k = pu_core[pu]) >= 0 && core_ntasks[k] > 1) {
+	m->shared_tasks++;
+	break;
+      }
+    } hwloc_bitmap_foreach_end();
+  }
+
+  hwloc_bitmap_free(near);
+  free(core_ntasks);
+  if (idx == NULL)
+    free(pu_core);
+
+  return 0;
+}
+
+/*
+ * A candidate mapping of the auto mode
+ */
+struct auto_candidate {
+  int greedy;
+  int llc;
+  int smt;
+};
+
+/* The auto mode evaluates no more than this many candidates
+   and, after this many nanoseconds, neither starts a candidate
+   nor measures the one it just mapped */
+#define AUTO_MAX_CANDIDATES 16
+#define AUTO_BUDGET_NS 4000000
+
+/*
+ * The cost of a mapping in the auto mode (lower is better):
+ * load imbalance, CPUs away from the tasks' GPUs, tasks
+ * crossing NUMA, package, and L3 boundaries, tasks sharing
+ * cores, and idle cores. Every term is between 0 and 1
+ * (imbalance as 1 - mean/max), and idle cores weigh the
+ * most so that locality is not obtained by leaving most
+ * of the node idle.
+ */
+static
+double mapping_cost(mpibind_metrics_t *m, int ncores_idle, int ncores)
+{
+  double cost;
+
+  cost = 1 - 1 / (1 + m->pu_imbalance);
+  cost += 1 - 1 / (1 + m->gpu_imbalance);
+  if (m->gpu_numa_affinity >= 0)
+    cost += 1 - m->gpu_numa_affinity;
+  if (m->gpu_l3_affinity >= 0)
+    cost += 0.5 * (1 - m->gpu_l3_affinity);
+  cost += (m->cross_numa + 0.5*m->cross_package + 0.25*m->cross_l3 +
+	   m->shared_tasks) / (double) m->ntasks;
+  cost += 4.0 * ncores_idle / ncores;
+
+  return cost;
+}
+
+/*
+ * Auto mode: Compute the mappings of several candidate
+ * parameters (greedy, L3-aware placement, and, if not given,
+ * the SMT level), starting with the parameters of the handle,
+ * and keep the mapping with the lowest cost. Parameters that
+ * make no difference on this node are not searched. Ties go
+ * to the earlier candidate. GPU optimization is left to the
+ * user: a CPU-optimized mapping may leave tasks without GPUs.
+ */
+static
+int distrib_auto(mpibind_t *hdl, int gpu_optim)
+{
+  int i, c, k, mask, nidle, hw_smt, ncand=0, best=-1;
+  int *nthreads;
+  double cost, best_cost=0;
+  uint64_t start = timer_now();
+  struct auto_candidate cand[AUTO_MAX_CANDIDATES];
+  struct topo_index *idx = hdl->index;
+  hwloc_bitmap_t used, *cpus, *gpus;
+  mpibind_metrics_t m;
+
+  /* Bit 0: greedy, bit 1: llc */
+  for (mask=0; mask<4; mask++) {
+    if (((mask & 1) && hdl->ntasks >= idx->nnumas) ||
+	((mask & 2) &&
+	 hwloc_get_nbobjs_by_type(hdl->topo, HWLOC_OBJ_L3CACHE) <= 0))
+      continue;
+    cand[ncand].greedy = (mask & 1) ? !hdl->greedy : hdl->greedy;
+    cand[ncand].llc = (mask & 2) ? !hdl->llc : hdl->llc;
+    cand[ncand].smt = hdl->smt;
+    ncand++;
+  }
+  hw_smt = get_smt_level(hdl->topo);
+  for (k=1; hdl->smt == 0 && k<=hw_smt && ncand<AUTO_MAX_CANDIDATES; k++) {
+    cand[ncand] = cand[0];
+    cand[ncand].smt = k;
+    ncand++;
+  }
+
+  /* The best mapping so far */
+  nthreads = malloc(hdl->ntasks * sizeof(int));
+  cpus = calloc(2 * hdl->ntasks, sizeof(hwloc_bitmap_t));
+  used = hwloc_bitmap_alloc();
+  if (nthreads == NULL || cpus == NULL || used == NULL)
+    goto out;
+  gpus = cpus + hdl->ntasks;
+  for (i=0; i<2*hdl->ntasks; i++)
+    if ((cpus[i] = hwloc_bitmap_alloc()) == NULL)
+      goto out;
+
+  /* The first candidate is always evaluated */
+  for (c=0; c<ncand && (c == 0 || timer_now() - start < AUTO_BUDGET_NS);
+       c++) {
+    for (i=0; i<hdl->ntasks; i++) {
+      hwloc_bitmap_zero(hdl->cpus[i]);
+      hwloc_bitmap_zero(hdl->gpus[i]);
+    }
+    if (mpibind_distrib(hdl->topo, idx, hdl->ntasks, hdl->in_nthreads,
+			cand[c].greedy, gpu_optim, cand[c].smt,
+			cand[c].llc, hdl->cpukinds, hdl->weights,
+			hdl->leader, hdl->leader_domain,
+			hdl->nthreads, hdl->cpus, hdl->gpus) != 0 ||
+	(c > 0 && timer_now() - start >= AUTO_BUDGET_NS) ||
+	mapping_metrics(hdl->topo, idx, hdl->devs, hdl->ntasks,
+			hdl->weights, hdl->cpus, hdl->gpus, &m) != 0)
+      continue;
+
+    hwloc_bitmap_zero(used);
+    for (i=0; i<hdl->ntasks; i++)
+      hwloc_bitmap_or(used, used, hdl->cpus[i]);
+    for (nidle=0, k=0; k<idx->ncores; k++)
+      if (!hwloc_bitmap_intersects(idx->core_pus[k], used))
+	nidle++;
+    cost = mapping_cost(&m, nidle, idx->ncores);
+
+#if VERBOSE >= 1
+    PRINT("Auto: greedy %d llc %d smt %d cost %.3f\n",
+	  cand[c].greedy, cand[c].llc, cand[c].smt, cost);
+#endif
+
+    if (best < 0 || cost < best_cost) {
+      best = c;
+      best_cost = cost;
+      memcpy(nthreads, hdl->nthreads, hdl->ntasks * sizeof(int));
+      for (i=0; i<hdl->ntasks; i++) {
+	hwloc_bitmap_copy(cpus[i], hdl->cpus[i]);
+	hwloc_bitmap_copy(gpus[i], hdl->gpus[i]);
+      }
+    }
+  }
+
+  if (best >= 0) {
+    memcpy(hdl->nthreads, nthreads, hdl->ntasks * sizeof(int));
+    for (i=0; i<hdl->ntasks; i++) {
+      hwloc_bitmap_copy(hdl->cpus[i], cpus[i]);
+      hwloc_bitmap_copy(hdl->gpus[i], gpus[i]);
+    }
+  }
+
+ out:
+  hwloc_bitmap_free(used);
+  for (i=0; cpus != NULL && i<2*hdl->ntasks; i++)
+    hwloc_bitmap_free(cpus[i]);
+  free(cpus);
+  free(nthreads);
+
+  return (best >= 0) ? 0 : 1;
+}
+
+/*
+ * A candidate placement of a surviving task for remap_tasks
+ */
+struct remap_pair {
+  int task;
+  int slot;
+  int gpus;     // GPUs in common with the previous mapping
+  int cpus;     // CPUs in common with the previous mapping
+  int diff;     // CPUs and GPUs not in common
+};
+
+static
+int compare_remap_pairs(const void *a, const void *b)
+{
+  const struct remap_pair *x = a, *y = b;
+
+  if (x->gpus != y->gpus)
+    return y->gpus - x->gpus;
+  if (x->cpus != y->cpus)
+    return y->cpus - x->cpus;
+  if (x->diff != y->diff)
+    return x->diff - y->diff;
+  /* Keep the order of the tasks if all else is equal */
+  if ((x->task == x->slot) != (y->task == y->slot))
+    return (y->task == y->slot) - (x->task == x->slot);
+  if (x->task != y->task)
+    return x->task - y->task;
+  return x->slot - y->slot;
+}
+
+/*
+ * Can a task take the place (slot) of another task?
+ * Not if the tasks have different weights or one
+ * of them is the leader, since their resources differ.
+ * This only rules out some pairs: The other tasks
+ * are still remapped among the slots compatible
+ * with them, e.g., tasks of the same weight.
+ */
+static
+int remap_compatible(mpibind_t *hdl, int task, int slot)
+{
+  if (hdl->weights != NULL && hdl->weights[task] != hdl->weights[slot])
+    return 0;
+  if (hdl->leader >= 0 && (task == hdl->leader) != (slot == hdl->leader))
+    return 0;
+
+  return 1;
+}
+
+/*
+ * Reorder a new mapping so that the tasks of the previous
+ * mapping (the surviving tasks) keep as much of their CPUs
+ * and GPUs as possible: Tasks take the place of the task
+ * of the new mapping they have the most in common with
+ * (GPUs first), greedily. The new mapping is only reordered,
+ * so the balance of the tasks is the same. Finally, set
+ * hdl->moved for each task.
+ * Return 0 on success and 1 otherwise (out of memory).
+ */
+static
+int remap_tasks(mpibind_t *hdl)
+{
+  int i, j, n, nsurv, npairs, ntasks = hdl->ntasks, rc = 1;
+  int *slot, *owner, *nthreads;
+  struct remap_pair *pairs;
+  hwloc_bitmap_t set, *cpus, *gpus;
+
+  nsurv = (hdl->nprev < ntasks) ? hdl->nprev : ntasks;
+  slot = malloc(ntasks * sizeof(int));
+  owner = malloc(ntasks * sizeof(int));
+  set = hwloc_bitmap_alloc();
+  pairs = malloc((size_t)nsurv * ntasks * sizeof(struct remap_pair));
+  nthreads = malloc(ntasks * sizeof(int));
+  cpus = malloc(ntasks * sizeof(hwloc_bitmap_t));
+  gpus = malloc(ntasks * sizeof(hwloc_bitmap_t));
+  if (slot == NULL || owner == NULL || set == NULL || pairs == NULL ||
+      nthreads == NULL || cpus == NULL || gpus == NULL ||
+      (hdl->moved = arena_alloc(&hdl->arena, ntasks * sizeof(int))) == NULL)
+    goto out;
+
+  for (i=0; i<ntasks; i++)
+    slot[i] = owner[i] = -1;
+
+  /* Rank the placements of the surviving tasks */
+  for (npairs=0, i=0; i<nsurv; i++)
+    for (j=0; j<ntasks; j++) {
+      if (!remap_compatible(hdl, i, j))
+	continue;
+      pairs[npairs].task = i;
+      pairs[npairs].slot = j;
+      hwloc_bitmap_and(set, hdl->prev_cpus[i], hdl->cpus[j]);
+      pairs[npairs].cpus = hwloc_bitmap_weight(set);
+      hwloc_bitmap_xor(set, hdl->prev_cpus[i], hdl->cpus[j]);
+      pairs[npairs].diff = hwloc_bitmap_weight(set);
+      pairs[npairs].gpus = 0;
+      if (hdl->prev_gpus != NULL) {
+	hwloc_bitmap_and(set, hdl->prev_gpus[i], hdl->gpus[j]);
+	pairs[npairs].gpus = hwloc_bitmap_weight(set);
+	hwloc_bitmap_xor(set, hdl->prev_gpus[i], hdl->gpus[j]);
+	pairs[npairs].diff += hwloc_bitmap_weight(set);
+      }
+      if (pairs[npairs].cpus > 0 || pairs[npairs].gpus > 0)
+	npairs++;
+    }
+  qsort(pairs, npairs, sizeof(struct remap_pair), compare_remap_pairs);
+
+  for (n=0; n<npairs; n++)
+    if (slot[pairs[n].task] < 0 && owner[pairs[n].slot] < 0) {
+      slot[pairs[n].task] = pairs[n].slot;
+      owner[pairs[n].slot] = pairs[n].task;
+    }
+
+  /* The other tasks take the places left in order */
+  for (i=0; i<ntasks; i++)
+    if (slot[i] < 0)
+      for (j=0; j<ntasks; j++)
+	if (owner[j] < 0 && remap_compatible(hdl, i, j)) {
+	  slot[i] = j;
+	  owner[j] = i;
+	  break;
+	}
+
+  /* Reorder the mapping */
+  for (i=0; i<ntasks; i++) {
+    nthreads[i] = hdl->nthreads[slot[i]];
+    cpus[i] = hdl->cpus[slot[i]];
+    gpus[i] = hdl->gpus[slot[i]];
+  }
+  memcpy(hdl->nthreads, nthreads, ntasks * sizeof(int));
+  memcpy(hdl->cpus, cpus, ntasks * sizeof(hwloc_bitmap_t));
+  memcpy(hdl->gpus, gpus, ntasks * sizeof(hwloc_bitmap_t));
+
+  for (i=0; i<ntasks; i++)
+    if (i >= hdl->nprev)
+      hdl->moved[i] = MPIBIND_TASK_NEW;
+    else if (hwloc_bitmap_isequal(hdl->prev_cpus[i], hdl->cpus[i]) &&
+	     (hdl->prev_gpus == NULL ||
+	      hwloc_bitmap_isequal(hdl->prev_gpus[i], hdl->gpus[i])))
+      hdl->moved[i] = MPIBIND_TASK_UNCHANGED;
+    else
+      hdl->moved[i] = MPIBIND_TASK_MOVED;
+  rc = 0;
+
+ out:
+  free(gpus);
+  free(cpus);
+  free(nthreads);
+  free(pairs);
+  hwloc_bitmap_free(set);
+  free(owner);
+  free(slot);
+
+  return rc;
+}
+
+/*
+ * Process the input and call the main mapping function.
+ * Input:
+ *   ntasks: number of tasks.
+ *   nthreads: (optional) number of threads per task.
+ *             Default value should be 0, in which case
+ *             mpibind calculates the nthreads per task.
+ *   greedy: (optional) Use the whole node when using a single task.
+ *           Default value should be 1, in which case
+ *           1-task jobs span the whole node.
+ *   gpu_optim: (optional) optimize placement based on GPUs.
+ *              If 0, optimize based on memory and CPUs.
+ *              Default value should be 1 if allocation has GPUs
+ *              and 0 otherwise.
+ *   smt: (optional) map app workers to the specified SMT level.
+ *        Default value should be 0, in which case the matching
+ *        level is Core, or SMT-k if enough threads are given.
+ *        If smt>0 workers are always mapped to the specified SMT
+ *        level regardless of the given number of threads.
+ * Output:
+ *   nthreads, cpus, gpus.
+ * Returns 0 on success.
+ */
+int mpibind(mpibind_t *hdl)
+{
+  int gpu_optim, hit=0, rc=0;
+  uint64_t start;
+  struct map_key key = { { 0, 0 } };
+
+  /* Release the previous mapping, if any */
+  mpibind_reset(hdl);
+
+  /* Input parameters check */
+  if (hdl->ntasks <= 0 || hdl->in_nthreads < 0) {
+    fprintf(stderr, "Error: ntasks %d or nthreads %d out of range\n",
+	    hdl->ntasks, hdl->in_nthreads);
+    return 1;
+  }
+
+  if (hdl->weights != NULL && hdl->nweights != hdl->ntasks) {
+    fprintf(stderr, "Error: %d task weights for %d tasks\n",
+	    hdl->nweights, hdl->ntasks);
+    return 1;
+  }
+
+  if (hdl->leader >= hdl->ntasks) {
+    fprintf(stderr, "Error: Leader task %d out of range\n", hdl->leader);
+    return 1;
   }
 
-  /* Discover I/O devices */
-  hdl->devs = calloc(MAX_IO_DEVICES, sizeof(struct device *));
-  for (i=0; i<MAX_IO_DEVICES; i++)
-    hdl->devs[i] = NULL;
-  hdl->ndevs = discover_devices(hdl->topo, hdl->devs, MAX_IO_DEVICES);
+  if (prepare_topology(hdl) != 0)
+    return 1;
 
-#if VERBOSE >=1
-  PRINT("Effective I/O devices: %d\n", hdl->ndevs);
-  for (i=0; i<hdl->ndevs; i++)
-    PRINT("[%d]: busid=%s smi=%d name=%s\n"
-	  "\tvendor=%s model=%s\n"
-	  "\tuuid=%s\n"
-	  "\tvendorid=0x%x ancestor=0x%" PRIu64 "\n",
-	  i, hdl->devs[i]->pci, hdl->devs[i]->smi, hdl->devs[i]->name,
-	  hdl->devs[i]->vendor, hdl->devs[i]->model,
-	  hdl->devs[i]->univ, hdl->devs[i]->vendor_id,
-	  hdl->devs[i]->ancestor->gp_index);
-#endif
+  if (hdl->smt < 0 || hdl->smt > get_smt_level(hdl->topo)) {
+    fprintf(stderr, "Error: SMT parameter %d out of range\n",
+	    hdl->smt);
+    return 1;
+  }
 
   /* If there's no GPUs, mapping should be CPU-guided */
   gpu_optim = ( get_num_gpus(hdl->devs, hdl->ndevs) ) ? 1 : 0;
   gpu_optim &= hdl->gpu_optim;
 
   /* Allocate space to store the resulting mapping */
-  hdl->nthreads = calloc(hdl->ntasks, sizeof(int));
-  hdl->cpus = calloc(hdl->ntasks, sizeof(hwloc_bitmap_t));
-  hdl->gpus = calloc(hdl->ntasks, sizeof(hwloc_bitmap_t));
-  for (i=0; i<hdl->ntasks; i++) {
-    hdl->cpus[i] = hwloc_bitmap_alloc();
-    hdl->gpus[i] = hwloc_bitmap_alloc();
-  }
+  alloc_mapping(hdl);
 
 #if VERBOSE >= 1
   PRINT("Input: tasks %d threads %d greedy %d smt %d\n",
@@ -663,23 +2275,49 @@ int mpibind(mpibind_t *hdl)
 	get_gpu_vendor(hdl->devs, hdl->ndevs));
 #endif
 
+  /* Reuse a previous mapping if the topology and
+     the input parameters have not changed */
+  start = timer_now();
+  if (hdl->map_cache) {
+    key = map_cache_key(hdl->topo, hdl->devs, hdl->ndevs,
+			hdl->ntasks, hdl->in_nthreads,
+			hdl->greedy, gpu_optim, hdl->smt, hdl->llc,
+			hdl->cpukinds, hdl->auto_map, hdl->weights,
+			hdl->leader, hdl->leader_domain);
+    hit = !map_cache_lookup(key, hdl->topo, hdl->ndevs,
+			    hdl->map_cache_file, hdl->ntasks,
+			    hdl->nthreads, hdl->cpus, hdl->gpus);
+  }
+
   /* Calculate the mapping.
      I could pass the mpibind handle, but using explicit
      parameters for now. */
-  rc = mpibind_distrib(hdl->topo, hdl->devs, hdl->ndevs,
-		       hdl->ntasks, hdl->in_nthreads,
-		       hdl->greedy, gpu_optim, hdl->smt,
-		       hdl->nthreads, hdl->cpus, hdl->gpus);
+  if (!hit) {
+    if (hdl->auto_map)
+      rc = distrib_auto(hdl, gpu_optim);
+    else
+      rc = mpibind_distrib(hdl->topo, hdl->index,
+			   hdl->ntasks, hdl->in_nthreads,
+			   hdl->greedy, gpu_optim, hdl->smt, hdl->llc,
+			   hdl->cpukinds, hdl->weights,
+			   hdl->leader, hdl->leader_domain,
+			   hdl->nthreads, hdl->cpus, hdl->gpus);
+
+    if (rc == 0 && hdl->map_cache &&
+	map_cache_store(key, hdl->map_cache_file, hdl->ntasks,
+			hdl->nthreads, hdl->cpus, hdl->gpus))
+      PRINT("WARN: Failed to save mapping in %s\n",
+	    (hdl->map_cache_file != NULL) ?
+	    hdl->map_cache_file : "the mapping cache");
+  }
+
+  /* Move as few of the previous tasks as possible */
+  if (rc == 0 && hdl->nprev > 0)
+    rc = remap_tasks(hdl);
 
   /* Finally, populate hdl->cpus_usr */
-  hdl->cpus_usr = calloc(hdl->ntasks, sizeof(int *));
-  for (i=0; i<hdl->ntasks; i++) {
-    hdl->cpus_usr[i] = calloc(MAX_CPUS_PER_TASK, sizeof(int));
-    j = 0;
-    hwloc_bitmap_foreach_begin(val, hdl->cpus[i]) {
-      hdl->cpus_usr[i][j++] = val;
-    } hwloc_bitmap_foreach_end();
-  }
+  complete_mapping(hdl);
+  hdl->timers[MPIBIND_TIMER_DISTRIB] += timer_now() - start;
 
   /* Don't destroy the topology, because the caller may
      need it to parse the resulting cpu/gpu bitmaps */
@@ -688,6 +2326,317 @@ int mpibind(mpibind_t *hdl)
   return rc;
 }
 
+/*
+ * Make room for 'need' more elements in a sweep column.
+ * Columns are indexed by int (see mpibind_sweep_t).
+ * Return 0 on success and 1 otherwise (the column is kept).
+ */
+static
+int sweep_grow(int **col, size_t *cap, int used, int need)
+{
+  size_t size = *cap;
+  int *tmp;
+
+  if (need > INT_MAX - used)
+    return 1;
+  if ((size_t)(used + need) <= size)
+    return 0;
+
+  if (size == 0)
+    size = 1;
+  while ((size_t)(used + need) > size)
+    size *= 2;
+
+  if (size > SIZE_MAX / sizeof(int) ||
+      (tmp = realloc(*col, size * sizeof(int))) == NULL)
+    return 1;
+
+  *col = tmp;
+  *cap = size;
+  return 0;
+}
+
+/*
+ * Compute the mappings of a range of task counts and SMT
+ * levels. The topology, the I/O devices, and the index
+ * (NUMA domains, CPU and GPU weights, core cpusets) are
+ * prepared once and shared by all of the mappings.
+ */
+mpibind_sweep_t* mpibind_sweep(mpibind_t *hdl,
+			       int min_ntasks, int max_ntasks,
+			       const int *smt, int nsmt)
+{
+  int i, k, n, p, t, val, hw_smt, gpu_optim;
+  int nper, ncpus, ngpus;
+  int *nthreads = NULL;
+  size_t ntotal, cap_cpus, cap_gpus;
+  hwloc_bitmap_t *cpus = NULL, *gpus = NULL;
+  mpibind_sweep_t *sw;
+
+  if (hdl == NULL || smt == NULL || nsmt <= 0 ||
+      min_ntasks <= 0 || max_ntasks < min_ntasks ||
+      hdl->in_nthreads < 0) {
+    fprintf(stderr, "Error: Sweep parameters out of range\n");
+    return NULL;
+  }
+
+  /* Points and tasks are indexed by int */
+  nper = max_ntasks - min_ntasks + 1;
+  ntotal = (size_t)nper * ((size_t)min_ntasks + max_ntasks) / 2;
+  if (nper > INT_MAX / nsmt || ntotal > (INT_MAX - 1) / nsmt) {
+    fprintf(stderr, "Error: Sweep is too large\n");
+    return NULL;
+  }
+  ntotal *= nsmt;
+
+  if (prepare_topology(hdl) != 0)
+    return NULL;
+
+  hw_smt = get_smt_level(hdl->topo);
+
+  /* If there's no GPUs, mapping should be CPU-guided */
+  gpu_optim = ( get_num_gpus(hdl->devs, hdl->ndevs) ) ? 1 : 0;
+  gpu_optim &= hdl->gpu_optim;
+
+  if ((sw = calloc(1, sizeof(mpibind_sweep_t))) == NULL)
+    goto nomem;
+  sw->npoints = nsmt * nper;
+  sw->ntasks = malloc(sw->npoints * sizeof(int));
+  sw->smt = malloc(sw->npoints * sizeof(int));
+  sw->rc = malloc(sw->npoints * sizeof(int));
+  sw->offset = malloc(sw->npoints * sizeof(int));
+
+  sw->ntotal = ntotal;
+  sw->nthreads = calloc(ntotal, sizeof(int));
+  sw->cpu_start = malloc((ntotal+1) * sizeof(int));
+  sw->gpu_start = malloc((ntotal+1) * sizeof(int));
+
+  /* Tasks of a point usually do not share CPUs.
+     If that does not fit, start small and grow */
+  if ((size_t)hdl->index->npus <= SIZE_MAX / sizeof(int) / sw->npoints)
+    cap_cpus = (size_t)sw->npoints * hdl->index->npus;
+  else
+    cap_cpus = ntotal;
+  cap_gpus = ntotal;
+  sw->cpu_ids = malloc(cap_cpus * sizeof(int));
+  sw->gpu_ids = malloc(cap_gpus * sizeof(int));
+
+  /* Scratch space for one mapping, reused across points */
+  nthreads = malloc(max_ntasks * sizeof(int));
+  cpus = calloc(max_ntasks, sizeof(hwloc_bitmap_t));
+  gpus = calloc(max_ntasks, sizeof(hwloc_bitmap_t));
+
+  if (sw->ntasks == NULL || sw->smt == NULL || sw->rc == NULL ||
+      sw->offset == NULL || sw->nthreads == NULL ||
+      sw->cpu_start == NULL || sw->gpu_start == NULL ||
+      sw->cpu_ids == NULL || sw->gpu_ids == NULL ||
+      nthreads == NULL || cpus == NULL || gpus == NULL)
+    goto nomem;
+
+  for (i=0; i<max_ntasks; i++) {
+    cpus[i] = hwloc_bitmap_alloc();
+    gpus[i] = hwloc_bitmap_alloc();
+    if (cpus[i] == NULL || gpus[i] == NULL)
+      goto nomem;
+  }
+
+  p = t = ncpus = ngpus = 0;
+  for (k=0; k<nsmt; k++)
+    for (n=min_ntasks; n<=max_ntasks; n++, p++) {
+      sw->ntasks[p] = n;
+      sw->smt[p] = smt[k];
+      sw->offset[p] = t;
+
+      if (smt[k] < 0 || smt[k] > hw_smt)
+	sw->rc[p] = 1;
+      else {
+	for (i=0; i<n; i++) {
+	  hwloc_bitmap_zero(cpus[i]);
+	  hwloc_bitmap_zero(gpus[i]);
+	}
+	sw->rc[p] = mpibind_distrib(hdl->topo, hdl->index,
+				    n, hdl->in_nthreads,
+				    hdl->greedy, gpu_optim, smt[k], hdl->llc,
+				    hdl->cpukinds, NULL, -1, 0,
+				    nthreads, cpus, gpus);
+      }
+
+      /* Tasks of a failed point have no resources */
+      for (i=0; i<n; i++, t++) {
+	sw->cpu_start[t] = ncpus;
+	sw->gpu_start[t] = ngpus;
+	if (sw->rc[p] != 0)
+	  continue;
+
+	sw->nthreads[t] = nthreads[i];
+
+	if (sweep_grow(&sw->cpu_ids, &cap_cpus, ncpus,
+		       hwloc_bitmap_weight(cpus[i])) != 0)
+	  goto nomem;
+	hwloc_bitmap_foreach_begin(val, cpus[i]) {
+	  sw->cpu_ids[ncpus++] = val;
+	} hwloc_bitmap_foreach_end();
+
+	if (sweep_grow(&sw->gpu_ids, &cap_gpus, ngpus,
+		       hwloc_bitmap_weight(gpus[i])) != 0)
+	  goto nomem;
+	hwloc_bitmap_foreach_begin(val, gpus[i]) {
+	  sw->gpu_ids[ngpus++] = val;
+	} hwloc_bitmap_foreach_end();
+      }
+    }
+  sw->cpu_start[t] = ncpus;
+  sw->gpu_start[t] = ngpus;
+
+#if VERBOSE >= 1
+  PRINT("Sweep: points %d tasks %zu cpus %d gpus %d\n",
+	sw->npoints, sw->ntotal, ncpus, ngpus);
+#endif
+
+ out:
+  for (i=0; cpus != NULL && gpus != NULL && i<max_ntasks; i++) {
+    hwloc_bitmap_free(cpus[i]);
+    hwloc_bitmap_free(gpus[i]);
+  }
+  free(cpus);
+  free(gpus);
+  free(nthreads);
+
+  return sw;
+
+ nomem:
+  fprintf(stderr, "Error: Out of memory for the sweep\n");
+  mpibind_sweep_free(sw);
+  sw = NULL;
+  goto out;
+}
+
+void mpibind_sweep_free(mpibind_sweep_t *sw)
+{
+  if (sw == NULL)
+    return;
+
+  free(sw->ntasks);
+  free(sw->smt);
+  free(sw->rc);
+  free(sw->offset);
+  free(sw->nthreads);
+  free(sw->cpu_start);
+  free(sw->cpu_ids);
+  free(sw->gpu_start);
+  free(sw->gpu_ids);
+  free(sw);
+}
+
+/*
+ * Get the time spent by a handle in each phase.
+ */
+int mpibind_get_timers(mpibind_t *handle, double *usecs)
+{
+  int i;
+
+  if (handle == NULL || usecs == NULL)
+    return 1;
+
+  for (i=0; i<MPIBIND_NUM_TIMERS; i++)
+    usecs[i] = handle->timers[i] / 1e3;
+
+  return 0;
+}
+
+/*
+ * Print the phase timers to a string.
+ */
+int mpibind_timers_snprint(char *buf, size_t size,
+			   mpibind_t *handle)
+{
+  int i, nc=0;
+  double usecs[MPIBIND_NUM_TIMERS];
+  const char *names[] = {
+    "load", "restrict", "devices", "distrib", "env_vars", "apply"
+  };
+
+  if (mpibind_get_timers(handle, usecs) != 0)
+    return -1;
+
+  nc += snprintf(buf+nc, size-nc, "mpibind: usecs");
+  for (i=0; i<MPIBIND_NUM_TIMERS && nc < size; i++)
+    nc += snprintf(buf+nc, size-nc, " %s %.1f", names[i], usecs[i]);
+
+  return nc;
+}
+
+
+/*
+ * Measure the quality of a mapping: the balance of PUs and
+ * GPUs across tasks, the locality of the tasks' CPUs to
+ * their GPUs, the tasks crossing NUMA, package, and L3
+ * boundaries, and the cores shared by more than one task.
+ */
+int mpibind_get_metrics(mpibind_t *handle, mpibind_metrics_t *metrics)
+{
+  if (handle == NULL || handle->cpus == NULL ||
+      handle->topo == NULL || metrics == NULL)
+    return 1;
+
+  return mapping_metrics(handle->topo, handle->index, handle->devs,
+			 handle->ntasks, handle->weights, handle->cpus,
+			 handle->gpus, metrics);
+}
+
+/*
+ * Print the quality metrics of a mapping to a string.
+ */
+int mpibind_metrics_snprint(char *buf, size_t size,
+			    mpibind_t *handle)
+{
+  mpibind_metrics_t m;
+
+  if (mpibind_get_metrics(handle, &m) != 0)
+    return -1;
+
+  return snprintf(buf, size, "mpibind: metrics tasks %d"
+		  " pus %d-%d imbalance %.2f gpus %d-%d imbalance %.2f"
+		  " gpu_affinity numa %.2f l3 %.2f"
+		  " crossing numa %d package %d l3 %d"
+		  " smt_shared cores %d tasks %d",
+		  m.ntasks, m.min_pus, m.max_pus, m.pu_imbalance,
+		  m.min_gpus, m.max_gpus, m.gpu_imbalance,
+		  m.gpu_numa_affinity, m.gpu_l3_affinity,
+		  m.cross_numa, m.cross_package, m.cross_l3,
+		  m.shared_cores, m.shared_tasks);
+}
+
+/*
+ * Get the number of mapping cache hits and misses
+ * in this process.
+ */
+void mpibind_get_map_cache_stats(int *hits, int *misses)
+{
+  map_cache_stats(hits, misses);
+}
+
+/*
+ * Get the memory used by the outputs of a handle: the number
+ * of allocations, the number of chunks obtained from the
+ * system, and the number of bytes in those chunks.
+ */
+int mpibind_get_mem_stats(mpibind_t *handle, int *nallocs,
+			  int *nchunks, size_t *nbytes)
+{
+  if (handle == NULL)
+    return 1;
+
+  if (nallocs != NULL)
+    *nallocs = handle->arena.nallocs;
+  if (nchunks != NULL)
+    *nchunks = handle->arena.nchunks;
+  if (nbytes != NULL)
+    *nbytes = handle->arena.reserved;
+
+  return 0;
+}
+
 /*
  * Pop 'ncpus' CPUs from the assigned CPUs of a particular task.
  * The main 'mpibind' function has to be called before calling
@@ -695,7 +2644,7 @@ int mpibind(mpibind_t *hdl)
  */
 int mpibind_pop_cpus_ptask(mpibind_t *handle, int taskid, int ncpus)
 {
-  if (handle == NULL ||
+  if (handle == NULL || handle->cpus == NULL ||
       taskid < 0 || taskid >= handle->ntasks ||
       ncpus < 1)
     return -1;
@@ -734,15 +2683,15 @@ int mpibind_pop_cpus_ptask(mpibind_t *handle, int taskid, int ncpus)
  */
 int mpibind_pop_cores_ptask(mpibind_t *handle, int taskid, int ncores)
 {
-  if (handle == NULL ||
+  if (handle == NULL || handle->cpus == NULL ||
       taskid < 0 || taskid >= handle->ntasks ||
       ncores < 1)
     return -1;
 
   int i, pu, val;
+  hwloc_const_bitmap_t core;
   hwloc_bitmap_t cpuset = handle->cpus[taskid];
   int weight = hwloc_bitmap_weight(cpuset);
-  hwloc_topology_t topo = mpibind_get_topology(handle);
 
   if (weight <= ncores) {
     fprintf(stderr, "mpibind_pop_cores_ptask: "
@@ -754,7 +2703,13 @@ int mpibind_pop_cores_ptask(mpibind_t *handle, int taskid, int ncores)
   /* Update cpus */
   for (i=0; i<ncores; i++) {
     pu = hwloc_bitmap_first(cpuset);
-    hwloc_bitmap_andnot(cpuset, cpuset, get_core_cpuset(topo, pu));
+    /* Imported mappings have no index. Without a
+       topology either, each PU is a core */
+    core = get_core_cpuset(handle->topo, handle->index, pu);
+    if (core != NULL)
+      hwloc_bitmap_andnot(cpuset, cpuset, core);
+    else
+      hwloc_bitmap_clr(cpuset, pu);
   }
 
   /* Update cpus_usr */
@@ -769,44 +2724,50 @@ int mpibind_pop_cores_ptask(mpibind_t *handle, int taskid, int ncores)
   return 0;
 }
 
+/*
+ * The part of a buffer from position 'nc' on, as the
+ * buffer and size arguments of snprintf-like functions.
+ * Past the end of the buffer, nothing is written.
+ */
+#define BUF_REST(buf, size, nc)					\
+  ((size_t)(nc) < (size) ? (buf)+(nc) : NULL),			\
+  ((size_t)(nc) < (size) ? (size)-(nc) : 0)
+
 /*
  * Print the mapping for a given task to a string.
+ * Like snprintf, return the number of characters of the
+ * whole line, which may be 'size' or more if truncated.
  */
 int mpibind_mapping_ptask_snprint(char *buf, size_t size,
                                   mpibind_t *handle, int taskid)
 {
-  if (handle == NULL || taskid < 0 || taskid >= handle->ntasks)
+  if (handle == NULL || handle->cpus == NULL ||
+      taskid < 0 || taskid >= handle->ntasks)
     return -1;
 
   int j, nc=0;
   /* The number of threads */
-  nc += snprintf(buf+nc, size-nc, "mpibind: task %3d nths %2d gpus ",
+  nc += snprintf(BUF_REST(buf, size, nc), "mpibind: task %3d nths %2d gpus ",
                  taskid, handle->nthreads[taskid]);
 
   /* The GPUs */
   if (handle->gpus_usr == NULL) {
     /* The user did not specify the type of IDs to use:
        Use the mpibind IDs */
-    if (size <= nc)
-      return nc;
-    nc += hwloc_bitmap_list_snprintf(buf+nc, size-nc, handle->gpus[taskid]);
+    nc += hwloc_bitmap_list_snprintf(BUF_REST(buf, size, nc),
+				     handle->gpus[taskid]);
   } else {
     /* Use the user-specified IDs (stored in gpus_usr) */
-    for (j=0; j<hwloc_bitmap_weight(handle->gpus[taskid]); j++) {
-      if (size <= nc)
-	return nc;
-      nc += snprintf(buf+nc, size-nc, "%s,", handle->gpus_usr[taskid][j]);
-    }
-    if (buf[nc-1] == ',')
-      nc--;
+    complete_task(handle, taskid);
+    for (j=0; j<hwloc_bitmap_weight(handle->gpus[taskid]); j++)
+      nc += snprintf(BUF_REST(buf, size, nc), (j == 0) ? "%s" : ",%s",
+		     handle->gpus_usr[taskid][j]);
   }
 
   /* The CPUs */
-  if (size <= nc)
-    return nc;
-  nc += snprintf(buf+nc, size-nc, " cpus ");
-  if (size > nc)
-    nc += hwloc_bitmap_list_snprintf(buf+nc, size-nc, handle->cpus[taskid]);
+  nc += snprintf(BUF_REST(buf, size, nc), " cpus ");
+  nc += hwloc_bitmap_list_snprintf(BUF_REST(buf, size, nc),
+				   handle->cpus[taskid]);
 
 #if DEBUG >= 1
   fprintf(OUT_STREAM, "mapping_ptask: task=%d size=%lu nc=%d\n",
@@ -817,36 +2778,115 @@ int mpibind_mapping_ptask_snprint(char *buf, size_t size,
 }
 
 /*
- * Print the mapping to a string.
+ * Write the mapping through 'write_fn', one line per task
+ * (without the newline character). A line is as long as it
+ * needs to be. Writing stops if 'write_fn' returns non-zero.
  */
-int mpibind_mapping_snprint(char *buf, size_t size,
-                            mpibind_t *handle)
+int mpibind_mapping_write(mpibind_t *handle,
+			  mpibind_write_fn write_fn, void *arg)
 {
-  if (handle == NULL)
-    return -1;
+  int i, len, rc=0;
+  size_t size = LONG_STR_SIZE;
+  char *line;
 
-  int i, nc=0;
+  if (handle == NULL || handle->cpus == NULL || write_fn == NULL)
+    return 1;
 
-  for (i=0; i<handle->ntasks; i++) {
-    if (size <= nc) {
-      terminate_str(buf, size);
-      return nc;
-    }
-    nc += mpibind_mapping_ptask_snprint(buf+nc, size-nc, handle, i);
+  if ((line = malloc(size)) == NULL)
+    return 1;
+
+  for (i=0; i<handle->ntasks && rc == 0; i++) {
+    len = mpibind_mapping_ptask_snprint(line, size, handle, i);
 
-    if (size <= nc) {
-      terminate_str(buf, size);
-      return nc;
+    /* Grow the line to fit this task */
+    if (len >= size) {
+      size = len + 1;
+      free(line);
+      if ((line = malloc(size)) == NULL)
+	return 1;
+      mpibind_mapping_ptask_snprint(line, size, handle, i);
     }
-    nc += snprintf(buf+nc, size-nc, "\n");
 
-    // snprintf writes the terminating null byte '\0'
-    // A return value of size or more means the output was truncated
-    // Debug:
-    // fprintf(stderr, "mapping: task=%d size=%lu nc=%d\n", i, size, nc);
+    rc = write_fn(line, arg);
   }
 
-  return nc;
+  free(line);
+
+  return rc;
+}
+
+static
+int write_to_stream(const char *line, void *arg)
+{
+  return (fprintf((FILE *)arg, "%s\n", line) < 0);
+}
+
+/*
+ * Print the mapping to a stream.
+ */
+int mpibind_mapping_fprint(FILE *stream, mpibind_t *handle)
+{
+  if (stream == NULL)
+    return 1;
+
+  return mpibind_mapping_write(handle, write_to_stream, stream);
+}
+
+/*
+ * A string being written by mpibind_mapping_snprint
+ */
+struct str_writer {
+  char *buf;
+  size_t size;
+  int nc;        // Characters of the whole output
+  int full;      // Output does not fit in buf
+};
+
+/*
+ * Append a line to the string. Only whole lines are kept:
+ * The first line that does not fit is replaced
+ * with [...] if there's space.
+ */
+static
+int write_to_str(const char *line, void *arg)
+{
+  struct str_writer *str = arg;
+  int len = strlen(line);
+
+  if (!str->full && str->nc + len + 1 < str->size) {
+    memcpy(str->buf + str->nc, line, len);
+    str->buf[str->nc + len] = '\n';
+    str->buf[str->nc + len + 1] = '\0';
+  } else if (!str->full) {
+    str->full = 1;
+    if (str->size - str->nc > 6)
+      snprintf(str->buf + str->nc, str->size - str->nc, "[...]\n");
+  }
+
+  str->nc += len + 1;
+
+  return 0;
+}
+
+/*
+ * Print the mapping to a string.
+ * Like snprintf, return the number of characters of the
+ * whole mapping, which may be 'size' or more if truncated.
+ */
+int mpibind_mapping_snprint(char *buf, size_t size,
+                            mpibind_t *handle)
+{
+  struct str_writer str = { buf, size, 0, (size == 0) };
+
+  if (handle == NULL || handle->cpus == NULL)
+    return -1;
+
+  if (size > 0)
+    buf[0] = '\0';
+
+  mpibind_mapping_write(handle, write_to_str, &str);
+
+  return str.nc;
 }
 
 /*
@@ -854,12 +2894,8 @@ int mpibind_mapping_snprint(char *buf, size_t size,
  */
 void mpibind_mapping_print(mpibind_t *handle)
 {
-  if (handle == NULL)
-    return;
-
-  char str[handle->ntasks * LONG_STR_SIZE];
-  mpibind_mapping_snprint(str, sizeof(str), handle);
-  printf("%s\n", str);
+  if (mpibind_mapping_fprint(stdout, handle) == 0)
+    printf("\n");
 }
 
 /*
@@ -871,44 +2907,16 @@ void mpibind_mapping_print(mpibind_t *handle)
  */
 int mpibind_set_gpu_ids(mpibind_t *handle, int id_type)
 {
-  int val, i, j, ngpus;
-
-  if (handle == NULL ||
+  if (handle == NULL || handle->gpus == NULL ||
       (id_type != MPIBIND_ID_NAME &&
       id_type != MPIBIND_ID_PCIBUS &&
       id_type != MPIBIND_ID_SMI &&
       id_type != MPIBIND_ID_UNIV))
     return 1;
 
-  /* If space has not been allocated, allocate space
-     to store GPU mapping. Space should be allocated
-     only once */
-  if (handle->gpus_usr == NULL) {
-    handle->gpus_usr = calloc(handle->ntasks, sizeof(char **));
-    for (i=0; i<handle->ntasks; i++) {
-      ngpus = hwloc_bitmap_weight(handle->gpus[i]);
-      handle->gpus_usr[i] = calloc(ngpus, sizeof(char *));
-      for (j=0; j<ngpus; j++)
-        /* UUID_LEN is the largest size */
-        handle->gpus_usr[i][j] = calloc(UUID_LEN, sizeof(char));
-    }
-  }
-
-  for (i=0; i<handle->ntasks; i++) {
-    j = 0;
-    hwloc_bitmap_foreach_begin(val, handle->gpus[i]) {
-      device_key_snprint(handle->gpus_usr[i][j],
-        UUID_LEN, handle->devs[val], id_type);
-      j++;
-	  } hwloc_bitmap_foreach_end();
-  }
-
-#if VERBOSE >= 2
-  for (i=0; i<handle->ntasks; i++)
-    for (j=0; j<hwloc_bitmap_weight(handle->gpus[i]); j++)
-      PRINT("Task[%d] GPU[%d]: %s\n", i, j,
-	    handle->gpus_usr[i][j]);
-#endif
+  pthread_mutex_lock(&handle->lock);
+  set_gpu_ids(handle, id_type);
+  pthread_mutex_unlock(&handle->lock);
 
   return 0;
 }
@@ -920,6 +2928,9 @@ int mpibind_set_gpu_ids(mpibind_t *handle, int id_type)
  * OMP_NUM_THREADS
  * OMP_PLACES --comma separated, each item in curly braces.
  * OMP_PROC_BIND --spread
+ * UCX_NET_DEVICES --comma separated, e.g., mlx5_0:1
+ * FI_CXI_DEVICE_NAME --comma separated, e.g., cxi0
+ *   (only on nodes with NICs of that kind)
  *
  * Todo: Use UUIDs instead of GPU indices to restrict
  * the topology with VISIBLE_DEVICES. I cannot
@@ -930,107 +2941,66 @@ int mpibind_set_gpu_ids(mpibind_t *handle, int id_type)
  */
 int mpibind_set_env_vars(mpibind_t *handle)
 {
-  int i, v, nc, val, end, vendor;
-  char *str;
-  const char *vars[] = {
-    "OMP_NUM_THREADS",
-    "OMP_PLACES",
-    "OMP_PROC_BIND",
-    "VISIBLE_DEVICES"
-  };
-  int nvars = sizeof(vars) / sizeof(const char *);
+  int i, v, vendor;
+  uint64_t start;
+  int nvars = 0;
+  int keys[NUM_ENV_VARS];
 
-  if (handle == NULL)
+  if (handle == NULL || handle->cpus == NULL)
     return 1;
 
+  start = timer_now();
+
+  for (v=0; v<NUM_ENV_VARS; v++)
+    if (env_var_used(handle, env_var_names[v]))
+      keys[nvars++] = v;
+
   /* Initialize/allocate env */
   handle->nvars = nvars;
-  handle->env_vars = calloc(nvars, sizeof(mpibind_env_var));
+  handle->env_vars = arena_alloc(&handle->arena,
+				 nvars * sizeof(mpibind_env_var));
 
   vendor = get_gpu_vendor_id(handle->devs, handle->ndevs);
 
   for (v=0; v<nvars; v++) {
     /* Fill in env_vars */
     handle->env_vars[v].size = handle->ntasks;
-    handle->env_vars[v].name = malloc(SHORT_STR_SIZE);
-    handle->env_vars[v].values = calloc(handle->ntasks, sizeof(char *));
-    sprintf(handle->env_vars[v].name, "%s", vars[v]);
-    /* Debug */
-    //printf("Var: %s\n", env->vars[v].name);
-
-    for (i=0; i<handle->ntasks; i++) {
-      (handle->env_vars[v].values)[i] = malloc(LONG_STR_SIZE);
-      str = (handle->env_vars[v].values)[i];
-      str[0] = '\0';
-
-      if ( strncmp(vars[v], "OMP_NUM_THREADS", 8) == 0 )
-	snprintf(str, LONG_STR_SIZE, "%d", handle->nthreads[i]);
-
-      else if ( strncmp(vars[v], "OMP_PLACES", 8) == 0 ) {
-	/*
-	 * Simplifying the value of this variable from
-	 * a list of PUs to 'threads'.
-	 *
-	 * mpibind binds each process to a set of PUs already
-	 * so it might be redundant to apply the thread
-	 * binding to the same list of PUs as the process
-	 * binding.
-	 * While setting this env variable to a explicit
-	 * list of places should not hurt, it can be problematic
-	 * for some OpenMP compilers that interpret the list
-	 * of places as relative IDs: An ID of 4 does not mean
-	 * hardware thread 4, instead it means the forth place.
-	 * This may result in errors when passing large IDs
-	 * like 60 (hardware thread 60) since there may not be a
-	 * 60th place within this process.
-	 */
-#if 0
-	nc = 0;
-	hwloc_bitmap_foreach_begin(val, handle->cpus[i]) {
-	  nc += snprintf(str+nc,
-			 (LONG_STR_SIZE-nc < 0) ? 0 : LONG_STR_SIZE-nc,
-			 "{%d},", val);
-	} hwloc_bitmap_foreach_end();
-#else
-	snprintf(str, LONG_STR_SIZE, "threads");
-#endif
-      }
-
-      else if ( strncmp(vars[v], "OMP_PROC", 8) == 0 )
-	snprintf(str, LONG_STR_SIZE, "spread");
-
-      else if ( strncmp(vars[v], "VISIBLE_DEVICES", 8) == 0 ) {
-	if (vendor == 0x1002)
-	  snprintf(handle->env_vars[v].name, SHORT_STR_SIZE,
-		   "ROCR_VISIBLE_DEVICES");
-	else if (vendor == 0x10de)
-	  snprintf(handle->env_vars[v].name, SHORT_STR_SIZE,
-		   "CUDA_VISIBLE_DEVICES");
-	nc = 0;
-        /* Use the GPU's visible devices ID (visdevs),
-           not the mpibind ID (val).
-           Todo: When AMD supports UUIDs, use UUIDs instead */
-	hwloc_bitmap_foreach_begin(val, handle->gpus[i]) {
-	  nc += snprintf(str+nc, LONG_STR_SIZE-nc, "%d,",
-			 handle->devs[val]->smi);
-	} hwloc_bitmap_foreach_end();
-      }
-
-      /* Strip the last comma */
-      end = strlen(str) - 1;
-      if (str[end] == ',')
-	str[end] = '\0';
+    handle->env_vars[v].key = keys[v];
+    handle->env_vars[v].values = arena_alloc(&handle->arena,
+					     handle->ntasks * sizeof(char *));
+    handle->env_vars[v].name = arena_strdup(&handle->arena,
+					    env_var_names[keys[v]]);
+    for (i=0; i<handle->ntasks; i++)
+      handle->env_vars[v].values[i] = NULL;
+
+    if (strncmp(env_var_names[keys[v]], "VISIBLE_DEVICES", 8) == 0) {
+      if (vendor == 0x1002)
+	handle->env_vars[v].name =
+	  arena_strdup(&handle->arena, "ROCR_VISIBLE_DEVICES");
+      else if (vendor == 0x10de)
+	handle->env_vars[v].name =
+	  arena_strdup(&handle->arena, "CUDA_VISIBLE_DEVICES");
     }
   }
 
   /* Store the names of the vars in its own array
      so that callers can retrieve them easily */
-  handle->names = calloc(nvars, sizeof(char *));
-  for (v=0; v<nvars; v++) {
-    handle->names[v] = malloc(SHORT_STR_SIZE);
-    sprintf(handle->names[v], "%s", handle->env_vars[v].name);
+  handle->names = arena_alloc(&handle->arena, nvars * sizeof(char *));
+  for (v=0; v<nvars; v++)
+    handle->names[v] = handle->env_vars[v].name;
+
+  if (handle->lazy) {
+    /* The values are built on first access */
+    handle->env_done = arena_alloc(&handle->arena, handle->ntasks);
+    memset(handle->env_done, 0, handle->ntasks);
+  } else {
+    for (i=0; i<handle->ntasks; i++)
+      env_vars_task(handle, i);
+    handle->env_done = NULL;
   }
 
+  handle->timers[MPIBIND_TIMER_ENV_VARS] += timer_now() - start;
+
   return 0;
 }
 
@@ -1038,6 +3008,8 @@ void mpibind_env_vars_print(mpibind_t *handle)
 {
   int i, v;
 
+  complete_tasks(handle);
+
   for (v=0; v<handle->nvars; v++) {
     printf("%s:\n", handle->env_vars[v].name);
     for (i=0; i<handle->env_vars[v].size; i++) {
@@ -1056,8 +3028,31 @@ char** mpibind_get_env_var_values(mpibind_t *handle,
 
   /* Always check that the input name is valid */
   for (v=0; v<handle->nvars; v++)
-    if (strcmp(handle->env_vars[v].name, name) == 0)
+    if (strcmp(handle->env_vars[v].name, name) == 0) {
+      complete_tasks(handle);
       return handle->env_vars[v].values;
+    }
+
+  return NULL;
+}
+
+/*
+ * The value of a given env variable (name) for a given task.
+ * In lazy mode, only the values of this task are built.
+ */
+char* mpibind_get_env_var_ptask(mpibind_t *handle, int taskid,
+				const char *name)
+{
+  int v;
+
+  if (handle == NULL || taskid < 0 || taskid >= handle->ntasks)
+    return NULL;
+
+  for (v=0; v<handle->nvars; v++)
+    if (strcmp(handle->env_vars[v].name, name) == 0) {
+      complete_task(handle, taskid);
+      return handle->env_vars[v].values[taskid];
+    }
 
   return NULL;
 }
@@ -1073,9 +3068,30 @@ char** mpibind_get_env_var_names(mpibind_t *handle, int *count)
   return handle->names;
 }
 
+/*
+ * Bind the memory of the calling process to the NUMA
+ * domains of a task. Without the strict flag, hwloc's
+ * bind policy prefers the given domains (Linux).
+ */
+static
+int apply_membind(mpibind_t *handle, int taskid)
+{
+  hwloc_membind_policy_t policy = HWLOC_MEMBIND_BIND;
+  int flags = HWLOC_MEMBIND_BYNODESET;
+
+  if (handle->membind == MPIBIND_MEMBIND_BIND)
+    flags |= HWLOC_MEMBIND_STRICT;
+  else if (handle->membind == MPIBIND_MEMBIND_INTERLEAVE)
+    policy = HWLOC_MEMBIND_INTERLEAVE;
+
+  return hwloc_set_membind(handle->topo, handle->mems[taskid],
+			   policy, flags);
+}
+
 int mpibind_apply(mpibind_t *handle, int taskid)
 {
   int rc = -1;
+  uint64_t start = timer_now();
   hwloc_bitmap_t *core_sets = mpibind_get_cpus(handle);
   hwloc_topology_t topo = mpibind_get_topology(handle);
 
@@ -1083,6 +3099,11 @@ int mpibind_apply(mpibind_t *handle, int taskid)
     rc = 0;
     if ((rc = hwloc_set_cpubind(topo, core_sets[taskid], 0)) < 0)
       perror("hwloc_set_cpubind");
+    else if (handle->membind != MPIBIND_MEMBIND_NONE &&
+	     !hwloc_bitmap_iszero(handle->mems[taskid]) &&
+	     (rc = apply_membind(handle, taskid)) < 0)
+      perror("hwloc_set_membind");
+    handle->timers[MPIBIND_TIMER_APPLY] += timer_now() - start;
   }
 
   return rc;
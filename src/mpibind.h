@@ -5,6 +5,7 @@
 #ifndef MPIBIND_H_INCLUDED
 #define MPIBIND_H_INCLUDED
 
+#include <stdio.h>
 #include <hwloc.h>
 
 #ifdef __cplusplus
@@ -21,6 +22,51 @@ extern "C" {
     MPIBIND_ID_SMI,
     MPIBIND_ID_PCIBUS,
     MPIBIND_ID_NAME,
+
+    /* Format of an exported mapping */
+    MPIBIND_FORMAT_BINARY,
+    MPIBIND_FORMAT_JSON,
+  };
+
+  /* Memory policy applied by mpibind_apply (see mpibind_set_membind) */
+  enum {
+    MPIBIND_MEMBIND_NONE,        /* First touch */
+    MPIBIND_MEMBIND_BIND,        /* Only the task's NUMA domains */
+    MPIBIND_MEMBIND_INTERLEAVE,  /* Round robin over them */
+    MPIBIND_MEMBIND_PREFERRED,   /* Prefer them, fall back to others */
+  };
+
+  /* Domains of the reserved cores (see mpibind_set_reserved) */
+  enum {
+    MPIBIND_RESERVE_NODE,
+    MPIBIND_RESERVE_PACKAGE,
+    MPIBIND_RESERVE_NUMA,
+  };
+
+  /* Change of a task with respect to a previous mapping
+     (see mpibind_get_moved) */
+  enum {
+    MPIBIND_TASK_UNCHANGED,
+    MPIBIND_TASK_MOVED,
+    MPIBIND_TASK_NEW,
+  };
+
+  /* Domains of a leader task (see mpibind_set_leader) */
+  enum {
+    MPIBIND_LEADER_CORE,
+    MPIBIND_LEADER_L3,
+    MPIBIND_LEADER_NUMA,
+  };
+
+  /* Phases of mpibind timed by a handle (see mpibind_get_timers) */
+  enum {
+    MPIBIND_TIMER_LOAD,      /* Topology load or check */
+    MPIBIND_TIMER_RESTRICT,  /* hwloc_topology_restrict */
+    MPIBIND_TIMER_DEVICES,   /* I/O device discovery */
+    MPIBIND_TIMER_DISTRIB,   /* Mapping calculation */
+    MPIBIND_TIMER_ENV_VARS,  /* mpibind_set_env_vars */
+    MPIBIND_TIMER_APPLY,     /* mpibind_apply */
+    MPIBIND_NUM_TIMERS
   };
 
   /* Opaque mpibind handle */
@@ -95,6 +141,76 @@ extern "C" {
   int mpibind_set_smt(mpibind_t *handle,
 		    int smt);
 
+  /*
+   * Valid values are 0 and 1. Default is 0.
+   * If 1, a task does not span more than one L3 cache
+   * (e.g., an AMD CCX) unless there are fewer tasks than
+   * L3 caches, and tasks are balanced over the L3 caches.
+   */
+  int mpibind_set_llc(mpibind_t *handle, int llc);
+
+  /*
+   * Valid values are 0 and 1. Default is 0.
+   * If 1 and the CPU is hybrid (hwloc CPU kinds), tasks are
+   * mapped to the most efficient kind of cores only, e.g.,
+   * P-cores, and the number of threads is calculated from
+   * them. The other cores are left for helper threads
+   * (see mpibind_get_helper_cpus).
+   */
+  int mpibind_set_cpukinds(mpibind_t *handle, int cpukinds);
+
+  /*
+   * Valid values are 0 and 1. Default is 0.
+   * If 1, mpibind computes the mappings of several candidate
+   * parameters: greedy on and off, L3-aware placement on and
+   * off, and, if smt is not given, each SMT level (which
+   * changes the number of threads if nthreads is not given).
+   * It keeps the mapping with the lowest cost, computed
+   * from the metrics of mpibind_get_metrics and the number
+   * of idle cores. The parameters of the handle are tried
+   * first and win ties. The search takes a few milliseconds
+   * at most.
+   */
+  int mpibind_set_auto(mpibind_t *handle, int enable);
+
+  /*
+   * Tasks of different sizes, e.g., a coordinator task:
+   * 'weights' has one positive weight per task, such as its
+   * number of threads. Tasks get a share of the cores and
+   * GPUs of their NUMA domain proportional to their weight,
+   * and consecutive tasks fill up the NUMA domains in
+   * proportion to their total weight. Without nthreads, the
+   * number of threads of a task is its number of PUs.
+   * With llc, the weights apply to the NUMA domains only.
+   * The weights are copied. NULL removes them.
+   */
+  int mpibind_set_weights(mpibind_t *handle, int nweights,
+			  const int *weights);
+
+  /*
+   * Manager/worker jobs: Task 'task' is a leader that gets a
+   * core, an L3 cache, or a NUMA domain (MPIBIND_LEADER_*) of
+   * its own, close to a NIC. The other tasks are mapped to
+   * the rest of the node. With a NUMA domain, the leader also
+   * gets its GPUs. A task of -1 (default) disables the leader.
+   */
+  int mpibind_set_leader(mpibind_t *handle, int task, int domain);
+
+  /*
+   * Malleable jobs: The CPUs and GPUs ('gpus' may be NULL) of
+   * the 'ntasks' tasks of a previous mapping, e.g., the outputs
+   * of the last call to mpibind() before the job grew or shrank.
+   * The next mappings are computed as usual, but the tasks of
+   * the previous mapping that survive (tasks 0 to ntasks-1)
+   * keep as many of their CPUs and GPUs as possible by taking
+   * the place of other tasks of the new mapping. A task only
+   * takes the place of a task with the same weight, and the
+   * leader keeps its own place. See mpibind_get_moved.
+   * The sets are copied; ntasks=0 removes the previous mapping.
+   */
+  int mpibind_set_previous(mpibind_t *handle, int ntasks,
+			   hwloc_bitmap_t *cpus, hwloc_bitmap_t *gpus);
+
   /*
    * Restrict the hardware topology to resources
    * associated with the specified hardware ids of type 'restr_type'.
@@ -122,6 +238,47 @@ extern "C" {
   int mpibind_set_topology(mpibind_t *handle,
 			   hwloc_topology_t topo);
 
+  /*
+   * Valid values of 'enable' are 0 and 1. Default is 0.
+   * If 1, reuse a mapping computed earlier by this process
+   * when the topology and the input parameters are the same.
+   * If 'cache_file' is not NULL (a node-local path), mappings
+   * are also saved to and looked up in this file so that
+   * other processes on the node can reuse them.
+   */
+  int mpibind_set_map_cache(mpibind_t *handle,
+			    int enable, const char *cache_file);
+
+  /*
+   * Memory policy applied by mpibind_apply over the NUMA
+   * domains of a task (see mpibind_get_mems), e.g.,
+   * MPIBIND_MEMBIND_BIND. Default is MPIBIND_MEMBIND_NONE.
+   */
+  int mpibind_set_membind(mpibind_t *handle, int policy);
+
+  /*
+   * Valid values of 'lazy' are 0 and 1. Default is 0.
+   * If 1, mpibind_set_env_vars and mpibind_set_gpu_ids do not
+   * build the values of every task: The values of a task are
+   * built the first time they are retrieved, e.g., with
+   * mpibind_get_env_var_ptask or mpibind_get_gpus_ptask.
+   * Tasks (threads or forked processes) may retrieve their
+   * values concurrently.
+   */
+  int mpibind_set_lazy(mpibind_t *handle, int lazy);
+
+  /*
+   * Reserve 'ncores' cores of each domain (MPIBIND_RESERVE_*)
+   * for the OS and system daemons, e.g., one core per package.
+   * If 'from_end' is 1 the last cores of a domain are reserved,
+   * otherwise the first ones. Tasks are not mapped to reserved
+   * cores. Default is no reserved cores.
+   * Like a restriction, the reservation is applied to the
+   * topology once; to change it, pass a new topology.
+   */
+  int mpibind_set_reserved(mpibind_t *handle, int ncores,
+			   int domain, int from_end);
+
   /*
    * Main mapping function.
    * The resulting mapping can be retrieved with the
@@ -129,6 +286,58 @@ extern "C" {
    */
   int mpibind(mpibind_t *handle);
 
+  /*
+   * Release the mapping of a handle. The handle keeps its
+   * input parameters, the topology, and the discovered I/O
+   * devices so that it can compute another mapping quickly:
+   * set new input parameters and call mpibind() again.
+   * mpibind() releases the previous mapping implicitly.
+   * A topology can only be restricted once; to use a
+   * different restriction, pass a new topology.
+   */
+  int mpibind_reset(mpibind_t *handle);
+
+  /*
+   * The mappings computed by mpibind_sweep, stored by columns.
+   * There is one point per (ntasks, smt) pair. The tasks of
+   * point p are offset[p] to offset[p]+ntasks[p]-1 and rc[p]
+   * is 0 if the mapping of point p succeeded.
+   * The CPUs of task t are cpu_ids[cpu_start[t]] to
+   * cpu_ids[cpu_start[t+1]-1]. Similarly for the GPUs, which
+   * use mpibind's device IDs.
+   */
+  typedef struct {
+    int npoints;
+    int *ntasks;
+    int *smt;
+    int *rc;
+    int *offset;
+    size_t ntotal;
+    int *nthreads;
+    int *cpu_start;
+    int *cpu_ids;
+    int *gpu_start;
+    int *gpu_ids;
+  } mpibind_sweep_t;
+
+  /*
+   * Compute the mappings for every number of tasks from
+   * 'min_ntasks' to 'max_ntasks' and every SMT level in 'smt'
+   * (an array of 'nsmt' elements). The other input parameters
+   * are taken from the handle, except for the task weights
+   * and the leader task.
+   * Work that does not depend on the
+   * number of tasks is done once for the whole sweep.
+   * The mapping of the handle, if any, is not modified.
+   * Returns NULL on failure. The result must be released
+   * with mpibind_sweep_free.
+   */
+  mpibind_sweep_t* mpibind_sweep(mpibind_t *handle,
+				 int min_ntasks, int max_ntasks,
+				 const int *smt, int nsmt);
+
+  void mpibind_sweep_free(mpibind_sweep_t *sweep);
+
   /*
    * Output: The mapping of workers to the hardware.
    * Asssign CPUs, GPUs, and number of threads to each
@@ -144,12 +353,38 @@ extern "C" {
    */
   int* mpibind_get_nthreads(mpibind_t *handle);
 
+  /*
+   * Return an array with 'ntasks' elements: For each task,
+   * MPIBIND_TASK_UNCHANGED if its CPUs and GPUs are the same
+   * as in the previous mapping (see mpibind_set_previous),
+   * MPIBIND_TASK_MOVED if they are not, or MPIBIND_TASK_NEW if
+   * the task was not in the previous mapping. Only the tasks
+   * that moved or are new need to be bound again.
+   * NULL if there is no previous mapping.
+   */
+  int* mpibind_get_moved(mpibind_t *handle);
+
   /*
    * Return an array with 'ntasks' elements.
    * The physical CPUs to use for a given process/task.
    */
   hwloc_bitmap_t* mpibind_get_cpus(mpibind_t *handle);
 
+  /*
+   * Array with 'ntasks' elements. Each entry is the
+   * nodeset (NUMA domains by OS index) local to the
+   * CPUs of a task.
+   */
+  hwloc_bitmap_t* mpibind_get_mems(mpibind_t *handle);
+
+  /*
+   * The PUs not used by tasks because of their CPU kind,
+   * e.g., E-cores, to be used by helper threads (progress,
+   * I/O). NULL unless CPU kinds are used and the CPU is
+   * hybrid (see mpibind_set_cpukinds).
+   */
+  hwloc_const_bitmap_t mpibind_get_helper_cpus(mpibind_t *handle);
+
   /*
    * Return an array with the CPUs assigned to the
    * given task. The size of the array is set in 'ncpus'.
@@ -157,6 +392,26 @@ extern "C" {
   int* mpibind_get_cpus_ptask(mpibind_t *handle, int taskid,
 			      int *ncpus);
 
+  /*
+   * Return an array with the CPUs of each thread of the
+   * given task. Threads are placed on different cores first,
+   * then on the hardware threads of each core, so that
+   * runtimes without OpenMP places can pin their threads.
+   * The number of threads is set in 'nthreads' and the
+   * number of CPUs of each thread in '*ncpus' (optional).
+   * Returns NULL on error, e.g., if out of memory.
+   */
+  int** mpibind_get_threads_ptask(mpibind_t *handle, int taskid,
+				  int *nthreads, int **ncpus);
+
+  /*
+   * Return an array with the CPUs of the given thread
+   * of the given task (see mpibind_get_threads_ptask).
+   * The size of the array is set in 'ncpus'.
+   */
+  int* mpibind_get_thread_cpus(mpibind_t *handle, int taskid,
+			       int threadid, int *ncpus);
+
   /*
    * Return an array with the GPUs assigned to the
    * given task. The size of the array is set in 'ngpus'.
@@ -177,6 +432,27 @@ extern "C" {
    */
   hwloc_bitmap_t* mpibind_get_gpus(mpibind_t *handle);
 
+  /*
+   * Return an array with the names of the NICs assigned
+   * to the given task, e.g., mlx5_0. NICs are local to the
+   * NUMA domains of the task when possible.
+   * The size of the array is set in 'nnics'.
+   */
+  char** mpibind_get_nics_ptask(mpibind_t *handle,
+          int taskid, int *nnics);
+
+  /*
+   * Get the number of NICs in the system/allocation.
+   */
+  int mpibind_get_num_nics(mpibind_t *handle);
+
+  /*
+   * Return an array with 'ntasks' elements.
+   * The NICs to use for a given process/task
+   * (mpibind's device IDs).
+   */
+  hwloc_bitmap_t* mpibind_get_nics(mpibind_t *handle);
+
   /*
    * Get the hwloc loaded topology used by mpibind so that
    * callers can continue to use it even after mpibind has
@@ -186,6 +462,83 @@ extern "C" {
    */
   hwloc_topology_t mpibind_get_topology(mpibind_t *handle);
 
+  /*
+   * Get the number of mapping cache hits and misses
+   * in this process (see mpibind_set_map_cache).
+   */
+  void mpibind_get_map_cache_stats(int *hits, int *misses);
+
+  /*
+   * Get the memory used by the outputs of a handle
+   * (mapping, GPU IDs, and environment variables):
+   * the number of allocations, the number of chunks
+   * obtained from the system, and the bytes reserved.
+   * Output memory is released by mpibind_finalize.
+   */
+  int mpibind_get_mem_stats(mpibind_t *handle, int *nallocs,
+			    int *nchunks, size_t *nbytes);
+
+  /*
+   * Get the time, in microseconds, spent by a handle in each
+   * phase of mpibind. 'usecs' must have MPIBIND_NUM_TIMERS
+   * elements, indexed by MPIBIND_TIMER_*. Times accumulate
+   * over the life of the handle. The load time includes
+   * loading the topology only if mpibind loaded it, i.e.,
+   * no topology was passed to mpibind_set_topology; the time
+   * to load a topology given to mpibind_set_topology is
+   * returned by mpibind_load_topology_cached.
+   */
+  int mpibind_get_timers(mpibind_t *handle, double *usecs);
+
+  /*
+   * Print the phase timers of a handle to a string.
+   */
+  int mpibind_timers_snprint(char *buf, size_t size,
+			     mpibind_t *handle);
+
+  /*
+   * The quality of a mapping (see mpibind_get_metrics).
+   * The imbalance of a resource is max/mean - 1 over the
+   * tasks (0 is a perfect balance); with task weights, the
+   * resources of a task are divided by its weight.
+   * The GPU affinity is the mean fraction of the CPUs of a
+   * task that share a NUMA domain (or an L3 cache) with the
+   * task's GPUs, over the tasks with GPUs; it is -1 if no
+   * task has GPUs or the node has no L3 caches.
+   * A task crosses a boundary if its CPUs span more than
+   * one NUMA domain, package, or L3 cache. A core is shared
+   * if its hardware threads are assigned to more than one task.
+   */
+  typedef struct {
+    int ntasks;
+    int min_pus;
+    int max_pus;
+    int min_gpus;
+    int max_gpus;
+    double pu_imbalance;
+    double gpu_imbalance;
+    double gpu_numa_affinity;
+    double gpu_l3_affinity;
+    int cross_numa;
+    int cross_package;
+    int cross_l3;
+    int shared_cores;
+    int shared_tasks;
+  } mpibind_metrics_t;
+
+  /*
+   * Measure the quality of the mapping of a handle.
+   * Requires the topology the mapping was computed on:
+   * It fails on an imported mapping without a topology.
+   */
+  int mpibind_get_metrics(mpibind_t *handle, mpibind_metrics_t *metrics);
+
+  /*
+   * Print the quality metrics of a mapping to a string.
+   */
+  int mpibind_metrics_snprint(char *buf, size_t size,
+			      mpibind_t *handle);
+
   /*
    * Helper functions
    */
@@ -195,15 +548,39 @@ extern "C" {
    */
   void mpibind_mapping_print(mpibind_t *handle);
 
+  /*
+   * Print the mapping for each task to a stream.
+   * There is no limit on the size of the mapping.
+   */
+  int mpibind_mapping_fprint(FILE *stream, mpibind_t *handle);
+
+  /*
+   * Called with the mapping of each task, one line at a time,
+   * without a newline character. Return non-zero to stop.
+   */
+  typedef int (*mpibind_write_fn)(const char *line, void *arg);
+
+  /*
+   * Write the mapping for each task through 'write_fn'.
+   * 'arg' is passed to every call of 'write_fn'.
+   * There is no limit on the size of the mapping.
+   */
+  int mpibind_mapping_write(mpibind_t *handle,
+			    mpibind_write_fn write_fn, void *arg);
+
   /*
    * Print the mapping for a given task.
+   * Like snprintf, returns the number of characters of the
+   * whole line, which may be 'size' or more if truncated.
    */
   int mpibind_mapping_ptask_snprint(char *buf, size_t size,
         mpibind_t *handle, int taskid);
 
   /*
    * Print the mapping for each task to a string.
-   * Returns the number of characters printed to the string.
+   * Returns the number of characters of the whole mapping,
+   * which may be 'size' or more if truncated. Only whole
+   * lines are kept. Call with size 0 to get the size needed.
    */
   int mpibind_mapping_snprint(char *str, size_t size,
         mpibind_t *handle);
@@ -255,6 +632,38 @@ extern "C" {
    */
   char** mpibind_get_env_var_names(mpibind_t *handle, int *count);
 
+  /*
+   * Return the value of a given env variable (name) for a
+   * given task. mpibind_set_env_vars must be called before
+   * this function. In lazy mode, only the values of the
+   * given task are built (see mpibind_set_lazy).
+   */
+  char* mpibind_get_env_var_ptask(mpibind_t *handle, int taskid,
+				  const char *name);
+
+  /*
+   * Export the mapping of a handle so that it can be handed
+   * to the tasks (through a file, a pipe, or a message) without
+   * recomputing it. The export includes the I/O devices and,
+   * if set, the environment variables. 'format' is
+   * MPIBIND_FORMAT_BINARY (compact, same byte order only) or
+   * MPIBIND_FORMAT_JSON (a null-terminated string).
+   * The output is valid until the next mapping, mpibind_reset,
+   * or mpibind_finalize.
+   */
+  int mpibind_export(mpibind_t *handle, int format,
+		     const char **buf, size_t *size);
+
+  /*
+   * Replace the mapping of a handle with one given by
+   * mpibind_export. All the getter and print functions can be
+   * used afterwards. mpibind_apply needs a topology: Call
+   * mpibind_set_topology before this function.
+   * On failure, the handle is unchanged.
+   */
+  int mpibind_import(mpibind_t *handle, int format,
+		     const char *buf, size_t size);
+
   /*
    * Other "getter" functions.
    * These may be used to retrieve mpibind parameters
@@ -286,6 +695,47 @@ extern "C" {
    */
   int mpibind_get_smt(mpibind_t *handle);
 
+  /*
+   * Get the L3-aware setting (see mpibind_set_llc).
+   */
+  int mpibind_get_llc(mpibind_t *handle);
+
+  /*
+   * Get the CPU kinds setting (see mpibind_set_cpukinds).
+   */
+  int mpibind_get_cpukinds(mpibind_t *handle);
+
+  /*
+   * Get the auto mode setting (see mpibind_set_auto).
+   */
+  int mpibind_get_auto(mpibind_t *handle);
+
+  /*
+   * Get the task weights and, if not NULL, their number
+   * (see mpibind_set_weights). NULL if there are none.
+   */
+  const int* mpibind_get_weights(mpibind_t *handle, int *nweights);
+
+  /*
+   * Get the leader task, -1 if there is none, and, if not
+   * NULL, its domain (see mpibind_set_leader).
+   */
+  int mpibind_get_leader(mpibind_t *handle, int *domain);
+
+  /*
+   * Get the memory policy associated with an
+   * mpibind handle.
+   */
+  int mpibind_get_membind(mpibind_t *handle);
+
+  /*
+   * Get the number of reserved cores per domain and,
+   * if not NULL, the domain and the from_end flag
+   * (see mpibind_set_reserved).
+   */
+  int mpibind_get_reserved(mpibind_t *handle,
+			   int *domain, int *from_end);
+
   /*
    * Get the restrict id set associated with an
    * mpibind handle.
@@ -345,13 +795,45 @@ extern "C" {
   /*
    * Parse resource manager plugin options
    */
-  char* mpibind_parse_option(const char *opt,
-			     int *debug, int *gpu, int *greedy,
-			     int *master,
-			     int *omp_places, int *omp_proc_bind,
-			     int *smt, int *turn_on,
+  char* mpibind_parse_option(const char *opt, int *auto_map,
+			     int *cpukinds, int *debug, int *gpu, int *greedy,
+			     int *leader, int *leader_domain,
+			     int *llc, int *master, int *membind,
+			     int *nics, int *omp_places, int *omp_proc_bind,
+			     int *reserve, int *reserve_domain,
+			     int *reserve_end, int *smt, int *turn_on,
 			     int *verbose, int *visdevs);
 
+  /*
+   * Get the memory policy (MPIBIND_MEMBIND_*) given its
+   * name: none, bind, interleave, or preferred.
+   * Returns -1 if the name is not valid.
+   */
+  int mpibind_parse_membind(const char *name);
+
+  /*
+   * Parse a core reservation 'N[:node|package|numa][:first|last]',
+   * e.g., '1:package'. Default is per node, from the end.
+   * Returns 0 on success, 1 if the string is not valid.
+   */
+  int mpibind_parse_reserved(const char *str, int *ncores,
+			     int *domain, int *from_end);
+
+  /*
+   * Parse a comma-separated list of task weights, e.g., '4,1',
+   * into an array of 'ntasks' elements. Tasks past the end
+   * of the list get weight 1.
+   * Returns 0 on success, 1 if the string is not valid.
+   */
+  int mpibind_parse_weights(const char *str, int ntasks, int *weights);
+
+  /*
+   * Parse a leader task '[<task>][:core|l3|numa]', e.g., 'numa'
+   * or '3:l3'. Default is task 0 with a core.
+   * Returns 0 on success, 1 if the string is not valid.
+   */
+  int mpibind_parse_leader(const char *str, int *task, int *domain);
+
   /*
    * Get the PUs associated with a given set of Cores
    */
@@ -372,6 +854,20 @@ extern "C" {
    */
   int mpibind_load_topology(hwloc_topology_t topo);
 
+  /*
+   * Same as mpibind_load_topology, but keep a snapshot of the
+   * loaded topology in 'cache_file' (a node-local path).
+   * Subsequent calls import the snapshot instead of discovering
+   * the topology again. A snapshot is discarded automatically
+   * when the hwloc version, the kernel boot, or the topology
+   * filters change. If 'cache_file' is NULL, this function is
+   * equivalent to mpibind_load_topology. If 'usecs' is not
+   * NULL, it gets the time, in microseconds, it took to load
+   * the topology.
+   */
+  int mpibind_load_topology_cached(hwloc_topology_t topo,
+				   const char *cache_file, double *usecs);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -4,6 +4,7 @@
  ******************************************************/
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <hwloc.h>
@@ -57,9 +58,9 @@ int mpibind_range_nints(char *arg)
   /* First token */
   char *token = strtok(str, delim);
 
-  /* Output string */
+  /* Output string: Long lists of IDs do not fit on the stack */
   int nc=0, size=strlen(arg)+1;
-  char out[size];
+  char *out = malloc(size);
 
   int num=0, rc, begin, end;
   while (token != NULL) {
@@ -89,6 +90,7 @@ int mpibind_range_nints(char *arg)
     PRINT("%s: %s -> %d\n", name, arg, num);
 
  outlab:
+  free(out);
   free(str);
   return num;
 }
@@ -118,9 +120,9 @@ int mpibind_parse_restrict_ids(char *restr, int len)
     return 1;
 
   int rc = 1;
-  char line[len];
+  char *line = malloc(len);
   while ( feof(fp) == 0 ) {
-    if (fgets(line, sizeof(line), fp) != NULL) {
+    if (fgets(line, len, fp) != NULL) {
       //printf("%lu: <%s>\n", strlen(str), str);
 
       if (mpibind_range_nints(line) > 0) {
@@ -132,10 +134,124 @@ int mpibind_parse_restrict_ids(char *restr, int len)
     }
   }
 
+  free(line);
   fclose(fp);
   return rc;
 }
 
+/*
+ * Get the memory policy given its name.
+ * Returns -1 if the name is not valid.
+ */
+int mpibind_parse_membind(const char *name)
+{
+  if (strcmp(name, "none") == 0)
+    return MPIBIND_MEMBIND_NONE;
+  else if (strcmp(name, "bind") == 0)
+    return MPIBIND_MEMBIND_BIND;
+  else if (strcmp(name, "interleave") == 0)
+    return MPIBIND_MEMBIND_INTERLEAVE;
+  else if (strcmp(name, "preferred") == 0)
+    return MPIBIND_MEMBIND_PREFERRED;
+
+  return -1;
+}
+
+/*
+ * Parse a core reservation: N[:node|package|numa][:first|last].
+ * Returns 0 on success, 1 if the string is not valid.
+ */
+int mpibind_parse_reserved(const char *str, int *ncores,
+			   int *domain, int *from_end)
+{
+  int n, dom = MPIBIND_RESERVE_NODE, end = 1;
+  char buf[SHORT_STR_SIZE], *p, *tok, *save;
+
+  n = strtol(str, &p, 10);
+  if (p == str || n < 0 || (*p != '\0' && *p != ':') ||
+      strlen(p) >= sizeof(buf))
+    return 1;
+
+  strcpy(buf, p);
+  for (tok = strtok_r(buf, ":", &save); tok != NULL;
+       tok = strtok_r(NULL, ":", &save)) {
+    if (strcmp(tok, "node") == 0)
+      dom = MPIBIND_RESERVE_NODE;
+    else if (strcmp(tok, "package") == 0)
+      dom = MPIBIND_RESERVE_PACKAGE;
+    else if (strcmp(tok, "numa") == 0)
+      dom = MPIBIND_RESERVE_NUMA;
+    else if (strcmp(tok, "first") == 0)
+      end = 0;
+    else if (strcmp(tok, "last") == 0)
+      end = 1;
+    else
+      return 1;
+  }
+
+  *ncores = n;
+  *domain = dom;
+  *from_end = end;
+
+  return 0;
+}
+
+/*
+ * Parse a list of task weights: w0,w1,...
+ * Returns 0 on success, 1 if the string is not valid.
+ */
+int mpibind_parse_weights(const char *str, int ntasks, int *weights)
+{
+  int i;
+  long w;
+  char *p;
+
+  for (i=0; i<ntasks; i++)
+    weights[i] = 1;
+
+  for (i=0; *str != '\0'; i++) {
+    w = strtol(str, &p, 10);
+    if (p == str || w <= 0 || w > INT_MAX || i >= ntasks ||
+	(*p != '\0' && *p != ','))
+      return 1;
+    weights[i] = w;
+    str = (*p == ',') ? p+1 : p;
+  }
+
+  return (i == 0);
+}
+
+/*
+ * Parse a leader task: [<task>][:core|l3|numa].
+ * Returns 0 on success, 1 if the string is not valid.
+ */
+int mpibind_parse_leader(const char *str, int *task, int *domain)
+{
+  int t = 0, dom = MPIBIND_LEADER_CORE;
+  char buf[SHORT_STR_SIZE], *p, *tok, *save;
+
+  if (strlen(str) >= sizeof(buf))
+    return 1;
+
+  strcpy(buf, str);
+  for (tok = strtok_r(buf, ":", &save); tok != NULL;
+       tok = strtok_r(NULL, ":", &save)) {
+    if (strcmp(tok, "core") == 0)
+      dom = MPIBIND_LEADER_CORE;
+    else if (strcmp(tok, "l3") == 0)
+      dom = MPIBIND_LEADER_L3;
+    else if (strcmp(tok, "numa") == 0)
+      dom = MPIBIND_LEADER_NUMA;
+    else if ((t = strtol(tok, &p, 10)) < 0 || p == tok || *p != '\0')
+      return 1;
+  }
+
+  *task = t;
+  *domain = dom;
+
+  return 0;
+}
+
 /*
  * Parse mpibind plugin options
  *
@@ -143,12 +259,22 @@ int mpibind_parse_restrict_ids(char *restr, int len)
  * otherwise a string with error message.
  */
 char* mpibind_parse_option(const char *opt,
+			   int *auto_map,
+			   int *cpukinds,
 			   int *debug,
 			   int *gpu,
 			   int *greedy,
+			   int *leader,
+			   int *leader_domain,
+			   int *llc,
 			   int *master,
+			   int *membind,
+			   int *nics,
 			   int *omp_places,
 			   int *omp_proc_bind,
+			   int *reserve,
+			   int *reserve_domain,
+			   int *reserve_end,
 			   int *smt,
 			   int *turn_on,
 			   int *verbose,
@@ -156,7 +282,21 @@ char* mpibind_parse_option(const char *opt,
 {
   int rc = 0;
 
-  if (strcmp(opt, "debug") == 0) {
+  if (strncmp(opt, "auto", 4) == 0) {
+    *auto_map = 1;
+    /* Parse options if any */
+    sscanf(opt+4, ":%d", auto_map);
+    if (*auto_map < 0 || *auto_map > 1)
+      rc = 2;
+  }
+  else if (strncmp(opt, "cpukinds", 8) == 0) {
+    *cpukinds = 1;
+    /* Parse options if any */
+    sscanf(opt+8, ":%d", cpukinds);
+    if (*cpukinds < 0 || *cpukinds > 1)
+      rc = 2;
+  }
+  else if (strcmp(opt, "debug") == 0) {
     *debug = 1;
   }
   else if (strncmp(opt, "gpu", 3) == 0) {
@@ -176,12 +316,34 @@ char* mpibind_parse_option(const char *opt,
   else if (strncmp(opt, "h", 1) == 0) {
     rc = 1;
   }
+  else if (strncmp(opt, "leader", 6) == 0) {
+    if ((opt[6] != '\0' && opt[6] != ':') ||
+	mpibind_parse_leader(opt+6, leader, leader_domain))
+      rc = 2;
+  }
+  else if (strncmp(opt, "llc", 3) == 0) {
+    *llc = 1;
+    /* Parse options if any */
+    sscanf(opt+3, ":%d", llc);
+    if (*llc < 0 || *llc > 1)
+      rc = 2;
+  }
   else if (strncmp(opt, "master", 6) == 0) {
     *master = 1;
     sscanf(opt+6, ":%d", master);
     if (*master < 0 || *master > 1)
       rc = 2;
   }
+  else if (strncmp(opt, "membind", 7) == 0) {
+    /* Parse options if any */
+    if (opt[7] == '\0')
+      *membind = MPIBIND_MEMBIND_BIND;
+    else if (opt[7] != ':' || (*membind = mpibind_parse_membind(opt+8)) < 0)
+      rc = 2;
+  }
+  else if (strcmp(opt, "nics") == 0) {
+    *nics = 1;
+  }
   else if (strcmp(opt, "off") == 0) {
     *turn_on = 0;
   }
@@ -194,6 +356,11 @@ char* mpibind_parse_option(const char *opt,
   else if (strcmp(opt, "on") == 0) {
     *turn_on = 1;
   }
+  else if (strncmp(opt, "reserve", 7) == 0) {
+    if (opt[7] != ':' ||
+	mpibind_parse_reserved(opt+8, reserve, reserve_domain, reserve_end))
+      rc = 2;
+  }
   else if (sscanf(opt, "smt:%d", smt) == 1) {
     if (*smt <= 0)
       rc = 2;
@@ -216,11 +383,14 @@ char* mpibind_parse_option(const char *opt,
   }
 
   if (rc > 0) {
-    char *str = malloc(sizeof(char) * LONG_STR_SIZE);
+    /* The usage message may not fit in LONG_STR_SIZE */
+    size_t size = (sizeof(usage_str) > LONG_STR_SIZE) ?
+      sizeof(usage_str) : LONG_STR_SIZE;
+    char *str = malloc(sizeof(char) * size);
     str[0] = '\0';
 
     if (rc == 1)
-      snprintf(str, LONG_STR_SIZE, usage_str);
+      snprintf(str, size, usage_str);
     else if (rc == 2)
       snprintf(str, LONG_STR_SIZE, "Invalid option value '%s'", opt);
     else if (rc == 3)
@@ -0,0 +1,65 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the auto selection of the mapping parameters**/
+int test_auto() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  mpibind_metrics_t m0, m1;
+  hwloc_bitmap_t *cpus;
+  int i, same, *nthreads, nthreads0[4];
+  hwloc_bitmap_t cpus0[4];
+
+  load_xml_topology(&topo, XML_PATH, 0);
+
+  diag("Testing the auto selection of the mapping parameters");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  ok(mpibind_get_auto(handle) == 0 && mpibind_set_auto(handle, 2) == 1,
+     "The auto mode is off by default and takes 0 or 1");
+
+  /* A balanced mapping is kept */
+  mpibind_set_ntasks(handle, 4);
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  nthreads = mpibind_get_nthreads(handle);
+  for (i=0; i<4; i++) {
+    cpus0[i] = hwloc_bitmap_dup(cpus[i]);
+    nthreads0[i] = nthreads[i];
+  }
+  mpibind_set_auto(handle, 1);
+  ok(mpibind(handle) == 0, "mpibind succeeds in auto mode");
+  cpus = mpibind_get_cpus(handle);
+  nthreads = mpibind_get_nthreads(handle);
+  for (same=1, i=0; i<4; i++) {
+    same &= hwloc_bitmap_isequal(cpus[i], cpus0[i]) &&
+      nthreads[i] == nthreads0[i];
+    hwloc_bitmap_free(cpus0[i]);
+  }
+  ok(same, "The auto mode keeps the default mapping if it is the best");
+
+  /* More tasks than cores: The SMT level balances the tasks */
+  mpibind_set_auto(handle, 0);
+  mpibind_set_ntasks(handle, 64);
+  mpibind(handle);
+  mpibind_get_metrics(handle, &m0);
+  mpibind_set_auto(handle, 1);
+  mpibind(handle);
+  mpibind_get_metrics(handle, &m1);
+  ok(m1.pu_imbalance < m0.pu_imbalance &&
+     m1.cross_numa <= m0.cross_numa && m1.shared_cores <= m0.shared_cores,
+     "The auto mode improves an unbalanced mapping");
+
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_auto();
+  done_testing();
+  return (0);
+}
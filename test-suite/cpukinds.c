@@ -0,0 +1,83 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the mapping on hybrid CPUs**/
+int test_cpukinds() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_obj_t pkg;
+  hwloc_bitmap_t *cpus, set;
+  int t, inside;
+
+  load_xml_topology(&topo, XML_PATH, 0);
+
+  diag("Testing the mapping on hybrid CPUs");
+
+  /* The first core has 1 PU and the others 4 */
+  set = hwloc_bitmap_dup(hwloc_get_root_obj(topo)->cpuset);
+  t = hwloc_bitmap_first(hwloc_get_obj_by_type(topo, HWLOC_OBJ_CORE, 0)->cpuset);
+  hwloc_bitmap_clr_range(set, t+1, t+3);
+  hwloc_topology_restrict(topo, set, HWLOC_RESTRICT_FLAG_REMOVE_CPULESS);
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 40);
+  mpibind_set_smt(handle, 4);
+  ok(mpibind(handle) == 0 && mpibind_get_cpus(handle) != NULL &&
+     hwloc_bitmap_weight(mpibind_get_cpus(handle)[0]) == 1 &&
+     hwloc_bitmap_weight(mpibind_get_cpus(handle)[1]) == 4,
+     "The SMT level is the maximum number of PUs per core");
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  /* The cores of the second package are more efficient */
+  load_xml_topology(&topo, XML_PATH, 0);
+  pkg = hwloc_get_obj_by_type(topo, HWLOC_OBJ_PACKAGE, 0);
+  hwloc_cpukinds_register(topo, pkg->cpuset, 0, 0, NULL, 0);
+  pkg = hwloc_get_obj_by_type(topo, HWLOC_OBJ_PACKAGE, 1);
+  hwloc_cpukinds_register(topo, pkg->cpuset, 1, 0, NULL, 0);
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 4);
+
+  ok(mpibind_get_cpukinds(handle) == 0 &&
+     mpibind_set_cpukinds(handle, 2) == 1,
+     "CPU kinds are not used by default");
+
+  mpibind(handle);
+  ok(mpibind_get_helper_cpus(handle) == NULL &&
+     !hwloc_bitmap_isincluded(mpibind_get_cpus(handle)[0], pkg->cpuset),
+     "Without CPU kinds tasks use every core");
+
+  mpibind_set_cpukinds(handle, 1);
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  inside = 1;
+  for (t = 0; t < 4; t++)
+    if (hwloc_bitmap_iszero(cpus[t]) ||
+        !hwloc_bitmap_isincluded(cpus[t], pkg->cpuset))
+      inside = 0;
+  ok(inside && mpibind_get_nthreads(handle)[0] ==
+     hwloc_get_nbobjs_inside_cpuset_by_type(topo, pkg->cpuset,
+                                            HWLOC_OBJ_CORE) / 4,
+     "With CPU kinds tasks use the most efficient cores");
+
+  hwloc_bitmap_andnot(set, hwloc_get_root_obj(topo)->cpuset, pkg->cpuset);
+  ok(mpibind_get_helper_cpus(handle) != NULL &&
+     hwloc_bitmap_isequal(mpibind_get_helper_cpus(handle), set),
+     "The other cores are left for helper threads");
+
+  hwloc_bitmap_free(set);
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_cpukinds();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,86 @@
+#include "test_utils.h"
+
+/**Test the use of the NUMA distances**/
+int test_distances() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_obj_t numas[8], pkg0, pkg1;
+  hwloc_uint64_t values[64];
+  hwloc_distances_add_handle_t dh;
+  hwloc_bitmap_t *cpus, set;
+  int i, j;
+
+  /* 2 packages of 4 NUMA domains, with latencies */
+  load_xml_topology(&topo, "../topo-xml/epyc-corona.xml", 0);
+
+  diag("Testing the use of the NUMA distances");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_greedy(handle, 0);
+  mpibind_set_ntasks(handle, 2);
+  mpibind(handle);
+
+  cpus = mpibind_get_cpus(handle);
+  pkg0 = hwloc_get_next_obj_covering_cpuset_by_type(topo, cpus[0],
+                                                    HWLOC_OBJ_PACKAGE, NULL);
+  pkg1 = hwloc_get_next_obj_covering_cpuset_by_type(topo, cpus[1],
+                                                    HWLOC_OBJ_PACKAGE, NULL);
+  ok(pkg0 != NULL && pkg1 != NULL && pkg0 != pkg1,
+     "An under-subscribed job is spread over the packages");
+
+  /* Make even and odd NUMA domains close to each other */
+  for (i = 0; i < 8; i++) {
+    numas[i] = hwloc_get_obj_by_type(topo, HWLOC_OBJ_NUMANODE, i);
+    for (j = 0; j < 8; j++)
+      values[i*8 + j] = (i == j) ? 10 : (i%2 == j%2) ? 12 : 32;
+  }
+  hwloc_distances_remove(topo);
+  dh = hwloc_distances_add_create(topo, "test",
+                                  HWLOC_DISTANCES_KIND_FROM_USER |
+                                  HWLOC_DISTANCES_KIND_MEANS_LATENCY, 0);
+  hwloc_distances_add_values(topo, dh, 8, numas, values, 0);
+  hwloc_distances_add_commit(topo, dh, 0);
+
+  /* A handle indexes its topology once: Use a new handle */
+  mpibind_finalize(handle);
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 2);
+  mpibind(handle);
+
+  set = hwloc_bitmap_alloc();
+  for (i = 0; i < 8; i += 2)
+    hwloc_bitmap_or(set, set, numas[i]->parent->cpuset);
+  cpus = mpibind_get_cpus(handle);
+  ok(hwloc_bitmap_isequal(cpus[0], set),
+     "The NUMA domains of a greedy task are the closest ones");
+
+  /* No distances: NUMA domains in object order */
+  hwloc_distances_remove(topo);
+  mpibind_finalize(handle);
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 2);
+  mpibind(handle);
+
+  hwloc_bitmap_zero(set);
+  for (i = 0; i < 4; i++)
+    hwloc_bitmap_or(set, set, numas[i]->parent->cpuset);
+  cpus = mpibind_get_cpus(handle);
+  ok(hwloc_bitmap_isequal(cpus[0], set),
+     "Without distances a greedy task gets consecutive NUMA domains");
+
+  hwloc_bitmap_free(set);
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_distances();
+  done_testing();
+  return (0);
+}
@@ -17,6 +17,20 @@ int test_null_handle() {
      "mpibind_set_gpu_optim fails when handle == NULL");
   ok(mpibind_set_smt(handle, 1) == 1,
      "mpibind_set_smt fails when handle == NULL");
+  ok(mpibind_set_llc(handle, 1) == 1,
+     "mpibind_set_llc fails when handle == NULL");
+  ok(mpibind_set_cpukinds(handle, 1) == 1,
+     "mpibind_set_cpukinds fails when handle == NULL");
+  ok(mpibind_set_auto(handle, 1) == 1,
+     "mpibind_set_auto fails when handle == NULL");
+  ok(mpibind_set_weights(handle, 0, NULL) == 1,
+     "mpibind_set_weights fails when handle == NULL");
+  ok(mpibind_set_leader(handle, 0, MPIBIND_LEADER_CORE) == 1,
+     "mpibind_set_leader fails when handle == NULL");
+  ok(mpibind_set_previous(handle, 0, NULL, NULL) == 1,
+     "mpibind_set_previous fails when handle == NULL");
+  ok(mpibind_set_reserved(handle, 1, MPIBIND_RESERVE_NODE, 1) == 1,
+     "mpibind_set_reserved fails when handle == NULL");
   ok(mpibind_set_restrict_ids(handle, NULL) == 1,
      "mpibind_set_restrict_ids fails when handle == NULL");
   ok(mpibind_set_restrict_type(handle, 1) == 1,
@@ -25,6 +39,10 @@ int test_null_handle() {
      "mpibind_set_topology fails when handle == NULL");
   ok(mpibind_set_env_vars(handle) == 1,
      "mpibind_set_end_vars fails when handle == NULL");
+  ok(mpibind_set_lazy(handle, 1) == 1,
+     "mpibind_set_lazy fails when handle == NULL");
+  ok(mpibind_set_membind(handle, MPIBIND_MEMBIND_BIND) == 1,
+     "mpibind_set_membind fails when handle == NULL");
 
   ok(mpibind_get_ntasks(handle) == -1,
      "mpibind_get_ntasks return -1 when handle == NULL");
@@ -34,6 +52,20 @@ int test_null_handle() {
      "mpibind_get_gpu_optim return -1 when handle == NULL");
   ok(mpibind_get_smt(handle) == -1,
      "mpibind_get_smt return -1 when handle == NULL");
+  ok(mpibind_get_llc(handle) == -1,
+     "mpibind_get_llc return -1 when handle == NULL");
+  ok(mpibind_get_cpukinds(handle) == -1,
+     "mpibind_get_cpukinds return -1 when handle == NULL");
+  ok(mpibind_get_auto(handle) == -1,
+     "mpibind_get_auto return -1 when handle == NULL");
+  ok(mpibind_get_helper_cpus(handle) == NULL,
+     "mpibind_get_helper_cpus returns NULL when handle == NULL");
+  ok(mpibind_get_weights(handle, NULL) == NULL,
+     "mpibind_get_weights returns NULL when handle == NULL");
+  ok(mpibind_get_leader(handle, NULL) == -1,
+     "mpibind_get_leader return -1 when handle == NULL");
+  ok(mpibind_get_reserved(handle, NULL, NULL) == -1,
+     "mpibind_get_reserved return -1 when handle == NULL");
   ok(mpibind_get_restrict_ids(handle) == NULL,
      "mpibind_get_ntasks return NULL when handle == NULL");
   ok(mpibind_get_restrict_type(handle) == -1,
@@ -41,10 +73,20 @@ int test_null_handle() {
 
   ok(mpibind_get_nthreads(handle) == NULL,
      "mpibind_get_nthreads returns NULL when handle == NULL");
+  ok(mpibind_get_moved(handle) == NULL,
+     "mpibind_get_moved returns NULL when handle == NULL");
   ok(mpibind_get_cpus(handle) == NULL,
      "mpibind_get_cpus returns NULL when handle == NULL");
   ok(mpibind_get_gpus(handle) == NULL,
      "mpibind_get_gpus returns NULL when handle == NULL");
+  ok(mpibind_get_mems(handle) == NULL,
+     "mpibind_get_mems returns NULL when handle == NULL");
+  ok(mpibind_get_nics(handle) == NULL,
+     "mpibind_get_nics returns NULL when handle == NULL");
+  ok(mpibind_get_nics_ptask(handle, 0, &count) == NULL,
+     "mpibind_get_nics_ptask returns NULL when handle == NULL");
+  ok(mpibind_get_membind(handle) == -1,
+     "mpibind_get_membind return -1 when handle == NULL");
   //ok(mpibind_get_gpu_type(handle) == -1,
   //   "mpibind_get_gpu_type returns NULL when handle == NULL");
   ok(mpibind_get_topology(handle) == NULL,
@@ -53,6 +95,14 @@ int test_null_handle() {
      "mpibind_get_env_var_values returns NULL when handle == NULL");
   ok(mpibind_get_env_var_names(handle, &count) == NULL,
      "mpibind_get_env_var_names returns NULL when handle == NULL");
+  ok(mpibind_get_env_var_ptask(handle, 0, "OMP_NUM_THREADS") == NULL,
+     "mpibind_get_env_var_ptask returns NULL when handle == NULL");
+  ok(mpibind_reset(handle) == 1,
+     "mpibind_reset fails when handle == NULL");
+  ok(mpibind_get_metrics(handle, NULL) == 1,
+     "mpibind_get_metrics fails when handle == NULL");
+  ok(mpibind_sweep(handle, 1, 2, &count, 1) == NULL,
+     "mpibind_sweep returns NULL when handle == NULL");
   ok(mpibind_finalize(handle) == 1,
      "mpibind_finalize fails when handle == NULL");
 
@@ -96,6 +146,21 @@ int test_mpibind_errors() {
   mpibind_set_smt(handle, 16);
   ok(mpibind(handle) == 1, "Mapping fails if smt is valid but too high");
 
+  mpibind_set_smt(handle, 0);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_restrict_ids(handle, "0-39");
+  ok(mpibind(handle) == 0, "Mapping succeeds on a restricted topology");
+
+  mpibind_set_restrict_ids(handle, "40-79");
+  ok(mpibind(handle) == 1,
+     "Mapping fails if the topology is restricted again");
+  ok(mpibind_get_cpus(handle) == NULL,
+     "A failed mapping releases the previous mapping");
+
+  ok(mpibind_finalize(handle) == 0,
+     "mpibind_finalize succeeds after a failed mapping");
+  hwloc_topology_destroy(topo);
+
   // TODO: ERROR CODES RELATED TO RESTRICT SETS
   todo("Error codes related to restrict sets");
   return 0;
@@ -0,0 +1,160 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/* The mapping of a handle as a new string */
+static char* mapping_str(mpibind_t *handle) {
+  int len = mpibind_mapping_snprint(NULL, 0, handle);
+  char *str = malloc(len + 1);
+
+  mpibind_mapping_snprint(str, len + 1, handle);
+  return str;
+}
+
+/**Test that exported mappings are imported unchanged**/
+int test_export_import() {
+  mpibind_t *src, *dst;
+  hwloc_topology_t topo;
+  const char *buf;
+  size_t size;
+  int i, j, f, same, count;
+  int formats[] = {MPIBIND_FORMAT_BINARY, MPIBIND_FORMAT_JSON};
+  const char *names[] = {"binary", "JSON"};
+  char **vals_src, **vals_dst;
+  char *map_src, *map_dst;
+
+  /* Keep PCI devices: The mapping includes GPUs */
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing export and import of mappings");
+
+  mpibind_init(&src);
+  mpibind_set_topology(src, topo);
+  mpibind_set_ntasks(src, 6);
+  mpibind(src);
+  mpibind_set_env_vars(src);
+
+  for (f = 0; f < 2; f++) {
+    ok(mpibind_export(src, formats[f], &buf, &size) == 0 && size > 0,
+       "mpibind_export writes the %s format", names[f]);
+
+    mpibind_init(&dst);
+    ok(mpibind_import(dst, formats[f], buf, size) == 0,
+       "mpibind_import reads the %s format", names[f]);
+    ok(mpibind_import(dst, formats[f], buf, size/2) != 0,
+       "mpibind_import rejects a truncated %s export", names[f]);
+
+    same = (mpibind_get_ntasks(dst) == 6);
+    for (i = 0; same && i < 6; i++)
+      same = (mpibind_get_nthreads(dst)[i] == mpibind_get_nthreads(src)[i] &&
+              hwloc_bitmap_isequal(mpibind_get_cpus(dst)[i],
+                                   mpibind_get_cpus(src)[i]) &&
+              hwloc_bitmap_isequal(mpibind_get_gpus(dst)[i],
+                                   mpibind_get_gpus(src)[i]) &&
+              hwloc_bitmap_isequal(mpibind_get_nics(dst)[i],
+                                   mpibind_get_nics(src)[i]));
+    ok(same && mpibind_get_num_gpus(dst) == mpibind_get_num_gpus(src) &&
+       mpibind_get_num_gpus(dst) > 0,
+       "Imported %s mapping matches the original", names[f]);
+
+    mpibind_get_env_var_names(dst, &count);
+    same = (count > 0);
+    vals_src = mpibind_get_env_var_values(src, "OMP_PLACES");
+    vals_dst = mpibind_get_env_var_values(dst, "OMP_PLACES");
+    for (i = 0; same && i < 6; i++)
+      same = (strcmp(vals_src[i], vals_dst[i]) == 0);
+    ok(same, "Imported %s env variables match the original", names[f]);
+
+    /* Every type of GPU ID is available */
+    same = 1;
+    for (j = MPIBIND_ID_UNIV; j <= MPIBIND_ID_NAME; j++) {
+      mpibind_set_gpu_ids(src, j);
+      mpibind_set_gpu_ids(dst, j);
+      map_src = mapping_str(src);
+      map_dst = mapping_str(dst);
+      if (strcmp(map_src, map_dst) != 0)
+        same = 0;
+      free(map_src);
+      free(map_dst);
+    }
+    ok(same, "Imported %s GPU IDs match the original", names[f]);
+
+    mpibind_finalize(dst);
+  }
+
+  /* Counts and values the input cannot back are rejected */
+  char *bad;
+  int32_t *ints;
+  mpibind_export(src, MPIBIND_FORMAT_BINARY, &buf, &size);
+  bad = malloc(size);
+  memcpy(bad, buf, size);
+  ints = (int32_t *)bad;
+  ints[2] = 1 << 24;
+  ok(mpibind_import(src, MPIBIND_FORMAT_BINARY, bad, size) != 0,
+     "mpibind_import rejects more tasks than the input holds");
+  memcpy(bad, buf, size);
+  ints[5] = 7;
+  ok(mpibind_import(src, MPIBIND_FORMAT_BINARY, bad, size) != 0,
+     "mpibind_import rejects an unknown device type");
+  free(bad);
+
+  mpibind_export(src, MPIBIND_FORMAT_JSON, &buf, &size);
+  bad = replace_str(buf, "\"ntasks\": 6", "\"ntasks\": 6.5");
+  ok(bad != NULL && mpibind_import(src, MPIBIND_FORMAT_JSON,
+                                   bad, strlen(bad)) != 0,
+     "mpibind_import rejects a number that is not an integer");
+  free(bad);
+  bad = replace_str(buf, "\"ntasks\": 6", "\"ntasks\": 4294967302");
+  ok(bad != NULL && mpibind_import(src, MPIBIND_FORMAT_JSON,
+                                   bad, strlen(bad)) != 0,
+     "mpibind_import rejects a number out of range");
+  free(bad);
+  bad = replace_str(buf, "\"type\": 0", "\"type\": 7");
+  ok(bad != NULL && mpibind_import(src, MPIBIND_FORMAT_JSON,
+                                   bad, strlen(bad)) != 0,
+     "mpibind_import rejects an unknown JSON device type");
+  free(bad);
+
+  /* Imported mappings have no index: Cores come from the
+     topology of the handle or, without one, are single PUs */
+  hwloc_bitmap_t left = hwloc_bitmap_alloc();
+  hwloc_obj_t core;
+  mpibind_export(src, MPIBIND_FORMAT_BINARY, &buf, &size);
+  mpibind_init(&dst);
+  mpibind_set_topology(dst, topo);
+  mpibind_import(dst, MPIBIND_FORMAT_BINARY, buf, size);
+  core = hwloc_get_ancestor_obj_by_type(topo, HWLOC_OBJ_CORE,
+          hwloc_get_pu_obj_by_os_index(topo,
+            hwloc_bitmap_first(mpibind_get_cpus(src)[0])));
+  hwloc_bitmap_andnot(left, mpibind_get_cpus(src)[0], core->cpuset);
+  ok(mpibind_pop_cores_ptask(dst, 0, 1) == 0 &&
+     hwloc_bitmap_isequal(mpibind_get_cpus(dst)[0], left) &&
+     mpibind_get_nthreads(dst)[0] == hwloc_bitmap_weight(left),
+     "mpibind_pop_cores_ptask pops a core of an imported mapping");
+  mpibind_finalize(dst);
+
+  mpibind_init(&dst);
+  mpibind_import(dst, MPIBIND_FORMAT_BINARY, buf, size);
+  hwloc_bitmap_copy(left, mpibind_get_cpus(src)[0]);
+  hwloc_bitmap_clr(left, hwloc_bitmap_first(left));
+  ok(mpibind_pop_cores_ptask(dst, 0, 1) == 0 &&
+     hwloc_bitmap_isequal(mpibind_get_cpus(dst)[0], left),
+     "Without a topology, mpibind_pop_cores_ptask pops a PU");
+  mpibind_finalize(dst);
+  hwloc_bitmap_free(left);
+
+  ok(mpibind_import(src, MPIBIND_FORMAT_JSON, "{\"version\": 1}", 14) != 0 &&
+     mpibind_get_ntasks(src) == 6 && mpibind_get_cpus(src) != NULL,
+     "A failed import keeps the mapping of the handle");
+
+  mpibind_finalize(src);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_export_import();
+  done_testing();
+  return (0);
+}
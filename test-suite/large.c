@@ -0,0 +1,66 @@
+#include "test_utils.h"
+
+/**Test the mapping on a large synthetic topology**/
+static int disjoint_tasks(mpibind_t *handle, int ntasks, hwloc_bitmap_t all) {
+  hwloc_bitmap_t *cpus = mpibind_get_cpus(handle);
+  int i, sum = 0;
+
+  hwloc_bitmap_zero(all);
+  for (i=0; i<ntasks; i++) {
+    if (hwloc_bitmap_iszero(cpus[i]))
+      return 0;
+    sum += hwloc_bitmap_weight(cpus[i]);
+    hwloc_bitmap_or(all, all, cpus[i]);
+  }
+
+  return sum == hwloc_bitmap_weight(all);
+}
+
+int test_large_topology() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_bitmap_t all;
+  int ncores, npus;
+
+  /* 32 NUMA domains, 4096 cores, and 32768 PUs */
+  hwloc_topology_init(&topo);
+  hwloc_topology_set_synthetic(topo, "pack:8 numa:4 l3:4 core:16 pu:8");
+  hwloc_topology_load(topo);
+  ncores = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_CORE);
+  npus = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_PU);
+
+  diag("Testing the mapping on a large topology");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  all = hwloc_bitmap_alloc();
+
+  mpibind_set_ntasks(handle, 1024);
+  ok(mpibind(handle) == 0 && disjoint_tasks(handle, 1024, all) &&
+     hwloc_bitmap_weight(all) == ncores,
+     "1024 tasks get a PU of every core of a 32768-PU node");
+
+  mpibind_set_ntasks(handle, npus);
+  ok(mpibind(handle) == 0 && disjoint_tasks(handle, npus, all) &&
+     hwloc_bitmap_weight(all) == npus,
+     "Every PU of a 32768-PU node gets a task");
+
+  mpibind_set_ntasks(handle, 7);
+  mpibind_set_greedy(handle, 1);
+  ok(mpibind(handle) == 0 && disjoint_tasks(handle, 7, all) &&
+     hwloc_bitmap_weight(all) == npus,
+     "Greedy tasks get the 32 NUMA domains of the node");
+
+  hwloc_bitmap_free(all);
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_large_topology();
+  done_testing();
+  return (0);
+}
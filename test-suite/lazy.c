@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+#define LAZY_NTASKS 16
+
+struct lazy_task {
+  mpibind_t *handle;
+  int taskid;
+  char *values[8];
+  char *gpus;
+};
+
+/* A task retrieving its own env variables and GPUs */
+static void* lazy_task_init(void *arg) {
+  struct lazy_task *task = arg;
+  char **names, **gpus;
+  int v, j, nvars, ngpus;
+
+  names = mpibind_get_env_var_names(task->handle, &nvars);
+  for (v = 0; v < nvars && v < 8; v++)
+    task->values[v] = mpibind_get_env_var_ptask(task->handle,
+                                                task->taskid, names[v]);
+
+  gpus = mpibind_get_gpus_ptask(task->handle, task->taskid, &ngpus);
+  task->gpus = calloc(1, 64 * (ngpus + 1));
+  for (j = 0; j < ngpus; j++) {
+    strcat(task->gpus, gpus[j]);
+    strcat(task->gpus, ",");
+  }
+
+  return NULL;
+}
+
+/**Test that lazy handles build the same values per task**/
+int test_lazy() {
+  mpibind_t *eager, *lazy;
+  hwloc_topology_t topo;
+  pthread_t threads[LAZY_NTASKS];
+  struct lazy_task tasks[LAZY_NTASKS];
+  char **names, **gpus;
+  int i, v, j, nvars, ngpus, same;
+  char str[1024];
+
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing lazy env variables and GPU IDs");
+
+  mpibind_init(&eager);
+  mpibind_set_topology(eager, topo);
+  mpibind_set_ntasks(eager, LAZY_NTASKS);
+  mpibind(eager);
+  mpibind_set_env_vars(eager);
+  mpibind_set_gpu_ids(eager, MPIBIND_ID_UNIV);
+
+  mpibind_init(&lazy);
+  mpibind_set_topology(lazy, topo);
+  mpibind_set_ntasks(lazy, LAZY_NTASKS);
+  ok(mpibind_set_lazy(lazy, 2) != 0 && mpibind_set_lazy(lazy, 1) == 0,
+     "mpibind_set_lazy accepts 0 and 1 only");
+  mpibind(lazy);
+  mpibind_set_env_vars(lazy);
+  mpibind_set_gpu_ids(lazy, MPIBIND_ID_UNIV);
+
+  /* Every task in its own thread */
+  for (i = 0; i < LAZY_NTASKS; i++) {
+    memset(&tasks[i], 0, sizeof(struct lazy_task));
+    tasks[i].handle = lazy;
+    tasks[i].taskid = i;
+    pthread_create(&threads[i], NULL, lazy_task_init, &tasks[i]);
+  }
+  for (i = 0; i < LAZY_NTASKS; i++)
+    pthread_join(threads[i], NULL);
+
+  names = mpibind_get_env_var_names(eager, &nvars);
+  same = 1;
+  for (i = 0; i < LAZY_NTASKS; i++) {
+    for (v = 0; v < nvars; v++)
+      if (tasks[i].values[v] == NULL ||
+          strcmp(tasks[i].values[v],
+                 mpibind_get_env_var_values(eager, names[v])[i]) != 0)
+        same = 0;
+
+    str[0] = '\0';
+    gpus = mpibind_get_gpus_ptask(eager, i, &ngpus);
+    for (j = 0; j < ngpus; j++) {
+      strcat(str, gpus[j]);
+      strcat(str, ",");
+    }
+    if (strcmp(str, tasks[i].gpus) != 0)
+      same = 0;
+    free(tasks[i].gpus);
+  }
+  ok(same, "Concurrent tasks build the same values as an eager handle");
+
+  same = 1;
+  for (v = 0; v < nvars; v++)
+    for (i = 0; i < LAZY_NTASKS; i++)
+      if (strcmp(mpibind_get_env_var_values(lazy, names[v])[i],
+                 mpibind_get_env_var_values(eager, names[v])[i]) != 0)
+        same = 0;
+  ok(same, "mpibind_get_env_var_values builds the values of every task");
+
+  ok(mpibind_get_env_var_ptask(lazy, LAZY_NTASKS, names[0]) == NULL &&
+     mpibind_get_env_var_ptask(lazy, 0, "NOT_A_VAR") == NULL,
+     "mpibind_get_env_var_ptask checks its input");
+
+  /* Without mpibind_set_gpu_ids, the first task to get its
+     GPUs picks the default IDs while others build theirs */
+  mpibind_finalize(lazy);
+  mpibind_init(&lazy);
+  mpibind_set_topology(lazy, topo);
+  mpibind_set_ntasks(lazy, LAZY_NTASKS);
+  mpibind_set_lazy(lazy, 1);
+  mpibind(lazy);
+  mpibind_set_env_vars(lazy);
+  for (i = 0; i < LAZY_NTASKS; i++) {
+    memset(&tasks[i], 0, sizeof(struct lazy_task));
+    tasks[i].handle = lazy;
+    tasks[i].taskid = i;
+    pthread_create(&threads[i], NULL, lazy_task_init, &tasks[i]);
+  }
+  for (i = 0; i < LAZY_NTASKS; i++)
+    pthread_join(threads[i], NULL);
+
+  mpibind_set_gpu_ids(eager, MPIBIND_ID_SMI);
+  same = 1;
+  for (i = 0; i < LAZY_NTASKS; i++) {
+    str[0] = '\0';
+    gpus = mpibind_get_gpus_ptask(eager, i, &ngpus);
+    for (j = 0; j < ngpus; j++) {
+      strcat(str, gpus[j]);
+      strcat(str, ",");
+    }
+    if (ngpus == 0 || strcmp(str, tasks[i].gpus) != 0)
+      same = 0;
+    free(tasks[i].gpus);
+  }
+  ok(same, "Concurrent tasks get the default GPU IDs");
+
+  mpibind_finalize(lazy);
+  mpibind_finalize(eager);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_lazy();
+  done_testing();
+  return (0);
+}
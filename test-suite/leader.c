@@ -0,0 +1,79 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the placement of a leader task**/
+int test_leader() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_obj_t core, numa;
+  hwloc_bitmap_t *cpus, *gpus;
+  int i, task, domain, apart;
+
+  /* Keep the NICs and GPUs */
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing the placement of a leader task");
+
+  ok(mpibind_parse_leader("", &task, &domain) == 0 &&
+     task == 0 && domain == MPIBIND_LEADER_CORE &&
+     mpibind_parse_leader(":3:l3", &task, &domain) == 0 &&
+     task == 3 && domain == MPIBIND_LEADER_L3,
+     "mpibind_parse_leader parses the task and the domain");
+  ok(mpibind_parse_leader("socket", &task, &domain) == 1 &&
+     mpibind_parse_leader("-1", &task, &domain) == 1,
+     "mpibind_parse_leader checks its input");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  ok(mpibind_set_leader(handle, 0, MPIBIND_LEADER_NUMA+1) == 1 &&
+     mpibind_get_leader(handle, NULL) == -1,
+     "mpibind_set_leader checks its input");
+
+  /* The leader gets a core by itself */
+  mpibind_set_ntasks(handle, 5);
+  mpibind_set_leader(handle, 0, MPIBIND_LEADER_CORE);
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  gpus = mpibind_get_gpus(handle);
+  core = hwloc_get_ancestor_obj_by_type(topo, HWLOC_OBJ_CORE,
+             hwloc_get_pu_obj_by_os_index(topo, hwloc_bitmap_first(cpus[0])));
+  numa = hwloc_get_obj_by_type(topo, HWLOC_OBJ_NUMANODE, 0);
+  for (apart = 1, i = 1; i < 5; i++)
+    if (hwloc_bitmap_intersects(cpus[i], core->cpuset) ||
+        hwloc_bitmap_iszero(gpus[i]))
+      apart = 0;
+  ok(hwloc_bitmap_weight(cpus[0]) == 1 && hwloc_bitmap_iszero(gpus[0]) &&
+     hwloc_bitmap_isincluded(cpus[0], numa->cpuset) && apart,
+     "The leader task gets a core of its own");
+
+  /* The leader gets a NUMA domain and its GPUs */
+  mpibind_set_leader(handle, 2, MPIBIND_LEADER_NUMA);
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  gpus = mpibind_get_gpus(handle);
+  for (apart = 1, i = 0; i < 5; i++)
+    if (i != 2 && (hwloc_bitmap_intersects(cpus[i], numa->cpuset) ||
+                   hwloc_bitmap_intersects(gpus[i], gpus[2])))
+      apart = 0;
+  ok(mpibind_get_leader(handle, &domain) == 2 &&
+     domain == MPIBIND_LEADER_NUMA &&
+     hwloc_bitmap_weight(cpus[2]) == 20 &&
+     hwloc_bitmap_weight(gpus[2]) == 2 && apart,
+     "The leader task gets a NUMA domain of its own");
+
+  mpibind_set_ntasks(handle, 2);
+  ok(mpibind(handle) == 1,
+     "mpibind fails when the leader task is out of range");
+
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_leader();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,81 @@
+#include "test_utils.h"
+
+/**Test the L3-aware placement**/
+static int max_l3_per_task(hwloc_topology_t topo, mpibind_t *handle) {
+  hwloc_bitmap_t *cpus = mpibind_get_cpus(handle);
+  hwloc_obj_t l3;
+  int t, n, max = 0;
+
+  for (t = 0; t < mpibind_get_ntasks(handle); t++) {
+    n = 0;
+    l3 = NULL;
+    while ((l3 = hwloc_get_next_obj_by_type(topo, HWLOC_OBJ_L3CACHE,
+                                            l3)) != NULL)
+      if (hwloc_bitmap_intersects(l3->cpuset, cpus[t]))
+        n++;
+    if (n > max)
+      max = n;
+  }
+
+  return max;
+}
+
+int test_llc() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_obj_t l3;
+  hwloc_bitmap_t *cpus;
+  int t, n, balanced;
+
+  /* 16 L3 caches of 3 cores each */
+  load_xml_topology(&topo, "../topo-xml/epyc-corona.xml", 0);
+
+  diag("Testing the L3-aware placement");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+
+  ok(mpibind_get_llc(handle) == 0,
+     "The L3-aware placement is off by default");
+  ok(mpibind_set_llc(handle, 2) == 1 && mpibind_set_llc(handle, -1) == 1,
+     "mpibind_set_llc rejects invalid values");
+
+  mpibind_set_ntasks(handle, 20);
+  mpibind(handle);
+  ok(max_l3_per_task(topo, handle) > 1,
+     "Without llc some of 20 tasks span two L3 caches");
+
+  mpibind_set_llc(handle, 1);
+  mpibind(handle);
+  ok(mpibind_get_llc(handle) == 1 && max_l3_per_task(topo, handle) == 1,
+     "With llc each of 20 tasks stays within one L3 cache");
+
+  /* One task per L3 cache */
+  mpibind_set_ntasks(handle, 16);
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  balanced = (max_l3_per_task(topo, handle) == 1);
+  l3 = NULL;
+  while (balanced &&
+         (l3 = hwloc_get_next_obj_by_type(topo, HWLOC_OBJ_L3CACHE,
+                                          l3)) != NULL) {
+    for (n = 0, t = 0; t < 16; t++)
+      if (hwloc_bitmap_intersects(l3->cpuset, cpus[t]))
+        n++;
+    if (n != 1)
+      balanced = 0;
+  }
+  ok(balanced, "With llc 16 tasks get one L3 cache each");
+
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_llc();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,47 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test that the load time is reported without changing the topology**/
+int test_load_time() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  double usecs[MPIBIND_NUM_TIMERS];
+  double load = 0;
+  int i, timed = 1;
+
+  diag("Testing the load time of topologies");
+
+  for (i = 0; i < 2; i++) {
+    hwloc_topology_init(&topo);
+    hwloc_topology_set_xml(topo, XML_PATH);
+    if (mpibind_load_topology_cached(topo, NULL, &load) != 0 || load <= 0)
+      timed = 0;
+    hwloc_topology_destroy(topo);
+  }
+  ok(timed, "mpibind_load_topology_cached returns the load time");
+
+  hwloc_topology_init(&topo);
+  hwloc_topology_set_xml(topo, XML_PATH);
+  mpibind_load_topology(topo);
+  ok(hwloc_obj_get_info_by_name(hwloc_get_root_obj(topo),
+                                "mpibindLoadTime") == NULL,
+     "Loading a topology does not add attributes to it");
+  hwloc_topology_destroy(topo);
+
+  /* A handle without a topology loads its own */
+  mpibind_init(&handle);
+  mpibind_set_ntasks(handle, 2);
+  ok(mpibind(handle) == 0 && mpibind_get_timers(handle, usecs) == 0 &&
+     usecs[MPIBIND_TIMER_LOAD] > 0,
+     "A handle accounts for the topology it loads");
+  mpibind_finalize(handle);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_load_time();
+  done_testing();
+  return (0);
+}
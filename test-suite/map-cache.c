@@ -0,0 +1,195 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the mapping cache shared by threads and processes**/
+#define MAP_CACHE_FILE "map-cache.test"
+#define MAP_CACHE_THREADS 8
+
+struct cached_task {
+  hwloc_topology_t topo;
+  hwloc_bitmap_t cpus;
+};
+
+static void* cached_task_map(void *arg) {
+  struct cached_task *task = arg;
+  mpibind_t *handle;
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, task->topo);
+  mpibind_set_ntasks(handle, 4);
+  mpibind_set_map_cache(handle, 1, NULL);
+  if (mpibind(handle) == 0)
+    hwloc_bitmap_copy(task->cpus, mpibind_get_cpus(handle)[3]);
+  mpibind_finalize(handle);
+
+  return NULL;
+}
+
+/*
+ * Map 'ntasks' tasks in a new process, so that the mapping
+ * can only come from the cache file. Returns the number of
+ * cache hits of the mapping, or -1 if the mapping has unknown CPUs or GPUs.
+ */
+static int map_in_child(hwloc_topology_t topo, int ntasks, int nthreads) {
+  mpibind_t *handle;
+  hwloc_const_bitmap_t root = hwloc_get_root_obj(topo)->cpuset;
+  int i, hits, prev, status, rc = 0;
+  pid_t pid;
+
+  /* Do not print the pending test output twice */
+  fflush(stdout);
+  if ((pid = fork()) < 0)
+    return -1;
+
+  if (pid == 0) {
+    mpibind_init(&handle);
+    mpibind_set_topology(handle, topo);
+    mpibind_set_ntasks(handle, ntasks);
+    mpibind_set_nthreads(handle, nthreads);
+    mpibind_set_map_cache(handle, 1, MAP_CACHE_FILE);
+    mpibind_get_map_cache_stats(&prev, NULL);
+    if (mpibind(handle) != 0)
+      rc = -1;
+    for (i=0; rc == 0 && i<ntasks; i++)
+      if (!hwloc_bitmap_isincluded(mpibind_get_cpus(handle)[i], root) ||
+          hwloc_bitmap_isset(mpibind_get_gpus(handle)[i], 99))
+        rc = -1;
+    mpibind_get_map_cache_stats(&hits, NULL);
+    mpibind_finalize(handle);
+    _exit((rc < 0) ? 255 : hits - prev);
+  }
+
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+    return -1;
+
+  return (WEXITSTATUS(status) == 255) ? -1 : WEXITSTATUS(status);
+}
+
+static int count_lines(const char *path) {
+  FILE *fp = fopen(path, "r");
+  int c, n = 0;
+
+  if (fp == NULL)
+    return 0;
+  while ((c = fgetc(fp)) != EOF)
+    if (c == '\n')
+      n++;
+  fclose(fp);
+
+  return n;
+}
+
+/* Replace 'old' with 'new' in the only line of the cache file */
+static int tamper_map_cache(const char *old, const char *new) {
+  char line[1024], *str;
+  FILE *fp = fopen(MAP_CACHE_FILE, "r");
+  int rc = 1;
+
+  if (fp == NULL)
+    return 1;
+  if (fgets(line, sizeof(line), fp) == NULL)
+    line[0] = '\0';
+  fclose(fp);
+
+  if ((str = replace_str(line, old, new)) != NULL &&
+      (fp = fopen(MAP_CACHE_FILE, "w")) != NULL) {
+    fputs(str, fp);
+    fclose(fp);
+    rc = 0;
+  }
+  free(str);
+
+  return rc;
+}
+
+int test_map_cache() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  pthread_t threads[MAP_CACHE_THREADS];
+  struct cached_task tasks[MAP_CACHE_THREADS];
+  hwloc_bitmap_t ref;
+  pid_t pids[4];
+  int i, j, hits, status, same;
+
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing the mapping cache");
+
+  /* Handles of several threads share the in-memory cache */
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 4);
+  mpibind_set_map_cache(handle, 1, NULL);
+  mpibind(handle);
+  ref = hwloc_bitmap_dup(mpibind_get_cpus(handle)[3]);
+  mpibind_finalize(handle);
+
+  for (i=0; i<MAP_CACHE_THREADS; i++) {
+    tasks[i].topo = topo;
+    tasks[i].cpus = hwloc_bitmap_alloc();
+    pthread_create(&threads[i], NULL, cached_task_map, &tasks[i]);
+  }
+  same = 1;
+  for (i=0; i<MAP_CACHE_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    if (!hwloc_bitmap_isequal(tasks[i].cpus, ref))
+      same = 0;
+    hwloc_bitmap_free(tasks[i].cpus);
+  }
+  mpibind_get_map_cache_stats(&hits, NULL);
+  ok(same && hits == MAP_CACHE_THREADS,
+     "Concurrent handles share the cached mapping");
+  hwloc_bitmap_free(ref);
+
+  /* Concurrent misses save the mapping once */
+  unlink(MAP_CACHE_FILE);
+  fflush(stdout);
+  for (i=0; i<4; i++)
+    if ((pids[i] = fork()) == 0)
+      _exit(map_in_child(topo, 4, 1) < 0);
+  for (i=0, j=0; i<4; i++)
+    if (pids[i] > 0 && waitpid(pids[i], &status, 0) == pids[i] &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0)
+      j++;
+  ok(j == 4 && count_lines(MAP_CACHE_FILE) == 1,
+     "Concurrent processes save a mapping once");
+  ok(map_in_child(topo, 4, 1) == 1,
+     "A mapping saved by a process is reused by another");
+
+  /* Mappings that do not fit the topology are not used.
+     The last task gets PUs 136-168 and GPU 7 */
+  ok(tamper_map_cache(",168:", ",9000:") == 0 &&
+     map_in_child(topo, 4, 1) == 0,
+     "A cached mapping with unknown CPUs is not used");
+  ok(tamper_map_cache(",9000:7", ",168:99") == 0 &&
+     map_in_child(topo, 4, 1) == 0,
+     "A cached mapping with unknown GPUs is not used");
+
+  /* The cache file does not grow without bound */
+  unlink(MAP_CACHE_FILE);
+  fflush(stdout);
+  if ((pids[0] = fork()) == 0) {
+    for (i=1; i<=20; i++)
+      for (j=1; j<=16; j++)
+        map_in_child(topo, i, j);
+    _exit(0);
+  }
+  waitpid(pids[0], &status, 0);
+  ok(count_lines(MAP_CACHE_FILE) > 0 && count_lines(MAP_CACHE_FILE) <= 256,
+     "The cache file keeps a bounded number of mappings");
+
+  unlink(MAP_CACHE_FILE);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_map_cache();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,63 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the NUMA domains and memory policy of each task**/
+int test_membind() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_bitmap_t *cpus, *mems, set;
+  int t, match;
+
+  load_xml_topology(&topo, XML_PATH, 0);
+
+  diag("Testing the NUMA domains of each task");
+
+  set = hwloc_bitmap_alloc();
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 4);
+
+  ok(mpibind_get_membind(handle) == MPIBIND_MEMBIND_NONE,
+     "The default memory policy is none");
+  ok(mpibind_set_membind(handle, -1) == 1 &&
+     mpibind_set_membind(handle, MPIBIND_MEMBIND_PREFERRED+1) == 1,
+     "mpibind_set_membind rejects invalid policies");
+  ok(mpibind_set_membind(handle, MPIBIND_MEMBIND_INTERLEAVE) == 0 &&
+     mpibind_get_membind(handle) == MPIBIND_MEMBIND_INTERLEAVE,
+     "mpibind_set_membind sets the memory policy");
+  ok(mpibind_parse_membind("none") == MPIBIND_MEMBIND_NONE &&
+     mpibind_parse_membind("bind") == MPIBIND_MEMBIND_BIND &&
+     mpibind_parse_membind("interleave") == MPIBIND_MEMBIND_INTERLEAVE &&
+     mpibind_parse_membind("preferred") == MPIBIND_MEMBIND_PREFERRED &&
+     mpibind_parse_membind("strict") == -1,
+     "mpibind_parse_membind maps policy names");
+
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  mems = mpibind_get_mems(handle);
+
+  /* Two tasks per NUMA domain */
+  match = (mems != NULL);
+  for (t = 0; match && t < 4; t++) {
+    hwloc_cpuset_to_nodeset(topo, cpus[t], set);
+    if (hwloc_bitmap_weight(mems[t]) != 1 ||
+        !hwloc_bitmap_isequal(mems[t], set) ||
+        !hwloc_bitmap_isequal(mems[t], mems[t - t%2]))
+      match = 0;
+  }
+  ok(match && !hwloc_bitmap_isequal(mems[0], mems[2]),
+     "Each task gets the NUMA domain of its CPUs");
+
+  hwloc_bitmap_free(set);
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_membind();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,79 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the quality metrics of a mapping**/
+int test_metrics() {
+  mpibind_t *handle, *dst;
+  hwloc_topology_t topo;
+  mpibind_metrics_t m;
+  const char *buf;
+  size_t size;
+
+  /* Keep PCI devices: The metrics include GPUs */
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing the quality metrics of a mapping");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  ok(mpibind_get_metrics(handle, &m) == 1,
+     "mpibind_get_metrics fails before a mapping");
+
+  /* One task per GPU */
+  mpibind_set_ntasks(handle, 4);
+  mpibind(handle);
+  ok(mpibind_get_metrics(handle, &m) == 0 && m.ntasks == 4 &&
+     m.min_pus == m.max_pus && m.pu_imbalance == 0 &&
+     m.min_gpus == 1 && m.max_gpus == 1 && m.gpu_imbalance == 0,
+     "A balanced mapping has no imbalance");
+  ok(m.gpu_numa_affinity == 1 && m.gpu_l3_affinity >= 0,
+     "The tasks share a NUMA domain with their GPUs");
+  ok(m.cross_numa == 0 && m.cross_package == 0 &&
+     m.shared_cores == 0 && m.shared_tasks == 0,
+     "The tasks do not cross NUMA domains or share cores");
+
+  /* Two tasks on the first socket and one on the second */
+  mpibind_set_ntasks(handle, 3);
+  mpibind(handle);
+  mpibind_get_metrics(handle, &m);
+  ok(m.max_pus == 2*m.min_pus && m.pu_imbalance > 0.49 &&
+     m.pu_imbalance < 0.51,
+     "The PU imbalance is max/mean - 1");
+
+  /* A single task takes the whole node */
+  mpibind_set_ntasks(handle, 1);
+  mpibind(handle);
+  mpibind_get_metrics(handle, &m);
+  ok(m.cross_numa == 1 && m.cross_package == 1,
+     "A task spanning both sockets crosses NUMA and package boundaries");
+
+  /* More tasks than cores */
+  mpibind_set_ntasks(handle, 80);
+  mpibind(handle);
+  mpibind_get_metrics(handle, &m);
+  ok(m.shared_cores == 40 && m.shared_tasks == 80,
+     "Tasks on the hardware threads of a core share the core");
+
+  ok(mpibind_metrics_snprint(NULL, 0, handle) > 0,
+     "mpibind_metrics_snprint returns the length of the metrics");
+
+  /* An imported mapping has no topology */
+  mpibind_export(handle, MPIBIND_FORMAT_BINARY, &buf, &size);
+  mpibind_init(&dst);
+  mpibind_import(dst, MPIBIND_FORMAT_BINARY, buf, size);
+  ok(mpibind_get_metrics(dst, &m) == 1,
+     "mpibind_get_metrics fails without a topology");
+  mpibind_finalize(dst);
+
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_metrics();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,77 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the assignment of NICs to tasks**/
+int test_nics() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_obj_t obj;
+  char **nics, *ucx;
+  int i, k, t, n, local, balanced;
+  int ntasks[] = {2, 4, 8};
+  int nnics[] = {2, 1, 1};
+
+  /* Keep PCI devices: The NICs are PCI devices */
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing the assignment of NICs");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+
+  /* Two InfiniBand NICs per socket */
+  for (k = 0; k < 3; k++) {
+    mpibind_set_ntasks(handle, ntasks[k]);
+    mpibind(handle);
+
+    local = balanced = 1;
+    for (t = 0; t < ntasks[k]; t++) {
+      nics = mpibind_get_nics_ptask(handle, t, &n);
+      if (nics == NULL || n != nnics[k]) {
+        balanced = 0;
+        break;
+      }
+      for (i = 0; i < n; i++) {
+        obj = NULL;
+        while ((obj = hwloc_get_next_osdev(topo, obj)) != NULL)
+          if (strcmp(obj->name, nics[i]) == 0)
+            break;
+        if (obj == NULL ||
+            !hwloc_bitmap_intersects(hwloc_get_non_io_ancestor_obj(topo,
+                                                                   obj)->cpuset,
+                                     mpibind_get_cpus(handle)[t]))
+          local = 0;
+      }
+      /* Tasks of a socket share its NICs evenly */
+      if (ntasks[k] == 8 &&
+          !hwloc_bitmap_isequal(mpibind_get_nics(handle)[t],
+                                mpibind_get_nics(handle)[t - t%2]))
+        balanced = 0;
+    }
+    ok(mpibind_get_num_nics(handle) == 4 && local && balanced,
+       "%d tasks get %d local NIC(s) each", ntasks[k], nnics[k]);
+  }
+
+  mpibind_set_env_vars(handle);
+  ucx = mpibind_get_env_var_ptask(handle, 2, "UCX_NET_DEVICES");
+  nics = mpibind_get_nics_ptask(handle, 2, &n);
+  ok(ucx != NULL && n == 1 && strncmp(ucx, nics[0], strlen(nics[0])) == 0 &&
+     strcmp(ucx + strlen(nics[0]), ":1") == 0,
+     "UCX_NET_DEVICES selects the NIC of a task");
+  ok(mpibind_get_env_var_ptask(handle, 2, "FI_CXI_DEVICE_NAME") == NULL,
+     "FI_CXI_DEVICE_NAME is not set without Slingshot NICs");
+  ok(mpibind_get_nics_ptask(handle, 8, &n) == NULL,
+     "mpibind_get_nics_ptask checks its input");
+
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_nics();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,44 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test printing a mapping of any size**/
+int test_mapping_snprint() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  char *buf;
+  int len, n;
+
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing the output of a mapping");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 8);
+  mpibind(handle);
+
+  len = mpibind_mapping_snprint(NULL, 0, handle);
+  buf = malloc(len + 1);
+  ok(len > 0 && mpibind_mapping_snprint(buf, len + 1, handle) == len &&
+     strlen(buf) == len,
+     "mpibind_mapping_snprint returns the size of the mapping");
+
+  /* A short buffer keeps whole lines only */
+  n = mpibind_mapping_snprint(buf, len/2, handle);
+  ok(n == len && strlen(buf) < len/2 &&
+     (buf[0] == '\0' || buf[strlen(buf)-1] == '\n'),
+     "mpibind_mapping_snprint truncates the mapping at a line");
+  free(buf);
+
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_mapping_snprint();
+  done_testing();
+  return (0);
+}
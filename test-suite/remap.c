@@ -0,0 +1,76 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test re-mapping a job that grows and shrinks**/
+int test_remap() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_obj_t numa;
+  hwloc_bitmap_t *cpus;
+  int i, n, *moved;
+
+  load_xml_topology(&topo, XML_PATH, 0);
+
+  diag("Testing the re-mapping of malleable jobs");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  ok(mpibind_set_previous(handle, 2, NULL, NULL) == 1,
+     "mpibind_set_previous checks its input");
+
+  /* One task per socket */
+  mpibind_set_ntasks(handle, 2);
+  mpibind(handle);
+  ok(mpibind_get_moved(handle) == NULL,
+     "mpibind_get_moved returns NULL without a previous mapping");
+
+  /* Grow: Task 1 keeps its socket and the new task goes to
+     the first socket, which has room for one more task */
+  mpibind_set_previous(handle, 2, mpibind_get_cpus(handle),
+                       mpibind_get_gpus(handle));
+  mpibind_set_ntasks(handle, 3);
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  moved = mpibind_get_moved(handle);
+  numa = hwloc_get_obj_by_type(topo, HWLOC_OBJ_NUMANODE, 0);
+  ok(moved != NULL && moved[0] == MPIBIND_TASK_MOVED &&
+     moved[1] == MPIBIND_TASK_UNCHANGED && moved[2] == MPIBIND_TASK_NEW &&
+     hwloc_bitmap_isincluded(cpus[0], numa->cpuset) &&
+     hwloc_bitmap_isincluded(cpus[2], numa->cpuset),
+     "Growing a job does not move a task to another socket");
+
+  /* Shrink: The tasks stay in their sockets */
+  mpibind_set_previous(handle, 3, cpus, mpibind_get_gpus(handle));
+  mpibind_set_ntasks(handle, 2);
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  moved = mpibind_get_moved(handle);
+  ok(moved[0] == MPIBIND_TASK_MOVED && moved[1] == MPIBIND_TASK_UNCHANGED &&
+     hwloc_bitmap_isincluded(cpus[0], numa->cpuset),
+     "Shrinking a job keeps the tasks in their sockets");
+
+  /* The same number of tasks */
+  mpibind_set_previous(handle, 2, cpus, NULL);
+  mpibind(handle);
+  moved = mpibind_get_moved(handle);
+  for (n = 0, i = 0; i < 2; i++)
+    n += (moved[i] == MPIBIND_TASK_UNCHANGED);
+  ok(n == 2, "No task moves if the job does not change");
+
+  mpibind_set_previous(handle, 0, NULL, NULL);
+  mpibind(handle);
+  ok(mpibind_get_moved(handle) == NULL,
+     "mpibind_set_previous removes the previous mapping");
+
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_remap();
+  done_testing();
+  return (0);
+}
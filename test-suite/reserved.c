@@ -0,0 +1,87 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the reservation of cores for the OS**/
+int test_reserved() {
+  mpibind_t *handle;
+  hwloc_topology_t topo, topo2;
+  hwloc_obj_t pkg, core;
+  hwloc_bitmap_t *cpus, resv;
+  int n, dom, end, ncores, core_depth;
+
+  load_xml_topology(&topo, XML_PATH, 0);
+
+  diag("Testing the reservation of cores");
+
+  ok(mpibind_parse_reserved("1:package", &n, &dom, &end) == 0 &&
+     n == 1 && dom == MPIBIND_RESERVE_PACKAGE && end == 1 &&
+     mpibind_parse_reserved("2:first:numa", &n, &dom, &end) == 0 &&
+     n == 2 && dom == MPIBIND_RESERVE_NUMA && end == 0 &&
+     mpibind_parse_reserved("4", &n, &dom, &end) == 0 &&
+     n == 4 && dom == MPIBIND_RESERVE_NODE && end == 1,
+     "mpibind_parse_reserved parses valid reservations");
+  ok(mpibind_parse_reserved("", &n, &dom, &end) == 1 &&
+     mpibind_parse_reserved("-1", &n, &dom, &end) == 1 &&
+     mpibind_parse_reserved("1:socket", &n, &dom, &end) == 1 &&
+     mpibind_parse_reserved("1package", &n, &dom, &end) == 1,
+     "mpibind_parse_reserved rejects invalid reservations");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 2);
+
+  ok(mpibind_get_reserved(handle, &dom, &end) == 0,
+     "No cores are reserved by default");
+  ok(mpibind_set_reserved(handle, -1, MPIBIND_RESERVE_NODE, 1) == 1 &&
+     mpibind_set_reserved(handle, 1, MPIBIND_RESERVE_NUMA+1, 1) == 1 &&
+     mpibind_set_reserved(handle, 1, MPIBIND_RESERVE_NODE, 2) == 1,
+     "mpibind_set_reserved rejects invalid values");
+
+  /* The last core of each package */
+  resv = hwloc_bitmap_alloc();
+  core_depth = mpibind_get_core_depth(topo);
+  ncores = hwloc_get_nbobjs_by_depth(topo, core_depth);
+  pkg = NULL;
+  while ((pkg = hwloc_get_next_obj_by_type(topo, HWLOC_OBJ_PACKAGE,
+                                           pkg)) != NULL) {
+    n = hwloc_get_nbobjs_inside_cpuset_by_depth(topo, pkg->cpuset,
+                                                core_depth);
+    core = hwloc_get_obj_inside_cpuset_by_depth(topo, pkg->cpuset,
+                                                core_depth, n-1);
+    hwloc_bitmap_or(resv, resv, core->cpuset);
+  }
+
+  mpibind_set_reserved(handle, 1, MPIBIND_RESERVE_PACKAGE, 1);
+  ok(mpibind(handle) == 0, "mpibind succeeds with reserved cores");
+  cpus = mpibind_get_cpus(handle);
+  ok(!hwloc_bitmap_intersects(cpus[0], resv) &&
+     !hwloc_bitmap_intersects(cpus[1], resv) &&
+     hwloc_get_nbobjs_by_depth(topo, core_depth) ==
+     ncores - hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_PACKAGE),
+     "Tasks do not use the last core of each package");
+
+  mpibind_set_reserved(handle, 2, MPIBIND_RESERVE_PACKAGE, 1);
+  ok(mpibind(handle) != 0,
+     "mpibind fails if the reservation changes for the same topology");
+
+  /* A new topology takes a new reservation */
+  load_xml_topology(&topo2, XML_PATH, 0);
+  mpibind_set_topology(handle, topo2);
+  mpibind_set_reserved(handle, ncores, MPIBIND_RESERVE_NODE, 1);
+  ok(mpibind(handle) != 0,
+     "mpibind fails if no cores are left");
+
+  hwloc_bitmap_free(resv);
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo2);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_reserved();
+  done_testing();
+  return (0);
+}
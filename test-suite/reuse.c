@@ -0,0 +1,55 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test computing several mappings with the same handle**/
+int test_handle_reuse() {
+  mpibind_t *reused, *fresh;
+  hwloc_topology_t topo;
+  int i, k, same;
+  int ntasks[] = {4, 8, 2};
+
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing mappings with a reused handle");
+
+  mpibind_init(&reused);
+  mpibind_set_topology(reused, topo);
+
+  for (k = 0; k < 3; k++) {
+    mpibind_set_ntasks(reused, ntasks[k]);
+    mpibind(reused);
+
+    mpibind_init(&fresh);
+    mpibind_set_topology(fresh, topo);
+    mpibind_set_ntasks(fresh, ntasks[k]);
+    mpibind(fresh);
+
+    same = 1;
+    for (i = 0; i < ntasks[k]; i++)
+      if (!hwloc_bitmap_isequal(mpibind_get_cpus(reused)[i],
+                                mpibind_get_cpus(fresh)[i]) ||
+          !hwloc_bitmap_isequal(mpibind_get_gpus(reused)[i],
+                                mpibind_get_gpus(fresh)[i]))
+        same = 0;
+    ok(same, "Reused handle maps %d tasks like a new handle",
+       ntasks[k]);
+
+    mpibind_finalize(fresh);
+  }
+
+  mpibind_reset(reused);
+  ok(mpibind_get_cpus(reused) == NULL,
+     "mpibind_reset releases the mapping");
+
+  mpibind_finalize(reused);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_handle_reuse();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,297 @@
+#include <stdlib.h>
+#include <time.h>
+#include "test_utils.h"
+
+/*
+ * Scaling tests: Run mpibind over a grid of synthetic topologies
+ * and numbers of tasks, check the properties every mapping must
+ * have, and check that the mapping time does not grow faster
+ * than expected as the topology grows.
+ */
+
+/* Synthetic topologies: packages x NUMAs x L3s x cores x PUs */
+static const char *grid[] = {
+  "pack:1 numa:1 l3:1 core:4 pu:1",
+  "pack:1 numa:2 l3:1 core:8 pu:2",
+  "pack:2 numa:1 l3:2 core:6 pu:2",
+  "pack:2 numa:2 l3:2 core:8 pu:4",
+  "pack:2 numa:4 l3:2 core:12 pu:2",
+  "pack:4 numa:2 l3:4 core:8 pu:8",
+  "pack:8 numa:4 l3:2 core:16 pu:2",
+  "pack:16 numa:4 l3:2 core:16 pu:2",
+};
+
+/* Topologies with GPUs (synthetic topologies have no I/O devices) */
+static const char *gpu_xmls[] = {
+  "../topo-xml/coral-lassen.xml",
+  "../topo-xml/epyc-corona-p2.xml",
+  "../topo-xml/eas-tioga.xml",
+  "../topo-xml/cts1-pascal.xml",
+  "../topo-xml/g4dnmetal.xml",
+};
+
+/*
+ * The mapping of 'ntasks' tasks is valid if every task has
+ * CPUs and, with no more tasks than PUs, no two tasks share a PU.
+ */
+static int valid_mapping(mpibind_t *handle, int ntasks, int npus) {
+  hwloc_bitmap_t *cpus = mpibind_get_cpus(handle);
+  hwloc_bitmap_t all = hwloc_bitmap_alloc();
+  int i, sum = 0, rc = 1;
+
+  for (i=0; i<ntasks; i++) {
+    if (hwloc_bitmap_iszero(cpus[i]))
+      rc = 0;
+    sum += hwloc_bitmap_weight(cpus[i]);
+    hwloc_bitmap_or(all, all, cpus[i]);
+  }
+  if (ntasks <= npus && sum != hwloc_bitmap_weight(all))
+    rc = 0;
+
+  hwloc_bitmap_free(all);
+  return rc;
+}
+
+int test_grid() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  int t, i, npus, ntasks[6], nvalid, nruns;
+
+  diag("Testing mappings over a grid of synthetic topologies");
+
+  for (t=0; t<sizeof(grid)/sizeof(grid[0]); t++) {
+    hwloc_topology_init(&topo);
+    hwloc_topology_set_synthetic(topo, grid[t]);
+    hwloc_topology_load(topo);
+    npus = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_PU);
+
+    /* One task, one per NUMA, one per core, one per PU,
+       and a few odd numbers */
+    ntasks[0] = 1;
+    ntasks[1] = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_NUMANODE);
+    ntasks[2] = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_CORE);
+    ntasks[3] = npus;
+    ntasks[4] = ntasks[2] + 1;
+    ntasks[5] = npus/3 + 1;
+
+    nvalid = nruns = 0;
+    for (i=0; i<sizeof(ntasks)/sizeof(ntasks[0]); i++) {
+      mpibind_init(&handle);
+      mpibind_set_topology(handle, topo);
+      mpibind_set_ntasks(handle, ntasks[i]);
+      mpibind_set_greedy(handle, 0);
+      nruns++;
+      if (mpibind(handle) == 0 && valid_mapping(handle, ntasks[i], npus))
+	nvalid++;
+      else
+	diag("%s: invalid mapping of %d tasks", grid[t], ntasks[i]);
+      mpibind_finalize(handle);
+
+      /* Same with an L3 per task when possible */
+      mpibind_init(&handle);
+      mpibind_set_topology(handle, topo);
+      mpibind_set_ntasks(handle, ntasks[i]);
+      mpibind_set_llc(handle, 1);
+      nruns++;
+      if (mpibind(handle) == 0 && valid_mapping(handle, ntasks[i], npus))
+	nvalid++;
+      else
+	diag("%s: invalid L3 mapping of %d tasks", grid[t], ntasks[i]);
+      mpibind_finalize(handle);
+    }
+
+    ok(nvalid == nruns,
+       "Tasks are non-empty and disjoint on %s", grid[t]);
+
+    hwloc_topology_destroy(topo);
+  }
+
+  return 0;
+}
+
+/*
+ * GPUs are shared evenly: When the number of tasks divides the
+ * number of GPUs, every task gets the same number of GPUs, and
+ * when it is a multiple of it, every GPU gets the same number
+ * of tasks.
+ */
+static int balanced_gpus(mpibind_t *handle, int ntasks, int ngpus) {
+  hwloc_bitmap_t *gpus = mpibind_get_gpus(handle);
+  hwloc_bitmap_t all = hwloc_bitmap_alloc();
+  int i, k, sum = 0, rc = 1;
+
+  for (i=0; i<ntasks; i++) {
+    k = hwloc_bitmap_weight(gpus[i]);
+    if (ntasks <= ngpus && k != ngpus/ntasks)
+      rc = 0;
+    if (ntasks > ngpus && k != 1)
+      rc = 0;
+    sum += k;
+    hwloc_bitmap_or(all, all, gpus[i]);
+  }
+  /* Every GPU is used the same number of times */
+  if (hwloc_bitmap_weight(all) != ngpus ||
+      sum != ngpus * ((ntasks > ngpus) ? ntasks/ngpus : 1))
+    rc = 0;
+
+  hwloc_bitmap_free(all);
+  return rc;
+}
+
+int test_gpu_balance() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  int t, n, ngpus, nbalanced, nruns;
+
+  diag("Testing the balance of GPUs among tasks");
+
+  for (t=0; t<sizeof(gpu_xmls)/sizeof(gpu_xmls[0]); t++) {
+    load_topology(&topo, (char *)gpu_xmls[t]);
+
+    mpibind_init(&handle);
+    mpibind_set_topology(handle, topo);
+    mpibind_set_ntasks(handle, 1);
+    ngpus = (mpibind(handle) == 0) ? mpibind_get_num_gpus(handle) : 0;
+    mpibind_finalize(handle);
+
+    nbalanced = nruns = 0;
+    for (n=1; n<=4*ngpus; n++) {
+      if (ngpus % n != 0 && n % ngpus != 0)
+	continue;
+      mpibind_init(&handle);
+      mpibind_set_topology(handle, topo);
+      mpibind_set_ntasks(handle, n);
+      mpibind_set_gpu_optim(handle, 1);
+      nruns++;
+      if (mpibind(handle) == 0 && balanced_gpus(handle, n, ngpus))
+	nbalanced++;
+      else
+	diag("%s: %d tasks do not share %d GPUs evenly",
+	     gpu_xmls[t], n, ngpus);
+      mpibind_finalize(handle);
+    }
+
+    ok(ngpus > 0 && nbalanced == nruns,
+       "GPUs are shared evenly on %s", gpu_xmls[t]);
+
+    hwloc_topology_destroy(topo);
+  }
+
+  return 0;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * The best of a few runs of mpibind with a task per core.
+ * Returns the time in seconds or -1 on error. 'nbytes' gets
+ * the output memory of a run (see mpibind_get_mem_stats).
+ */
+static double mapping_time(hwloc_topology_t topo, int ntasks,
+                           size_t *nbytes) {
+  mpibind_t *handle;
+  double start, best = -1;
+  int r, nallocs, nchunks;
+
+  for (r=0; r<5; r++) {
+    mpibind_init(&handle);
+    mpibind_set_topology(handle, topo);
+    mpibind_set_ntasks(handle, ntasks);
+    start = now();
+    if (mpibind(handle) != 0) {
+      mpibind_finalize(handle);
+      return -1;
+    }
+    start = now() - start;
+    if (best < 0 || start < best)
+      best = start;
+    mpibind_get_mem_stats(handle, &nallocs, &nchunks, nbytes);
+    mpibind_finalize(handle);
+  }
+
+  return best;
+}
+
+/*
+ * Doubling the topology and the number of tasks should cost
+ * at most 4x in time (quadratic: one bitmap per task whose
+ * length grows with the topology) and 2x in output memory
+ * (a mapping per task). The memory is deterministic and
+ * always checked. The time is checked from the first time of
+ * at least MIN_TIME, the shortest measured reliably, to the
+ * last one, which averages out the noise of single doublings.
+ * Wall-clock times also depend on the load of the machine,
+ * so the time is only checked if MPIBIND_TEST_TIMING is set;
+ * otherwise it is only reported.
+ */
+#define MAX_GROWTH 4.0
+#define MAX_MEM_GROWTH 2.0
+#define MIN_TIME 1e-3
+
+int test_complexity() {
+  hwloc_topology_t topo;
+  char str[128];
+  double cur, first = -1, growth = 0, limit = 1;
+  size_t prev_bytes = 0, nbytes = 0;
+  int p, ncores, ndoublings = 0, nmem = 0, nsmall = 0, fail = 0;
+
+  diag("Testing the growth of the mapping time and memory");
+
+  for (p=4; p<=64; p*=2) {
+    snprintf(str, sizeof(str), "pack:%d numa:4 l3:2 core:16 pu:2", p);
+    hwloc_topology_init(&topo);
+    hwloc_topology_set_synthetic(topo, str);
+    hwloc_topology_load(topo);
+    ncores = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_CORE);
+
+    cur = mapping_time(topo, ncores, &nbytes);
+    diag("%s: %d tasks in %.2f ms and %zu bytes",
+         str, ncores, cur*1e3, nbytes);
+    if (cur < 0)
+      fail = 1;
+    else if (first > 0) {
+      ndoublings++;
+      growth = cur / first;
+      limit *= MAX_GROWTH;
+    } else if (cur >= MIN_TIME)
+      first = cur;
+
+    if (prev_bytes > 0) {
+      nmem++;
+      if (nbytes <= MAX_MEM_GROWTH * prev_bytes)
+        nsmall++;
+      else
+        diag("%s: memory grew from %zu to %zu bytes",
+             str, prev_bytes, nbytes);
+    }
+    prev_bytes = nbytes;
+
+    hwloc_topology_destroy(topo);
+  }
+
+  ok(!fail && nmem > 0 && nsmall == nmem,
+     "Output memory grows linearly with the topology");
+
+  diag("Mapping time grew %.1fx over %d doublings (at most %.0fx)",
+       growth, ndoublings, limit);
+  if (getenv("MPIBIND_TEST_TIMING"))
+    ok(!fail && ndoublings > 0 && growth <= limit,
+       "Mapping time grows at most quadratically with the topology");
+  else
+    diag("Set MPIBIND_TEST_TIMING to check the mapping time");
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_grid();
+  test_gpu_balance();
+  test_complexity();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,63 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test computing the mappings of a range of task counts**/
+int test_sweep() {
+  mpibind_t *handle, *fresh;
+  mpibind_sweep_t *sweep;
+  hwloc_topology_t topo;
+  hwloc_bitmap_t set;
+  int i, j, k, t, same;
+  int ntasks[] = {4, 8, 2};
+  int smt = 0;
+
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing sweeps over the number of tasks");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+
+  sweep = mpibind_sweep(handle, 1, 8, &smt, 1);
+  ok(sweep != NULL && sweep->npoints == 8,
+     "mpibind_sweep computes 8 mappings");
+  ok(mpibind_sweep(handle, 1, INT_MAX, &smt, 1) == NULL &&
+     mpibind_sweep(handle, INT_MAX-1, INT_MAX, &smt, 1) == NULL,
+     "mpibind_sweep rejects sweeps with too many tasks");
+  set = hwloc_bitmap_alloc();
+
+  for (k = 0; k < 3; k++) {
+    mpibind_init(&fresh);
+    mpibind_set_topology(fresh, topo);
+    mpibind_set_ntasks(fresh, ntasks[k]);
+    mpibind(fresh);
+
+    /* Point ntasks-1 of the sweep has ntasks tasks */
+    same = (sweep != NULL && sweep->rc[ntasks[k]-1] == 0);
+    for (i = 0; same && i < ntasks[k]; i++) {
+      t = sweep->offset[ntasks[k]-1] + i;
+      hwloc_bitmap_zero(set);
+      for (j = sweep->cpu_start[t]; j < sweep->cpu_start[t+1]; j++)
+        hwloc_bitmap_set(set, sweep->cpu_ids[j]);
+      if (!hwloc_bitmap_isequal(set, mpibind_get_cpus(fresh)[i]))
+        same = 0;
+    }
+    ok(same, "Sweep maps %d tasks like a new handle", ntasks[k]);
+
+    mpibind_finalize(fresh);
+  }
+
+  hwloc_bitmap_free(set);
+  mpibind_sweep_free(sweep);
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_sweep();
+  done_testing();
+  return (0);
+}
@@ -109,7 +109,7 @@ void check_mapping(mpibind_t *handle, mpibind_test_out_t *expected) {
   int num_tasks = mpibind_get_ntasks(handle);
 
   /* Use VISIBLE_DEVICES IDs for the GPU mapping */ 
-  mpibind_set_gpu_ids(handle, MPIBIND_ID_VISDEVS);
+  mpibind_set_gpu_ids(handle, MPIBIND_ID_SMI);
 
   // Concat string array into single string
   int i = 0;
@@ -325,6 +325,26 @@ mpibind_test_in_t **generate_test_information(hwloc_topology_t topo) {
   sprintf(handle->restr_set, "%d", pu_id);
   *ptr++ = handle;
 
+  handle = calloc(1, sizeof(mpibind_test_in_t));
+  mpibind_test_in_t_init(handle);
+  // 13: Map two tasks without greedy
+  handle->ntasks = 2;
+  handle->greedy = 0;
+  *ptr++ = handle;
+
+  handle = calloc(1, sizeof(mpibind_test_in_t));
+  mpibind_test_in_t_init(handle);
+  // 14: Map a task to every other NUMA domain without greedy
+  handle->ntasks = (num_numas == 1) ? 1 : num_numas / 2;
+  handle->greedy = 0;
+  *ptr++ = handle;
+
+  handle = calloc(1, sizeof(mpibind_test_in_t));
+  mpibind_test_in_t_init(handle);
+  // 15: Map one and a half tasks per NUMA domain
+  handle->ntasks = num_numas + num_numas / 2;
+  *ptr++ = handle;
+
 
   if( (ptr-tests) / sizeof(mpibind_test_in_t*)){
       printf("Failure!");
@@ -334,20 +354,44 @@ mpibind_test_in_t **generate_test_information(hwloc_topology_t topo) {
   return tests;
 }
 
-/** Load an xml file into a topology **/
-void load_topology(hwloc_topology_t *topo, char *xml_file) {
+/**
+ * Load an xml file into a topology keeping the structure of the
+ * topology and, if 'io' is set, the OS and PCI devices (GPUs and NICs)
+ * **/
+void load_xml_topology(hwloc_topology_t *topo, const char *xml_file,
+                       int io) {
   hwloc_topology_init(topo);
   if (hwloc_topology_set_xml(*topo, xml_file) < 0)
     perror("Failed to set topology");
-  hwloc_topology_set_all_types_filter(*topo, 
+  hwloc_topology_set_all_types_filter(*topo,
       HWLOC_TYPE_FILTER_KEEP_STRUCTURE);
-  hwloc_topology_set_type_filter(*topo, HWLOC_OBJ_OS_DEVICE,
-      HWLOC_TYPE_FILTER_KEEP_IMPORTANT);
-  hwloc_topology_set_type_filter(*topo, HWLOC_OBJ_PCI_DEVICE,
-      HWLOC_TYPE_FILTER_KEEP_IMPORTANT);
+  if (io) {
+    hwloc_topology_set_type_filter(*topo, HWLOC_OBJ_OS_DEVICE,
+        HWLOC_TYPE_FILTER_KEEP_IMPORTANT);
+    hwloc_topology_set_type_filter(*topo, HWLOC_OBJ_PCI_DEVICE,
+        HWLOC_TYPE_FILTER_KEEP_IMPORTANT);
+  }
   hwloc_topology_load(*topo);
 }
 
+/** Load an xml file into a topology **/
+void load_topology(hwloc_topology_t *topo, char *xml_file) {
+  load_xml_topology(topo, xml_file, 1);
+}
+
+/** A copy of 'buf' with the first 'old' replaced by 'new' **/
+char *replace_str(const char *buf, const char *old, const char *new) {
+  const char *at = strstr(buf, old);
+  char *str;
+
+  if (at == NULL)
+    return NULL;
+  str = malloc(strlen(buf) - strlen(old) + strlen(new) + 1);
+  sprintf(str, "%.*s%s%s", (int)(at - buf), buf, new, at + strlen(old));
+
+  return str;
+}
+
 /**
  * Parse a single answer from an answer file
  * An answer consists of three consectutive lines with each line containing
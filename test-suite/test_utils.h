@@ -12,7 +12,7 @@
  * generating tests. This is also used to ensure the number of
  * tests and number of answers are consistent.
  * **/
-#define NUM_TESTS 12
+#define NUM_TESTS 15
 
 /**
  * Representation of a test answer
@@ -72,6 +72,14 @@ void run_test(hwloc_topology_t topo, mpibind_test_in_t *params,  mpibind_test_ou
 mpibind_test_in_t** generate_test_information(hwloc_topology_t);
 /** load an xml file into a topology **/
 void load_topology(hwloc_topology_t* topo, char* xml_file);
+/**
+ * Load an xml file into a topology. With 'io', keep the
+ * GPUs and NICs as load_topology does; without it, keep
+ * the structure of the topology only.
+ * **/
+void load_xml_topology(hwloc_topology_t* topo, const char* xml_file, int io);
+/** A copy of 'buf' with the first 'old' replaced by 'new' **/
+char* replace_str(const char* buf, const char* old, const char* new);
 /**
  * Loads a set of test answers from a file.
  * num_test_ptr will be used to store the number of answers parsed
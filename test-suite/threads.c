@@ -0,0 +1,87 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test the placement of threads within each task**/
+int test_threads() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_bitmap_t all, set;
+  int i, j, k, t, n, nths, *ncpus, **cpus, disjoint, covered, even;
+  int nthreads[] = {10, 20, 80};
+  int weights[] = {4, 2, 1};
+
+  load_xml_topology(&topo, XML_PATH, 0);
+
+  diag("Testing the placement of threads");
+
+  all = hwloc_bitmap_alloc();
+  set = hwloc_bitmap_alloc();
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  mpibind_set_ntasks(handle, 4);
+  mpibind_set_smt(handle, 4);
+
+  /* Each task has 10 cores with 4 PUs each */
+  for (k = 0; k < 3; k++) {
+    mpibind_set_nthreads(handle, nthreads[k]);
+    mpibind(handle);
+
+    disjoint = covered = even = 1;
+    for (t = 0; t < 4; t++) {
+      cpus = mpibind_get_threads_ptask(handle, t, &nths, &ncpus);
+      if (cpus == NULL || nths != nthreads[k]) {
+        covered = 0;
+        break;
+      }
+      hwloc_bitmap_zero(all);
+      n = 0;
+      for (i = 0; i < nths; i++) {
+        if (ncpus[i] != weights[k])
+          even = 0;
+        for (j = 0; j < ncpus[i]; j++) {
+          if (hwloc_bitmap_isset(all, cpus[i][j]))
+            disjoint = 0;
+          hwloc_bitmap_set(all, cpus[i][j]);
+          n++;
+        }
+      }
+      /* More threads than PUs: PUs are shared */
+      if (nths > hwloc_bitmap_weight(mpibind_get_cpus(handle)[t]))
+        disjoint = (n == nths);
+      if (!hwloc_bitmap_isequal(all, mpibind_get_cpus(handle)[t]))
+        covered = 0;
+
+      /* Threads on the same core are adjacent */
+      if (nths == 20) {
+        hwloc_bitmap_zero(set);
+        for (j = 0; j < ncpus[0]; j++)
+          hwloc_bitmap_set(set, cpus[0][j]);
+        for (j = 0; j < ncpus[1]; j++)
+          hwloc_bitmap_set(set, cpus[1][j]);
+        if (hwloc_get_obj_covering_cpuset(topo, set)->type != HWLOC_OBJ_CORE)
+          even = 0;
+      }
+    }
+    ok(covered && disjoint && even,
+       "%d threads per task get %d PU(s) each", nthreads[k], weights[k]);
+  }
+
+  ok(mpibind_get_thread_cpus(handle, 0, 79, &n) != NULL && n == 1 &&
+     mpibind_get_thread_cpus(handle, 0, 80, &n) == NULL &&
+     mpibind_get_thread_cpus(handle, 4, 0, &n) == NULL,
+     "mpibind_get_thread_cpus checks its input");
+
+  hwloc_bitmap_free(all);
+  hwloc_bitmap_free(set);
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_threads();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,46 @@
+#include <unistd.h>
+#include <sys/stat.h>
+#include "test_utils.h"
+
+/**Test that topology snapshots are only used if trusted**/
+#define TOPO_CACHE_FILE "topo-cache.test"
+
+int test_topo_cache() {
+  hwloc_topology_t topo;
+  struct stat st;
+
+  diag("Testing the topology snapshots");
+
+  unlink(TOPO_CACHE_FILE);
+  hwloc_topology_init(&topo);
+  ok(mpibind_load_topology_cached(topo, TOPO_CACHE_FILE, NULL) == 0,
+     "mpibind_load_topology_cached loads the topology");
+  hwloc_topology_destroy(topo);
+
+  /* Snapshots need the boot ID of the kernel */
+  if (stat(TOPO_CACHE_FILE, &st) != 0) {
+    diag("No topology snapshot on this system");
+    return 0;
+  }
+  ok((st.st_mode & 0777) == 0600,
+     "The topology snapshot is only accessible by its owner");
+
+  /* An untrusted snapshot is replaced rather than imported */
+  chmod(TOPO_CACHE_FILE, 0666);
+  hwloc_topology_init(&topo);
+  mpibind_load_topology_cached(topo, TOPO_CACHE_FILE, NULL);
+  hwloc_topology_destroy(topo);
+  ok(stat(TOPO_CACHE_FILE, &st) == 0 && (st.st_mode & 0777) == 0600,
+     "A snapshot writable by others is not used");
+
+  unlink(TOPO_CACHE_FILE);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_topo_cache();
+  done_testing();
+  return (0);
+}
@@ -0,0 +1,88 @@
+#include "test_utils.h"
+#define XML_PATH "../topo-xml/coral-lassen.xml"
+
+/**Test tasks of different weights**/
+int test_weights() {
+  mpibind_t *handle;
+  hwloc_topology_t topo;
+  hwloc_bitmap_t *cpus, *gpus;
+  int i, n, *nthreads;
+  int weights[4], zero[] = {1, 0};
+  int two[] = {3, 1, 1, 1, 3, 1, 1, 1};
+  const int *w;
+
+  /* Keep the GPUs */
+  load_xml_topology(&topo, XML_PATH, 1);
+
+  diag("Testing tasks of different weights");
+
+  ok(mpibind_parse_weights("4,1", 4, weights) == 0 &&
+     weights[0] == 4 && weights[1] == 1 && weights[3] == 1,
+     "mpibind_parse_weights gives weight 1 to the remaining tasks");
+  ok(mpibind_parse_weights("4,x", 4, weights) == 1 &&
+     mpibind_parse_weights("1,1,1,1,1", 4, weights) == 1 &&
+     mpibind_parse_weights("0", 4, weights) == 1,
+     "mpibind_parse_weights checks its input");
+
+  mpibind_init(&handle);
+  mpibind_set_topology(handle, topo);
+  ok(mpibind_set_weights(handle, 2, zero) == 1,
+     "mpibind_set_weights fails with a weight of 0");
+
+  /* A heavy task gets a NUMA domain and its two GPUs */
+  mpibind_parse_weights("3", 4, weights);
+  mpibind_set_ntasks(handle, 4);
+  mpibind_set_weights(handle, 4, weights);
+  weights[0] = 1;
+  w = mpibind_get_weights(handle, &n);
+  ok(n == 4 && w != NULL && w[0] == 3,
+     "mpibind_get_weights returns a copy of the weights");
+
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  gpus = mpibind_get_gpus(handle);
+  nthreads = mpibind_get_nthreads(handle);
+  ok(hwloc_bitmap_weight(cpus[0]) == 20 && nthreads[0] == 20 &&
+     hwloc_bitmap_weight(gpus[0]) == 2,
+     "A task of weight 3 gets a socket and its GPUs");
+  ok(hwloc_bitmap_weight(cpus[1]) == 7 && hwloc_bitmap_weight(cpus[3]) == 6 &&
+     hwloc_bitmap_weight(gpus[1]) == 1 &&
+     hwloc_bitmap_isequal(gpus[2], gpus[3]),
+     "Tasks of weight 1 share the other socket");
+
+  /* Cores are split in proportion to the weights */
+  mpibind_set_ntasks(handle, 8);
+  mpibind_set_weights(handle, 8, two);
+  mpibind(handle);
+  cpus = mpibind_get_cpus(handle);
+  nthreads = mpibind_get_nthreads(handle);
+  for (i = 0; i < 8; i++)
+    if (nthreads[i] != hwloc_bitmap_weight(cpus[i]) ||
+        hwloc_bitmap_intersects(cpus[i], cpus[(i+1)%8]))
+      break;
+  ok(i == 8 && nthreads[0] == 10 && nthreads[1] == 4 && nthreads[4] == 10 &&
+     hwloc_bitmap_last(cpus[0]) < hwloc_bitmap_first(cpus[1]),
+     "Tasks of weight 3 get 3x the cores of their NUMA domain");
+
+  /* The number of weights must match the number of tasks */
+  mpibind_set_ntasks(handle, 4);
+  ok(mpibind(handle) == 1,
+     "mpibind fails when the weights do not match the tasks");
+
+  mpibind_set_weights(handle, 0, NULL);
+  ok(mpibind(handle) == 0 && mpibind_get_weights(handle, NULL) == NULL &&
+     mpibind_get_nthreads(handle)[0] == 10,
+     "Removing the weights restores an even mapping");
+
+  mpibind_finalize(handle);
+  hwloc_topology_destroy(topo);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  plan(NO_PLAN);
+  test_weights();
+  done_testing();
+  return (0);
+}